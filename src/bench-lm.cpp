@@ -0,0 +1,422 @@
+/******************************************************************************
+IrstLM: IRST Language Model Toolkit
+Copyright (C) 2006 Marcello Federico, ITC-irst Trento, Italy
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+
+******************************************************************************/
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+#include "cmd.h"
+#include "util.h"
+#include "lmContainer.h"
+#include "lmtable.h"
+#include "tokenizer.h"
+
+using namespace std;
+using namespace irstlm;
+
+// Query traces: all n-grams are generated before timing and stored
+// with a fixed stride, oldest word first.
+
+typedef struct {
+  std::string name;
+  int stride;
+  std::vector<int> codes;
+  std::vector<int> size;
+} trace_t;
+
+static inline void push_ngram(trace_t& t, const int* ng, int sz)
+{
+  t.codes.insert(t.codes.end(), ng, ng+sz);
+  t.codes.insert(t.codes.end(), t.stride-sz, 0);
+  t.size.push_back(sz);
+}
+
+//n-grams of up to order words ending at each word of the sentences, as
+//scored by a decoder or by compile-lm --eval
+static void trace_sentences(trace_t& t, const std::vector< std::vector<int> >& text, int order)
+{
+  for (size_t s=0; s<text.size(); s++)
+    for (size_t k=0; k<text[s].size(); k++) {
+      int sz=(k+1 < (size_t) order)? k+1 : order;
+      push_ngram(t, &text[s][k+1-sz], sz);
+    }
+}
+
+//beam expansions: the history of each word is extended with the word
+//itself and with beam-1 other words, drawn by their frequency in the text
+static void trace_beam(trace_t& t, const std::vector< std::vector<int> >& text, const std::vector<int>& histo, int maxlev, int beam)
+{
+  int ng[LMTMAXLEV+1];
+  for (size_t s=0; s<text.size(); s++)
+    for (size_t k=0; k<text[s].size(); k++) {
+      int sz=(k+1 < (size_t) maxlev)? k+1 : maxlev;
+      memcpy(ng, &text[s][k+1-sz], sz*sizeof(int));
+      for (int b=0; b<beam; b++) {
+        if (b>0) ng[sz-1]=histo[rand() % histo.size()];
+        push_ngram(t, ng, sz);
+      }
+    }
+}
+
+//n-grams of the largest order made of words drawn by their frequency
+static void trace_random(trace_t& t, const std::vector<int>& histo, int maxlev, long long calls)
+{
+  int ng[LMTMAXLEV+1];
+  for (long long n=0; n<calls; n++) {
+    for (int l=0; l<maxlev; l++) ng[l]=histo[rand() % histo.size()];
+    push_ngram(t, ng, maxlev);
+  }
+}
+
+static inline long long now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//resident and peak resident memory in kB, from /proc
+static void memory_kb(long& rss, long& hwm)
+{
+  rss=hwm=-1;
+  std::ifstream inp("/proc/self/status");
+  std::string key;
+  long value;
+  while (inp >> key) {
+    if (key=="VmRSS:" && inp >> value) rss=value;
+    else if (key=="VmHWM:" && inp >> value) hwm=value;
+    else inp.ignore(1024, '\n');
+  }
+}
+
+//replays the trace one n-gram at a time or, if batch>0, in batches of
+//that many n-grams through clprob_batch; the latency of an n-gram of a
+//batch is the time of the batch divided by its size
+static void replay(lmContainer* lmt, trace_t& t, int rounds, int batch, std::vector<long long>& lat)
+{
+  long long n=t.size.size();
+  double bow;
+  int bol;
+  char* state;
+  unsigned int statesize;
+  double sum=0;
+  std::vector<int*> ngs(batch);
+  std::vector<double> logpr(batch);
+
+  lat.resize(n);
+  long long start=now_ns();
+  for (int r=0; r<rounds; r++)
+    if (batch>0) {
+      for (long long i=0; i<n; i+=batch) {
+        int m=(n-i<batch)? (int)(n-i) : batch;
+        for (int k=0; k<m; k++) ngs[k]=&t.codes[(i+k)*t.stride];
+        long long t0=now_ns();
+        lmt->clprob_batch(&ngs[0], &t.size[i], m, &logpr[0]);
+        long long t1=now_ns();
+        for (int k=0; k<m; k++) {
+          sum+=logpr[k];
+          if (r==rounds-1) lat[i+k]=(t1-t0)/m;
+        }
+      }
+    } else {
+      for (long long i=0; i<n; i++) {
+        long long t0=now_ns();
+        sum+=lmt->clprob(&t.codes[i*t.stride], t.size[i], &bow, &bol, &state, &statesize);
+        long long t1=now_ns();
+        if (r==rounds-1) lat[i]=t1-t0;
+      }
+    }
+  double secs=(now_ns()-start)/1e9;
+
+  std::sort(lat.begin(), lat.end());
+  double mean=0;
+  for (long long i=0; i<n; i++) mean+=lat[i];
+  mean/=(n>0?n:1);
+
+  std::cout << std::fixed << std::setprecision(1)
+            << "trace " << t.name;
+  if (batch>0) std::cout << "/batch" << batch;
+  std::cout << ": calls=" << n*rounds
+            << " time=" << std::setprecision(3) << secs << "s"
+            << " throughput=" << std::setprecision(0) << (secs>0? n*rounds/secs : 0) << "/s"
+            << " latency(ns) mean=" << std::setprecision(1) << mean;
+  if (n>0)
+    std::cout << " p50=" << lat[n/2] << " p99=" << lat[(n*99)/100] << " max=" << lat[n-1];
+  std::cout << " logPr=" << std::setprecision(2) << sum << std::endl;
+}
+
+//compares each logprob of the batched lookup with the one of clprob on
+//the n-gram and returns the number of n-grams on which they differ
+static long long check_batch(lmContainer* lmt, trace_t& t, int batch)
+{
+  long long n=t.size.size(), bad=0;
+  std::vector<int*> ngs(batch);
+  std::vector<double> logpr(batch);
+  ngram ng(lmt->getDict());
+
+  for (long long i=0; i<n; i+=batch) {
+    int m=(n-i<batch)? (int)(n-i) : batch;
+    for (int k=0; k<m; k++) ngs[k]=&t.codes[(i+k)*t.stride];
+    lmt->clprob_batch(&ngs[0], &t.size[i], m, &logpr[0]);
+    for (int k=0; k<m; k++) {
+      ng.size=0;
+      ng.pushc(ngs[k], t.size[i+k]);
+      if (fabs(logpr[k]-lmt->clprob(ng)) > 1e-6) bad++;
+    }
+  }
+  return bad;
+}
+
+//accesses, hits and evictions of the caches of each level; counters are
+//cumulative, hence the figures of a trace are taken from the difference
+static void cache_counts(lmContainer* lmt, std::vector<long long>& cnt)
+{
+  cnt.assign(6*(lmt->maxlevel()+1), -1);
+  if (lmt->getLanguageModelType() != _IRSTLM_LMTABLE) return;
+  lmtable* lmtb=(lmtable*) lmt;
+  for (int l=1; l<=lmt->maxlevel(); l++) {
+    long long* c=&cnt[6*l];
+    if (!lmtb->prob_and_state_cache_stat(l, c[0], c[1], c[2])) c[0]=c[1]=c[2]=-1;
+    if (!lmtb->lmtcache_stat(l, c[3], c[4], c[5])) c[3]=c[4]=c[5]=-1;
+  }
+}
+
+static void print_caches(lmContainer* lmt, const std::vector<long long>& before)
+{
+  std::vector<long long> after;
+  cache_counts(lmt, after);
+  const char* names[] = {"prob", "trie"};
+  for (int l=1; l<=lmt->maxlevel(); l++)
+    for (int k=0; k<2; k++) {
+      int o=6*l+3*k;
+      if (after[o] < 0) continue;
+      long long acc=after[o]-before[o];
+      long long hits=after[o+1]-before[o+1];
+      long long evicted=after[o+2]-before[o+2];
+      std::cout << "level " << l << " " << names[k] << " cache: acc=" << acc << " hits=" << hits
+                << " rate=" << std::setprecision(2) << (acc>0? 100.0*hits/acc : 0) << "%"
+                << " evicted=" << evicted << std::endl;
+    }
+}
+
+void print_help(int TypeFlag=0){
+  std::cerr << std::endl << "bench-lm - measures the query speed of a language model" << std::endl;
+  std::cerr << std::endl << "USAGE:"  << std::endl
+            << "       bench-lm -lm <model> -text <file> [options]" << std::endl;
+  std::cerr << std::endl << "DESCRIPTION:" << std::endl;
+  std::cerr << "       bench-lm replays query traces built from a text (sentences," << std::endl;
+  std::cerr << "       beam expansions, random n-grams, sentences with histories" << std::endl;
+  std::cerr << "       longer than the LM order) and reports throughput, latency" << std::endl;
+  std::cerr << "       percentiles, cache hit rates and memory usage. Batched" << std::endl;
+  std::cerr << "       replays are checked against the serial lookup." << std::endl;
+  std::cerr << std::endl << "OPTIONS:" << std::endl;
+
+  FullPrintParams(TypeFlag, 0, 1, stderr);
+}
+
+void usage(const char *msg = 0)
+{
+  if (msg){
+    std::cerr << msg << std::endl;
+  }
+  else{
+    print_help();
+  }
+}
+
+int main(int argc, char **argv)
+{
+  char *lm = NULL;
+  char *text = NULL;
+  char *traces = (char*) "sent,beam,random,long";
+  int mmap = 0;
+  char *salloc = NULL;
+  int requiredMaxlev = 1000;
+  int dub = 10000000;
+  int beam = 10;
+  int randcalls = 1000000;
+  int rounds = 1;
+  int batch = 0;
+  bool caches = true;
+  char *json = NULL;
+  bool perf = false;
+  bool help = false;
+
+  DeclareParams((char*)
+                "lm", CMDSTRINGTYPE|CMDMSG, &lm, "language model to use (must be specified)",
+                "text", CMDSTRINGTYPE|CMDMSG, &text, "text the query traces are built from (must be specified)",
+                "t", CMDSTRINGTYPE|CMDMSG, &text, "text the query traces are built from (must be specified)",
+                "traces", CMDSTRINGTYPE|CMDMSG, &traces, "comma separated list of traces among sent, beam, random and long; default is sent,beam,random,long",
+                "tr", CMDSTRINGTYPE|CMDMSG, &traces, "comma separated list of traces among sent, beam, random and long; default is sent,beam,random,long",
+                "memmap", CMDINTTYPE|CMDMSG, &mmap, "uses memory map to read a binary LM",
+                "mm", CMDINTTYPE|CMDMSG, &mmap, "uses memory map to read a binary LM",
+                "alloc", CMDSTRINGTYPE|CMDMSG, &salloc, "allocation policy of the in-memory tables: default, or a comma separated list of thp (transparent huge pages), hugetlb (huge pages, falling back to thp) and interleave (over NUMA nodes); default is default",
+                "al", CMDSTRINGTYPE|CMDMSG, &salloc, "allocation policy of the in-memory tables: default, or a comma separated list of thp (transparent huge pages), hugetlb (huge pages, falling back to thp) and interleave (over NUMA nodes); default is default",
+                "level", CMDINTTYPE|CMDMSG, &requiredMaxlev, "maximum level to load from the LM; if value is larger than the actual LM order, the latter is taken",
+                "lev", CMDINTTYPE|CMDMSG, &requiredMaxlev, "maximum level to load from the LM; if value is larger than the actual LM order, the latter is taken",
+                "dub", CMDINTTYPE|CMDMSG, &dub, "dictionary upperbound to compute OOV word penalty: default 10^7",
+                "beam", CMDINTTYPE|CMDMSG, &beam, "expansions of each history in the beam trace; default is 10",
+                "b", CMDINTTYPE|CMDMSG, &beam, "expansions of each history in the beam trace; default is 10",
+                "randcalls", CMDINTTYPE|CMDMSG, &randcalls, "n-grams of the random trace; default is 1000000",
+                "r", CMDINTTYPE|CMDMSG, &randcalls, "n-grams of the random trace; default is 1000000",
+                "rounds", CMDINTTYPE|CMDMSG, &rounds, "times each trace is replayed; latencies are taken from the last round; default is 1",
+                "ro", CMDINTTYPE|CMDMSG, &rounds, "times each trace is replayed; latencies are taken from the last round; default is 1",
+                "caches", CMDBOOLTYPE|CMDMSG, &caches, "enables the LM caches, if compiled in; default is true",
+                "c", CMDBOOLTYPE|CMDMSG, &caches, "enables the LM caches, if compiled in; default is true",
+                "batch", CMDINTTYPE|CMDMSG, &batch, "also replays each trace in batches of the given size through the batched lookup, to compare it with the serial one; default is 0 (serial only)",
+                "ba", CMDINTTYPE|CMDMSG, &batch, "also replays each trace in batches of the given size through the batched lookup, to compare it with the serial one; default is 0 (serial only)",
+                "json", CMDSTRINGTYPE|CMDMSG, &json, "writes the lookup counters of the LM, summed over all traces, as JSON into the given file",
+                "j", CMDSTRINGTYPE|CMDMSG, &json, "writes the lookup counters of the LM, summed over all traces, as JSON into the given file",
+                "perf", CMDBOOLTYPE|CMDMSG, &perf, "samples cycles and cache misses of the LM lookups with hardware counters, if available; default is false",
+                "p", CMDBOOLTYPE|CMDMSG, &perf, "samples cycles and cache misses of the LM lookups with hardware counters, if available; default is false",
+
+                "Help", CMDBOOLTYPE|CMDMSG, &help, "print this help",
+                "h", CMDBOOLTYPE|CMDMSG, &help, "print this help",
+
+                (char *)NULL
+                );
+
+  if (argc == 1){
+    usage();
+    exit_error(IRSTLM_NO_ERROR);
+  }
+
+  GetParams(&argc, &argv, (char*) NULL);
+
+  if (help){
+    usage();
+    exit_error(IRSTLM_NO_ERROR);
+  }
+
+  if (lm == NULL || text == NULL){
+    usage();
+    exit_error(IRSTLM_ERROR_DATA,"Missing parameter: please, specify the LM (-lm) and the text (-text)");
+  }
+  if (rounds < 1) rounds = 1;
+  if (beam < 1) beam = 1;
+  if (batch < 0) batch = 0;
+
+  long rss0, hwm0, rss1, hwm1;
+  memory_kb(rss0, hwm0);
+
+  lmContainer* lmt = lmContainer::CreateLanguageModel(lm);
+  lmt->setMaxLoadedLevel(requiredMaxlev);
+  if (salloc) lmt->setAllocPolicy(PAllocPolicy(salloc));
+  long long t0 = now_ns();
+  lmt->load(lm, mmap);
+  double loadtime = (now_ns()-t0)/1e9;
+  lmt->setlogOOVpenalty(dub);
+  if (caches) lmt->init_caches(lmt->maxlevel());
+  if (perf && lmt->getLanguageModelType() == _IRSTLM_LMTABLE)
+    ((lmtable*) lmt)->instrument(LMT_INSTR_COUNTS|LMT_INSTR_PERF);
+
+  memory_kb(rss1, hwm1);
+
+  std::cout << "model: " << lm << " order=" << lmt->maxlevel() << " mmap=" << mmap;
+  if (lmt->getLanguageModelType() == _IRSTLM_LMTABLE) {
+    lmtable* lmtb = (lmtable*) lmt;
+    std::cout << " quantized=" << lmtb->isQuantized() << " alloc=";
+    for (int l=1; l<=lmt->maxlevel(); l++)
+      std::cout << (l>1? "/" : "") << ((mmap>0 && l>=mmap)? std::string("memmap") : PAllocName(lmtb->alloc_kind(l)));
+  }
+  std::string cachelist;
+#ifdef PS_CACHE_ENABLE
+  cachelist += "prob ";
+#endif
+#ifdef LMT_CACHE_ENABLE
+  cachelist += "trie ";
+#endif
+  if (!caches || cachelist.empty()) cachelist = "none ";
+  std::cout << " caches=" << cachelist.substr(0, cachelist.size()-1) << std::endl;
+  std::cout << std::fixed << std::setprecision(3) << "load: time=" << loadtime << "s rss=" << (rss1-rss0) << "kB" << std::endl;
+
+  //the text is encoded without extending the dictionary
+  dictionary* dict = lmt->getDict();
+  dict->genoovcode();
+  std::vector< std::vector<int> > sents;
+  std::vector<int> histo;
+  {
+    std::fstream inp(text, std::ios::in);
+    if (!inp) exit_error(IRSTLM_ERROR_IO, std::string("cannot open ")+text);
+    tokenizer tok(inp);
+    while (tok.getline()>=0) {
+      int n = tok.encode(dict);
+      sents.push_back(std::vector<int>(tok.code(), tok.code()+n));
+      histo.insert(histo.end(), tok.code(), tok.code()+n);
+    }
+  }
+  if (histo.empty()) exit_error(IRSTLM_ERROR_DATA, "the text is empty");
+
+  srand(1234);
+  int maxlev = lmt->maxlevel();
+  std::string list = std::string(",") + traces + ",";
+  std::vector<long long> lat;
+  long long mismatches = 0;
+  const char* names[] = {"sent", "beam", "random", "long"};
+
+  for (int k=0; k<4; k++) {
+    if (list.find(std::string(",") + names[k] + ",") == std::string::npos) continue;
+    trace_t t;
+    t.name = names[k];
+    t.stride = (k==3)? maxlev+2 : maxlev;
+    if (k==0) trace_sentences(t, sents, maxlev);
+    else if (k==1) trace_beam(t, sents, histo, maxlev, beam);
+    else if (k==2) trace_random(t, histo, maxlev, randcalls);
+    else trace_sentences(t, sents, maxlev+2); //two words more than used
+
+    for (int b=0; b<=(batch>0? 1 : 0); b++) {
+      std::vector<long long> before;
+      if (caches) lmt->reset_caches();
+      cache_counts(lmt, before);
+      replay(lmt, t, rounds, b? batch : 0, lat);
+      print_caches(lmt, before);
+    }
+    if (batch>0) {
+      long long bad=check_batch(lmt, t, batch);
+      std::cout << "check " << t.name << "/batch" << batch << ": "
+                << bad << " of " << t.size.size() << " logprobs differ from clprob" << std::endl;
+      mismatches+=bad;
+    }
+  }
+
+  memory_kb(rss1, hwm1);
+  std::cout << "memory: rss=" << rss1 << "kB peak=" << hwm1 << "kB" << std::endl;
+
+  if (json) {
+    if (lmt->getLanguageModelType() != _IRSTLM_LMTABLE)
+      std::cerr << "bench-lm: lookup counters are only available for plain LM tables" << std::endl;
+    else {
+      std::fstream out(json, std::ios::out);
+      if (!out) exit_error(IRSTLM_ERROR_IO, std::string("cannot open ")+json);
+      ((lmtable*) lmt)->stat_json(out);
+    }
+  }
+
+  delete lmt;
+  if (mismatches > 0)
+    exit_error(IRSTLM_ERROR_GENERIC, "bench-lm: the batched lookup differs from clprob");
+  return 0;
+}
@@ -0,0 +1,63 @@
+/******************************************************************************
+ IrstLM: IRST Language Model Toolkit
+ Copyright (C) 2006 Marcello Federico, ITC-irst Trento, Italy
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+
+ ******************************************************************************/
+
+/* Bounded blocking queue between the stages of a pipeline.
+ *
+ * push() waits while the queue is full, pop() while it is empty, so
+ * that a fast stage can be at most cap items ahead of the next one.
+ * By convention a NULL item marks the end of data.
+ */
+
+#ifndef _BQUEUE_
+#define _BQUEUE_
+
+#include <deque>
+#include <pthread.h>
+
+template<class T> class bqueue{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	std::deque<T*> q;
+	size_t cap;
+public:
+	bqueue(size_t c):cap(c){
+		pthread_mutex_init(&lock,NULL); pthread_cond_init(&cond,NULL);
+	}
+	~bqueue(){
+		pthread_mutex_destroy(&lock); pthread_cond_destroy(&cond);
+	}
+	void push(T* b){
+		pthread_mutex_lock(&lock);
+		while (q.size()>=cap) pthread_cond_wait(&cond,&lock);
+		q.push_back(b);
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+	T* pop(){
+		pthread_mutex_lock(&lock);
+		while (q.empty()) pthread_cond_wait(&cond,&lock);
+		T* b=q.front(); q.pop_front();
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+		return b;
+	}
+};
+
+#endif
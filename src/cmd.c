@@ -487,6 +487,7 @@ BuildCmdList(Cmd_T	**cmdp,
 			case CMDDOUBLETYPE:	/* nothing else is needed	 */
 			case CMDFLOATTYPE:
 			case CMDINTTYPE:
+			case CMDLONGLONGTYPE:
 			case CMDSTRINGTYPE:
 				break;
 			default:
@@ -568,6 +569,11 @@ PrintParam(Cmd_T	*cmd,
 		case CMDFLAGTYPE:
 			PrintFlag(cmd, TypeFlag, ValFlag, fp);
 			break;
+		case CMDLONGLONGTYPE:
+			fprintf(fp, "%s", cmd->Name);
+			if(TypeFlag) fprintf(fp, " [long long]");
+			if(ValFlag) fprintf(fp, ": %lld", *(long long*)cmd->Val);
+			break;
 		case CMDINTTYPE:
 			if(TypeFlag) sprintf(ts, " [int]");
 		case CMDSUBRANGETYPE:
@@ -744,6 +750,14 @@ SetParam(Cmd_T	*cmd,
 				exit(IRSTLM_CMD_ERROR_DATA);
 			}
 			break;
+		case CMDLONGLONGTYPE:
+			if(sscanf(s, "%lli", (long long*)cmd->Val)!=1) {
+				fprintf(stderr,
+								"Integer value required for parameter \"%s\"\n",
+								cmd->Name);
+				exit(IRSTLM_CMD_ERROR_DATA);
+			}
+			break;
 		case CMDSTRINGTYPE:
 			*(char **)cmd->Val = (strcmp(s, "<NULL>") && strcmp(s, "NULL"))
 			? strdup(s)
@@ -55,6 +55,7 @@
 #define	CMDINTARRAYTYPE	11
 #define	CMDDBLARRAYTYPE	12
 #define	CMDFLOATTYPE	13
+#define	CMDLONGLONGTYPE	14
 
 #define CMDMSG		(1<<31)
 
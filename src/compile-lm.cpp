@@ -25,15 +25,155 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <sstream>
 #include <stdlib.h>
 #include "cmd.h"
 #include "util.h"
 #include "math.h"
 #include "lmContainer.h"
+#include "lmtable.h"
+#include "ngramcache.h"
+#include "tokenizer.h"
+#include "wspool.h"
 
 using namespace std;
 using namespace irstlm;
 
+#define EVAL_CHUNKSIZE 100000 //words scored by a job of the parallel evaluation
+#define EVAL_CACHESIZE 200000 //n-grams cached per level by each thread
+
+//perplexity statistics, for the whole text and for the current sentence
+typedef struct evalstat {
+  int Nbo, Nw, Noov;
+  double logPr;
+  int sent_Nbo, sent_Nw, sent_Noov;
+  double sent_logPr;
+
+  evalstat(): Nbo(0), Nw(0), Noov(0), logPr(0), sent_Nbo(0), sent_Nw(0), sent_Noov(0), sent_logPr(0) {};
+
+  //accounts for a scored word; prints the perplexity of a sentence at its end
+  void add(double Pr, int bol, bool oov, bool eos, bool sent_PP_flag, double oovpenalty) {
+    logPr+=Pr;
+    sent_logPr+=Pr;
+    if (oov) {
+      Noov++;
+      sent_Noov++;
+    }
+    if (bol) {
+      Nbo++;
+      sent_Nbo++;
+    }
+    Nw++;
+    sent_Nw++;
+    if (sent_PP_flag && eos) {
+      double sent_PP=exp((-sent_logPr * log(10.0)) /sent_Nw);
+      double sent_PPwp= sent_PP * (1 - 1/exp((sent_Noov * oovpenalty) * log(10.0) / sent_Nw));
+
+      std::cout << "%% sent_Nw=" << sent_Nw
+                << " sent_PP=" << sent_PP
+                << " sent_PPwp=" << sent_PPwp
+                << " sent_Nbo=" << sent_Nbo
+                << " sent_Noov=" << sent_Noov
+                << " sent_OOV=" << (float)sent_Noov/sent_Nw * 100.0 << "%" << std::endl;
+      //reset statistics for sentence based Perplexity
+      sent_Nw=sent_Noov=sent_Nbo=0;
+      sent_logPr=0.0;
+    }
+  }
+} evalstat_t;
+
+//prints the score of an n-gram for debug levels 1 to 4
+static void print_eval(std::ostream& out, ngram& ng, int debug, int eos, double Pr, double bow, int bol, char* msp, unsigned int statesize)
+{
+  if (debug==1) {
+    out << ng.dict->decode(*ng.wordp(1)) << " [" << ng.size-bol << "]" << " ";
+    if (*ng.wordp(1)==eos) out << std::endl;
+  }
+  else if (debug==2) {
+    out << ng << " [" << ng.size-bol << "-gram]" << " " << Pr;
+    out << std::endl;
+  }
+  else if (debug==3) {
+    out << ng << " [" << ng.size-bol << "-gram]" << " " << Pr << " bow:" << bow;
+    out << std::endl;
+  }
+  else if (debug==4) {
+    out << ng << " [" << ng.size-bol << "-gram: recombine:" << statesize << " state:" << (void*) msp << "] [" << ng.size+1-((bol==0)?(1):bol) << "-gram: bol:" << bol << "] " << Pr << " bow:" << bow;
+    out << std::endl;
+  }
+}
+
+//parallel evaluation: the text is split into chunks of words, each one
+//preceded by the words of the previous chunk needed as context; chunks
+//are scored by a pool of threads and their scores are accounted in order
+typedef struct {
+  double Pr;
+  int bol;
+  bool oov;
+  bool eos;
+  size_t out; //end of the debug output of the word
+} evalword_t;
+
+typedef struct {
+  std::vector<int> codes; //words of the chunk, the first nwarm are context only
+  size_t nwarm;
+  std::vector<evalword_t> words;
+  std::string out;        //debug output of the chunk
+} evalchunk_t;
+
+typedef struct {
+  lmContainer* lmt;
+  int debug;
+  int bos, eos;
+  evalchunk_t* chunks;
+  std::vector< std::vector<ngramcache*> >* caches; //by thread and level
+} evalctx_t;
+
+static void eval_range(void* ctx, long long i)
+{
+  evalctx_t* e=(evalctx_t*) ctx;
+  evalchunk_t& c=e->chunks[i];
+  int th=wspool_thread_id();
+  std::vector<ngramcache*>& cache=(*e->caches)[th<0?0:th];
+  int maxlev=e->lmt->maxlevel();
+
+  ngram ng(e->lmt->getDict());
+  std::ostringstream out;
+  out.setf(ios::fixed);
+  out.precision(2);
+  c.words.clear();
+
+  for (size_t k=0; k<c.codes.size(); k++) {
+    ng.pushc(c.codes[k]);
+    ng.freq=1;
+    if (ng.size>maxlev) ng.size=maxlev;
+
+    // reset ngram at begin of sentence
+    if (*ng.wordp(1)==e->bos) {
+      ng.size=1;
+      continue;
+    }
+    if (k<c.nwarm) continue;
+
+    prob_and_state_t pst;
+    if (!cache[ng.size]->get(ng.wordp(ng.size), pst)) {
+      pst.logpr=e->lmt->clprob(ng, &pst.bow, &pst.bol, &pst.state, &pst.statesize);
+      if (cache[ng.size]->isfull()) cache[ng.size]->reset();
+      cache[ng.size]->add(ng.wordp(ng.size), pst);
+    }
+    if (e->debug) print_eval(out, ng, e->debug, e->eos, pst.logpr, pst.bow, pst.bol, pst.state, pst.statesize);
+
+    evalword_t w;
+    w.Pr=pst.logpr;
+    w.bol=pst.bol;
+    w.oov=e->lmt->is_OOV(*ng.wordp(1));
+    w.eos=(*ng.wordp(1)==e->eos);
+    w.out=out.tellp();
+    c.words.push_back(w);
+  }
+  c.out=out.str();
+}
+
 /********************************/
 void print_help(int TypeFlag=0){
   std::cerr << std::endl << "compile-lm - compiles an ARPA format LM into an IRSTLM format one" << std::endl;
@@ -63,6 +203,7 @@ int main(int argc, char **argv)
   char *seval=NULL;
 	char *tmpdir=NULL;
 	char *sfilter=NULL;
+	char *sfilterlist=NULL;
 	
 	bool textoutput = false;
 	bool sent_PP_flag = false;
@@ -72,7 +213,9 @@ int main(int argc, char **argv)
 	bool skeepunigrams = false;
 	
 	int debug = 0;
+	int threads = 1;
   bool memmap = false;
+  char *salloc = NULL;
   int requiredMaxlev = 1000;
   int dub = 10000000;
   int randcalls = 0;
@@ -87,6 +230,8 @@ int main(int argc, char **argv)
                 "t", CMDBOOLTYPE|CMDMSG, &textoutput, "output is again in text format; default is false",
                 "filter", CMDSTRINGTYPE|CMDMSG, &sfilter, "filter a binary language model with a word list",
                 "f", CMDSTRINGTYPE|CMDMSG, &sfilter, "filter a binary language model with a word list",
+                "filterlist", CMDSTRINGTYPE|CMDMSG, &sfilterlist, "filter the LM with many word lists: each line of the file gives a word list and the binary LM to write",
+                "fl", CMDSTRINGTYPE|CMDMSG, &sfilterlist, "filter the LM with many word lists: each line of the file gives a word list and the binary LM to write",
                 "keepunigrams", CMDBOOLTYPE|CMDMSG, &skeepunigrams, "filter by keeping all unigrams in the table, default  is true",
                 "ku", CMDBOOLTYPE|CMDMSG, &skeepunigrams, "filter by keeping all unigrams in the table, default  is true",
                 "eval", CMDSTRINGTYPE|CMDMSG, &seval, "computes perplexity of the specified text file",
@@ -103,6 +248,10 @@ int main(int argc, char **argv)
 								"l", CMDINTTYPE|CMDMSG, &requiredMaxlev, "maximum level to load from the LM; if value is larger than the actual LM order, the latter is taken",
                 "memmap", CMDBOOLTYPE|CMDMSG, &memmap, "uses memory map to read a binary LM",
 								"mm", CMDBOOLTYPE|CMDMSG, &memmap, "uses memory map to read a binary LM",
+                "alloc", CMDSTRINGTYPE|CMDMSG, &salloc, "allocation policy of the in-memory tables: default, or a comma separated list of thp (transparent huge pages), hugetlb (huge pages, falling back to thp) and interleave (over NUMA nodes); default is default",
+								"al", CMDSTRINGTYPE|CMDMSG, &salloc, "allocation policy of the in-memory tables: default, or a comma separated list of thp (transparent huge pages), hugetlb (huge pages, falling back to thp) and interleave (over NUMA nodes); default is default",
+                "threads", CMDINTTYPE|CMDMSG, &threads, "number of threads used for filtering and evaluation; default is 1",
+								"th", CMDINTTYPE|CMDMSG, &threads, "number of threads used for filtering and evaluation; default is 1",
                 "dub", CMDINTTYPE|CMDMSG, &dub, "dictionary upperbound to compute OOV word penalty: default 10^7",
                 "tmpdir", CMDSTRINGTYPE|CMDMSG, &tmpdir, "directory for temporary computation, default is either the environment variable TMP if defined or \"/tmp\")",
                 "invert", CMDBOOLTYPE|CMDMSG, &invert, "builds an inverted n-gram binary table for fast access; default if false",
@@ -188,8 +337,41 @@ int main(int argc, char **argv)
   if (invert) lmt->is_inverted(invert);
 
   lmt->setMaxLoadedLevel(requiredMaxlev);
+  if (salloc) lmt->setAllocPolicy(PAllocPolicy(salloc));
+
+  lmt->load(infile,memmap?1:0);
+
+  //filtering towards a binary LM: the filtered LM is directly written
+  //without being built in memory; with a list of word lists, the LM is
+  //read once (possibly memory mapped) and filtered with each of them
+  bool filtersave = (sfilter != NULL && !textoutput && seval == NULL && !sscore && !ngramscore);
+  if ((sfilterlist != NULL || filtersave) && lmt->getLanguageModelType() == _IRSTLM_LMTABLE) {
+    lmtable* lmtb = (lmtable*) lmt;
+    std::vector<std::string> wlists, outfiles;
+
+    if (sfilterlist != NULL) {
+      std::ifstream inp(sfilterlist);
+      if (!inp) exit_error(IRSTLM_ERROR_IO, std::string("cannot open ") + sfilterlist);
+      std::string wlist, wout;
+      while (inp >> wlist >> wout) {
+        wlists.push_back(wlist);
+        outfiles.push_back(wout);
+      }
+    } else {
+      wlists.push_back(sfilter);
+      outfiles.push_back(outfile);
+    }
 
-  lmt->load(infile);
+    for (size_t k=0; k<wlists.size(); k++) {
+      std::cerr << "filtering with " << wlists[k] << " to " << outfiles[k] << std::endl;
+      dictionary subdict((char*) wlists[k].c_str());
+      lmt_filter_t* f = lmtb->filter_select(&subdict, skeepunigrams, threads);
+      lmtb->filter_savebin(f, outfiles[k].c_str());
+      lmtb->filter_free(f);
+    }
+    delete lmt;
+    return 0;
+  }
 
   //CHECK this part for sfilter to make it possible only for LMTABLE
   if (sfilter != NULL) {
@@ -283,12 +465,8 @@ int main(int argc, char **argv)
       //			if (debug>0) std::cout.precision(8);
       std::fstream inptxt(seval,std::ios::in);
 			
-      int Nbo=0, Nw=0,Noov=0;
-      double logPr=0,PP=0,PPwp=0,Pr;
-
-      // variables for storing sentence-based Perplexity
-      int sent_Nbo=0, sent_Nw=0,sent_Noov=0;
-      double sent_logPr=0,sent_PP=0,sent_PPwp=0;
+      evalstat_t st;
+      double PP=0,PPwp=0,Pr;
 
 
       ng.dict->incflag(1);
@@ -303,101 +481,130 @@ int main(int argc, char **argv)
 
       lmt->dictionary_incflag(1);
 
-      while(inptxt >> ng) {
+      tokenizer tok(inptxt);
 
-        if (ng.size>lmt->maxlevel()) ng.size=lmt->maxlevel();
+      //the model is shared by the threads only if it is read-only
+      bool parallel=(threads>1 && debug<=4 && lmt->getLanguageModelType() == _IRSTLM_LMTABLE);
+#if defined(PS_CACHE_ENABLE) || defined(LMT_CACHE_ENABLE)
+      parallel=false;
+#endif
+
+      if (parallel) {
+        wspool pool=wspool_init(threads);
+        int maxlev=lmt->maxlevel();
+        std::vector< std::vector<ngramcache*> > caches(threads, std::vector<ngramcache*>(maxlev+1, (ngramcache*) NULL));
+        for (int t=0; t<threads; t++)
+          for (int l=1; l<=maxlev; l++)
+            caches[t][l]=new ngramcache(l, sizeof(prob_and_state_t), EVAL_CACHESIZE);
+
+        int nchunks=4*threads;
+        std::vector<evalchunk_t> chunks(nchunks);
+        evalctx_t ctx;
+        ctx.lmt=lmt;
+        ctx.debug=debug;
+        ctx.bos=bos;
+        ctx.eos=eos;
+        ctx.chunks=&chunks[0];
+        ctx.caches=&caches;
+
+        std::vector<int> hist; //last words read, context of the next chunk
+        bool more=true;
+        while (more) {
+          int nc=0;
+          for (; nc<nchunks && more; nc++) {
+            evalchunk_t& c=chunks[nc];
+            c.codes.assign(hist.begin(), hist.end());
+            c.nwarm=hist.size();
+            while (c.codes.size()-c.nwarm < EVAL_CHUNKSIZE) {
+              if (tok.getline()<0) {
+                more=false;
+                break;
+              }
+              int len=tok.encode(ng.dict);
+              c.codes.insert(c.codes.end(), tok.code(), tok.code()+len);
+            }
+            size_t h=(c.codes.size() < (size_t) maxlev-1)? c.codes.size() : maxlev-1;
+            hist.assign(c.codes.end()-h, c.codes.end());
+          }
 
-        // reset ngram at begin of sentence
-        if (*ng.wordp(1)==bos) {
-					ng.size=1;
-          continue;
+          wspool_parallel_for(pool, 0, nc, 1, eval_range, &ctx);
+
+          for (int i=0; i<nc; i++) {
+            evalchunk_t& c=chunks[i];
+            size_t o=0;
+            for (size_t k=0; k<c.words.size(); k++) {
+              evalword_t& w=c.words[k];
+              std::cout.write(c.out.data()+o, w.out-o);
+              o=w.out;
+              st.add(w.Pr, w.bol, w.oov, w.eos, sent_PP_flag, lmt->getlogOOVpenalty());
+              if ((st.Nw % 100000)==0) std::cerr << ".";
+            }
+          }
         }
 
-        if (ng.size>=1) {
-          Pr=lmt->clprob(ng,&bow,&bol,&msp,&statesize);
-          logPr+=Pr;
-          sent_logPr+=Pr;
+        for (int t=0; t<threads; t++)
+          for (int l=1; l<=maxlev; l++) delete caches[t][l];
+        wspool_destroy(pool);
+      } else {
+        while(tok.getline()>=0) {
+          for(int k=0, len=tok.encode(ng.dict); k<len; k++) {
+            ng.pushc(tok.code()[k]);
+            ng.freq=1;
 
-          if (debug==1) {
-            std::cout << ng.dict->decode(*ng.wordp(1)) << " [" << ng.size-bol << "]" << " ";
-            if (*ng.wordp(1)==eos) std::cout << std::endl;
-          }
-          else if (debug==2) {
-            std::cout << ng << " [" << ng.size-bol << "-gram]" << " " << Pr;
-            std::cout << std::endl;
-          }
-          else if (debug==3) {
-            std::cout << ng << " [" << ng.size-bol << "-gram]" << " " << Pr << " bow:" << bow;
-            std::cout << std::endl;
-          }
-          else if (debug==4) {
-            std::cout << ng << " [" << ng.size-bol << "-gram: recombine:" << statesize << " state:" << (void*) msp << "] [" << ng.size+1-((bol==0)?(1):bol) << "-gram: bol:" << bol << "] " << Pr << " bow:" << bow;
-            std::cout << std::endl;
-          }
-          else if (debug>4) {
-            std::cout << ng << " [" << ng.size-bol << "-gram: recombine:" << statesize << " state:" << (void*) msp << "] [" << ng.size+1-((bol==0)?(1):bol) << "-gram: bol:" << bol << "] " << Pr << " bow:" << bow;
-            double totp=0.0;
-            int oldw=*ng.wordp(1);
-            double oovp=lmt->getlogOOVpenalty();
-            lmt->setlogOOVpenalty((double) 0);
-            for (int c=0; c<ng.dict->size(); c++) {
-              *ng.wordp(1)=c;
-              totp+=pow(10.0,lmt->clprob(ng)); //using caches if available
+            if (ng.size>lmt->maxlevel()) ng.size=lmt->maxlevel();
+
+            // reset ngram at begin of sentence
+            if (*ng.wordp(1)==bos) {
+              ng.size=1;
+              continue;
             }
-            *ng.wordp(1)=oldw;
 
-            if ( totp < (1.0 - 1e-5) || totp > (1.0 + 1e-5))
-              std::cout << "  [t=" << totp << "] POSSIBLE ERROR";
-            std::cout << std::endl;
+            if (ng.size>=1) {
+              Pr=lmt->clprob(ng,&bow,&bol,&msp,&statesize);
 
-            lmt->setlogOOVpenalty((double)oovp);
-          }
+              if (debug>=1 && debug<=4) print_eval(std::cout, ng, debug, eos, Pr, bow, bol, msp, statesize);
+              else if (debug>4) {
+                std::cout << ng << " [" << ng.size-bol << "-gram: recombine:" << statesize << " state:" << (void*) msp << "] [" << ng.size+1-((bol==0)?(1):bol) << "-gram: bol:" << bol << "] " << Pr << " bow:" << bow;
+                double totp=0.0;
+                int oldw=*ng.wordp(1);
+                double oovp=lmt->getlogOOVpenalty();
+                lmt->setlogOOVpenalty((double) 0);
+                for (int c=0; c<ng.dict->size(); c++) {
+                  *ng.wordp(1)=c;
+                  totp+=pow(10.0,lmt->clprob(ng)); //using caches if available
+                }
+                *ng.wordp(1)=oldw;
 
+                if ( totp < (1.0 - 1e-5) || totp > (1.0 + 1e-5))
+                  std::cout << "  [t=" << totp << "] POSSIBLE ERROR";
+                std::cout << std::endl;
 
-          if (lmt->is_OOV(*ng.wordp(1))) {
-            Noov++;
-            sent_Noov++;
-          }
-          if (bol) {
-            Nbo++;
-            sent_Nbo++;
-          }
-          Nw++;
-          sent_Nw++;
-          if (sent_PP_flag && (*ng.wordp(1)==eos)) {
-            sent_PP=exp((-sent_logPr * log(10.0)) /sent_Nw);
-            sent_PPwp= sent_PP * (1 - 1/exp((sent_Noov *  lmt->getlogOOVpenalty()) * log(10.0) / sent_Nw));
-
-            std::cout << "%% sent_Nw=" << sent_Nw
-                      << " sent_PP=" << sent_PP
-                      << " sent_PPwp=" << sent_PPwp
-                      << " sent_Nbo=" << sent_Nbo
-                      << " sent_Noov=" << sent_Noov
-                      << " sent_OOV=" << (float)sent_Noov/sent_Nw * 100.0 << "%" << std::endl;
-            //reset statistics for sentence based Perplexity
-            sent_Nw=sent_Noov=sent_Nbo=0;
-            sent_logPr=0.0;
-          }
+                lmt->setlogOOVpenalty((double)oovp);
+              }
 
-          if ((Nw % 100000)==0) {
-            std::cerr << ".";
-            lmt->check_caches_levels();
-          }
+              st.add(Pr, bol, lmt->is_OOV(*ng.wordp(1)), *ng.wordp(1)==eos, sent_PP_flag, lmt->getlogOOVpenalty());
+
+              if ((st.Nw % 100000)==0) {
+                std::cerr << ".";
+                lmt->check_caches_levels();
+              }
 
+            }
+          }
         }
       }
 
-      PP=exp((-logPr * log(10.0)) /Nw);
+      PP=exp((-st.logPr * log(10.0)) /st.Nw);
 
-      PPwp= PP * (1 - 1/exp((Noov *  lmt->getlogOOVpenalty()) * log(10.0) / Nw));
+      PPwp= PP * (1 - 1/exp((st.Noov *  lmt->getlogOOVpenalty()) * log(10.0) / st.Nw));
 
-      std::cout << "%% Nw=" << Nw
+      std::cout << "%% Nw=" << st.Nw
                 << " PP=" << PP
                 << " PPwp=" << PPwp
-                << " Nbo=" << Nbo
-                << " Noov=" << Noov
-                << " OOV=" << (float)Noov/Nw * 100.0 << "%";
-      if (debug) std::cout << " logPr=" <<  logPr;
+                << " Nbo=" << st.Nbo
+                << " Noov=" << st.Noov
+                << " OOV=" << (float)st.Noov/st.Nw * 100.0 << "%";
+      if (debug) std::cout << " logPr=" <<  st.logPr;
       std::cout << std::endl;
 
       if (debug>1) lmt->used_caches();
@@ -505,7 +712,7 @@ int main(int argc, char **argv)
   if (textoutput == true) {
     std::cerr << "Saving in txt format to " << outfile << std::endl;
     lmt->savetxt(outfile.c_str());
-  } else if (!memmap) {
+  } else if (!memmap || sfilter != NULL) {
     std::cerr << "Saving in bin format to " << outfile << std::endl;
     lmt->savebin(outfile.c_str());
   } else {
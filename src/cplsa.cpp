@@ -24,7 +24,7 @@
 #include <string>
 #include <sstream>
 #include <pthread.h>
-#include "thpool.h"
+#include "wspool.h"
 #include "mfstream.h"
 #include "mempool.h"
 #include "htable.h"
@@ -458,8 +458,7 @@ int plsa::train(char *trainfile, char *modelfile, int maxiter,float noiseW,int s
     int r=topics;
     
     cerr << "Starting training \n";
-    threadpool thpool=thpool_init(threads);
-    task *t=new task[trset->numdoc()];
+    wspool pool=wspool_init(threads);
     
     pthread_mutex_init(&mut1, NULL);
     //pthread_mutex_init(&mut2, NULL);
@@ -472,14 +471,8 @@ int plsa::train(char *trainfile, char *modelfile, int maxiter,float noiseW,int s
         //initialize T table
         initT();
         
-        for (long long d=0;d<trset->numdoc();d++){
-            //prepare and assign tasks to threads
-            t[d].ctx=this; t[d].argv=(void *)d;
-            thpool_add_work(thpool, &plsa::expected_counts_helper, (void *)&t[d]);
-            
-        }
-        //join all threads
-        thpool_wait(thpool);
+        //compute expected counts of all documents
+        wspool_parallel_for(pool,0,trset->numdoc(),0,&plsa::expected_counts_range,(void *)this);
         
         //Recombination and normalization of expected counts
         for (int t=0; t<r; t++) {
@@ -497,13 +490,12 @@ int plsa::train(char *trainfile, char *modelfile, int maxiter,float noiseW,int s
     }
     
     //destroy thread pool
-    thpool_destroy(thpool);
+    wspool_destroy(pool);
   
     
     freeH(); freeT(); freeW();
     
     delete trset;
-    delete [] t;
     
     return 1;
 }
@@ -601,44 +593,34 @@ int plsa::inference(char *testfile, char* modelfile, int maxit, char* topicfeatf
     //use one vector H for all document
     H=new float[topics*bucket]; memset(H,0,sizeof(float)*(long long)topics*bucket);
     
-    threadpool thpool=thpool_init(threads);
-    task *t=new task[bucket];
-
+    wspool pool=wspool_init(threads);
     
     cerr << "Start inference: ";
     
-    for (long long d=0;d<trset->numdoc();d++){
+    for (long long d=0;d<trset->numdoc();d+=bucket){
         
-        t[d % bucket].ctx=this; t[d % bucket].argv=(void *)d;
-        thpool_add_work(thpool, &plsa::single_inference_helper, (void *)&t[d % bucket]);
+        //infer one bucket of documents: they take very different times
+        int size=MIN(bucket,trset->numdoc()-d);
+        wspool_parallel_for(pool,d,d+size,1,&plsa::single_inference_range,(void *)this);
         
-        if (((d % bucket) == (bucket-1)) || (d==(trset->numdoc()-1)) ){
-            //join all threads
-            thpool_wait(thpool);
-            
-            if ((d % bucket) != (bucket-1))
-                    bucket=trset->numdoc() % bucket; //last bucket at end of file
+        if (topicfeatfile){
+            mfstream out(topicfeatfile,ios::out | ios::app);
             
-            if (topicfeatfile){
-                mfstream out(topicfeatfile,ios::out | ios::app);
-                
-                for (int b=0;b<bucket;b++){ //include the case of
-                    out << H[b * topics];
-                    for (int t=1; t<topics; t++) out << " "  << H[b * topics + t];
-                    out << "\n";
-                }
+            for (int b=0;b<size;b++){ //include the case of
+                out << H[b * topics];
+                for (int t=1; t<topics; t++) out << " "  << H[b * topics + t];
+                out << "\n";
             }
-            if (wordfeatfile){
-                //cout << "from: " << d-bucket << " to: " << d-1 << "\n";
-                for (int b=0;b<bucket;b++) saveWordFeatures(wordfeatfile,d-bucket+b);
-            }
-            
         }
-       
+        if (wordfeatfile){
+            for (int b=0;b<size;b++) saveWordFeatures(wordfeatfile,d+b);
+        }
         
     }
     
-    delete [] H; delete [] t;
+    wspool_destroy(pool);
+    
+    delete [] H;
     delete trset;
     return 1;
 }
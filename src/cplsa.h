@@ -37,10 +37,6 @@ class plsa {
     int  threads;
     int bucket; //parallel inference
     int maxiter; //maximum iterations for inference
-    struct task {
-        void *ctx;
-        void *argv;
-    };
     
 public:
    
@@ -58,14 +54,12 @@ public:
 
     void expected_counts(void *argv);
 
-    static void *expected_counts_helper(void *argv){
-        task t=*(task *)argv;
-        ((plsa *)t.ctx)->expected_counts(t.argv);return NULL;
+    static void expected_counts_range(void *ctx,long long d){
+        ((plsa *)ctx)->expected_counts((void *)d);
     };
     
-    static void *single_inference_helper(void *argv){
-        task t=*(task *)argv;
-        ((plsa *)t.ctx)->single_inference(t.argv);return NULL;
+    static void single_inference_range(void *ctx,long long d){
+        ((plsa *)ctx)->single_inference((void *)d);
     };
     
     int train(char *trainfile,char* modelfile, int maxiter, float noiseW,int spectopic=0);
@@ -20,9 +20,9 @@
 
 
 #include <iostream>
+#include <cstring>
 #include "cmd.h"
 #include <pthread.h>
-#include "thpool.h"
 #include "util.h"
 #include "mfstream.h"
 #include "mempool.h"
@@ -60,11 +60,14 @@ int main(int argc, char **argv){
     char *w2vfile=NULL;
     char *modelfile=NULL;
     char *alignfile=NULL;
+    char *streamfile=NULL;
 
     bool forcemodel=false;
     
     int iterations=0;       //number of EM iterations to run
+    int benchrounds=0;      //rounds of kernel benchmark to run
     int threads=1;          //current EM iteration for multi-thread training
+    int batchsize=1000;     //sentence pairs per batch in streaming alignment
     bool help=false;
     int prunethreshold=3;
     bool trainvar=true;
@@ -90,9 +93,18 @@ int main(int argc, char **argv){
                   "Iterations", CMDINTTYPE|CMDMSG, &iterations, "<count> : training iterations",
                   "it", CMDINTTYPE|CMDMSG, &iterations, "<count> : training iterations",
                   
+                  "Benchmark", CMDINTTYPE|CMDMSG, &benchrounds, "<count> : rounds of Gaussian kernel benchmark on data",
+                  "bm", CMDINTTYPE|CMDMSG, &benchrounds, "<count> : rounds of Gaussian kernel benchmark on data",
+                  
                   "Alignments", CMDSTRINGTYPE|CMDMSG, &alignfile, "<fname> : output alignment file",
                   "al", CMDSTRINGTYPE|CMDMSG, &alignfile, "<fname> : output alignment file",
                   
+                  "Stream", CMDSTRINGTYPE|CMDMSG, &streamfile, "<fname> : align sentence pairs 'source ||| target', one per line, as they are read (- for stdin)",
+                  "st", CMDSTRINGTYPE|CMDMSG, &streamfile, "<fname> : align sentence pairs 'source ||| target', one per line, as they are read (- for stdin)",
+                  
+                  "BatchSize", CMDINTTYPE|CMDMSG, &batchsize, "<count> : sentence pairs per batch in streaming alignment (default 1000)",
+                  "bs", CMDINTTYPE|CMDMSG, &batchsize, "<count> : sentence pairs per batch in streaming alignment (default 1000)",
+                  
                   "UseNullWord", CMDBOOLTYPE|CMDMSG, &usenullword, "<bool>: use null word (default true)",
                   "unw", CMDBOOLTYPE|CMDMSG, &usenullword, "<bool>: use null word (default true)",
                   
@@ -130,6 +142,25 @@ int main(int argc, char **argv){
     }
     
     
+    if (streamfile){
+        if (!w2vfile || !modelfile || !alignfile) {
+            usage();
+            exit_error(IRSTLM_ERROR_DATA,"Missing parameters");
+        }
+        if (batchsize<1)
+            exit_error(IRSTLM_ERROR_DATA,"Batch size must be positive");
+        
+        //handles /dev/stdin or /dev/stdout
+        if (strcmp(streamfile,"-")==0) streamfile=(char *)"/dev/stdin";
+        if (strcmp(alignfile,"-")==0) alignfile=(char *)"/dev/stdout";
+        
+        cswam *model=new cswam(NULL,NULL,w2vfile,usenullword,normvectors,scalevectors,trainvar);
+        model->stream(streamfile,modelfile,alignfile,threads,batchsize);
+        delete model;
+        
+        exit_error(IRSTLM_NO_ERROR);
+    }
+    
     if (!srcdatafile || !trgdatafile || !w2vfile || !modelfile ) {
         usage();
         exit_error(IRSTLM_ERROR_DATA,"Missing parameters");
@@ -147,6 +178,9 @@ int main(int argc, char **argv){
     if (iterations)
         model->train(srcdatafile,trgdatafile,modelfile,iterations,threads);
     
+    if (benchrounds)
+        model->benchmark(srcdatafile,trgdatafile,modelfile,benchrounds);
+    
     if (alignfile)
         model->test(srcdatafile,trgdatafile,modelfile,alignfile,threads);
     
@@ -19,13 +19,16 @@
  *******************************************************************************/
 
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <stdio.h>
 #include <cmath>
 #include <limits>
 #include <string>
 #include <sstream>
+#include <vector>
 #include <pthread.h>
-#include "thpool.h"
+#include "wspool.h"
+#include "bqueue.h"
 #include "mfstream.h"
 #include "mempool.h"
 #include "htable.h"
@@ -46,8 +49,13 @@ using namespace std;
 cswam::cswam(char* sdfile,char *tdfile, char* w2vfile,bool usenull, bool normvect,bool scalevect,bool trainvar){
     
     //create dictionaries
-    srcdict=new dictionary(NULL,100000); srcdict->generate(sdfile,true);
-    trgdict=new dictionary(NULL,100000); trgdict->generate(tdfile,true);
+    srcdict=new dictionary(NULL,100000);
+    trgdict=new dictionary(NULL,100000);
+    
+    //without data files (streaming) the source dictionary is taken from word2vec
+    //and the target dictionary from the model
+    if (sdfile) srcdict->generate(sdfile,true); else srcdict->incflag(1);
+    if (tdfile) trgdict->generate(tdfile,true); else trgdict->incflag(1);
     
     //make aware of oov word
     srcdict->encode(srcdict->OOV());
@@ -58,21 +66,25 @@ cswam::cswam(char* sdfile,char *tdfile, char* w2vfile,bool usenull, bool normvec
     
     srcBoD = srcdict->encode(srcdict->BoD());  //codes for begin/end sentence markers
     srcEoD = srcdict->encode(srcdict->EoD());
-
+    
+    trgdict->incflag(0);
     
     //load word2vec dictionary
     W2V=NULL; D=0;
     loadword2vec(w2vfile);
+    srcdict->incflag(0);
 
     //check consistency of word2vec with target vocabulary
     
     //actual model structure
     
     TM=NULL;
+    iS=NULL;
+    lN=NULL;
     
     //S=NULL;
     //M=NULL;
-    //A=NULL;
+    A=NULL;
     
     
     normalize_vectors=normvect;
@@ -89,6 +101,8 @@ cswam::~cswam() {
     
     assert(A==NULL);
     
+    freeGauss();
+    
     if (TM){
         cerr << "Releasing memory of Translation Model\n";
         for (int e=0;e<trgdict->size();e++){
@@ -122,13 +136,16 @@ void cswam::loadword2vec(char* fname){
     mfstream inp(fname,ios::in);
     
     long long w2vsize;
-    inp >> w2vsize; cout << w2vsize << "\n";
-    inp >> D ; cout << D  << "\n";
+    inp >> w2vsize; cerr << w2vsize << "\n";
+    inp >> D ; cerr << D  << "\n";
     
     int srcoov=srcdict->oovcode();
     
-    W2V=new float* [srcdict->size()];
-    for (int f=0;f<srcdict->size();f++) W2V[f]=NULL;
+    //an extensible dictionary gets all the words of word2vec
+    long long maxsize=srcdict->size() + (srcdict->incflag()?w2vsize:0);
+    
+    W2V=new float* [maxsize];
+    for (long long f=0;f<maxsize;f++) W2V[f]=NULL;
     
     char word[100]; float dummy; int f;
     
@@ -387,12 +404,135 @@ float cswam::LogGauss(const int dim,const float* x,const float *m, const float *
 
     for (int i=0;i<dim;i++){
         assert(s[i]>0);
-        dist=(x[i]-m[i])*(x[i]-m[i])/(s[i]);
-        norm+=s[i];
+        dist+=(x[i]-m[i])*(x[i]-m[i])/(s[i]);
+        norm+=logf(s[i]);
+    }
+    
+    return -0.5 * (dist + dim * log2pi + norm);
+    
+}
+
+//Batched evaluation of one Gaussian against many vectors:
+//out[j] = c - 0.5 * sum_d (X[j][d]-m[d])^2 * is[d]
+//where is are the inverse variances and c the log normaliser.
+
+typedef void (*gaussbatch_t)(const int dim,const float* m,const float* is,const float c,
+                             const float **X,const int len,float* out);
+
+static void gaussbatch_generic(const int dim,const float* m,const float* is,const float c,
+                               const float **X,const int len,float* out){
+    for (int j=0;j<len;j++){
+        const float *x=X[j]; float dist=0,diff;
+        for (int d=0;d<dim;d++){
+            diff=x[d]-m[d];
+            dist+=diff*diff*is[d];
+        }
+        out[j]=c - 0.5 * dist;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+__attribute__((target("avx2,fma")))
+static void gaussbatch_avx2(const int dim,const float* m,const float* is,const float c,
+                            const float **X,const int len,float* out){
+    for (int j=0;j<len;j++){
+        const float *x=X[j];
+        __m256 acc=_mm256_setzero_ps(); int d=0;
+        for (;d+8<=dim;d+=8){
+            __m256 diff=_mm256_sub_ps(_mm256_loadu_ps(x+d),_mm256_loadu_ps(m+d));
+            acc=_mm256_fmadd_ps(_mm256_mul_ps(diff,_mm256_loadu_ps(is+d)),diff,acc);
+        }
+        __m128 r=_mm_add_ps(_mm256_castps256_ps128(acc),_mm256_extractf128_ps(acc,1));
+        r=_mm_hadd_ps(r,r); r=_mm_hadd_ps(r,r);
+        float dist=_mm_cvtss_f32(r),diff;
+        for (;d<dim;d++){ diff=x[d]-m[d]; dist+=diff*diff*is[d]; }
+        out[j]=c - 0.5 * dist;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gaussbatch_avx512(const int dim,const float* m,const float* is,const float c,
+                              const float **X,const int len,float* out){
+    __mmask16 tail=(__mmask16)((1u << (dim % 16)) - 1);
+    for (int j=0;j<len;j++){
+        const float *x=X[j];
+        __m512 acc=_mm512_setzero_ps(); int d=0;
+        for (;d+16<=dim;d+=16){
+            __m512 diff=_mm512_sub_ps(_mm512_loadu_ps(x+d),_mm512_loadu_ps(m+d));
+            acc=_mm512_fmadd_ps(_mm512_mul_ps(diff,_mm512_loadu_ps(is+d)),diff,acc);
+        }
+        if (d<dim){
+            __m512 diff=_mm512_sub_ps(_mm512_maskz_loadu_ps(tail,x+d),_mm512_maskz_loadu_ps(tail,m+d));
+            acc=_mm512_fmadd_ps(_mm512_mul_ps(diff,_mm512_maskz_loadu_ps(tail,is+d)),diff,acc);
+        }
+        out[j]=c - 0.5 * _mm512_reduce_add_ps(acc);
     }
+}
+#endif
+
+//pick the widest instruction set supported by the running cpu
+static gaussbatch_t gaussbatch_select(){
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return gaussbatch_avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return gaussbatch_avx2;
+#endif
+    return gaussbatch_generic;
+}
+
+static gaussbatch_t gaussbatch=gaussbatch_select();
+
+
+void cswam::initGauss(){
+    
+    //precompute inverse variances and log-normalisers of all components;
+    //to be called whenever the model has changed
+    static float log2pi=1.83787; //log(2 pi)
+    
+    freeGauss();
     
-    return -0.5 * (dist + dim * log2pi + logf(norm));
+    iS=new float* [trgdict->size()];
+    lN=new float* [trgdict->size()];
+    
+    for (int e=0;e<trgdict->size();e++){
+        iS[e]=new float[TM[e].n * D];
+        lN[e]=new float[TM[e].n];
+        for (int n=0;n<TM[e].n;n++){
+            float norm=0;
+            for (int d=0;d<D;d++){
+                //degenerate components of unseen words are never scored
+                if (TM[e].G[n].S[d]>0){
+                    iS[e][n * D + d]=1.0/TM[e].G[n].S[d];
+                    norm+=logf(TM[e].G[n].S[d]);
+                }else
+                    iS[e][n * D + d]=0;
+            }
+            lN[e][n]=log(TM[e].W[n]) - 0.5 * (D * log2pi + norm);
+        }
+    }
+}
+
+void cswam::freeGauss(){
+    
+    if (iS!=NULL){
+        for (int e=0;e<trgdict->size();e++){
+            delete [] iS[e]; delete [] lN[e];
+        }
+        delete [] iS; delete [] lN;
+        iS=NULL; lN=NULL;
+    }
+}
+
+//scores vectors X[0..len-1] against all components of target word e:
+//out[n][j] = log W[n] + LogGauss(X[j],M[n],S[n]); requires initGauss()
+
+void cswam::LogGaussBatch(int e,const float **X,int len,float **out){
     
+    assert(iS!=NULL);
+    for (int n=0;n<TM[e].n;n++)
+        gaussbatch(D,TM[e].G[n].M,&iS[e][n * D],lN[e][n],X,len,out[n]);
 }
             
 void cswam::expected_counts(void *argv){
@@ -410,25 +550,26 @@ void cswam::expected_counts(void *argv){
     //reset likelihood
     localLL[s]=0;
     
+    //score all source vectors against all components of each target word
+    const float *X[srclen];
+    for (int j=0;j<srclen;j++) X[j]=W2V[srcdata->docword(s,j)];
+    
+    for (int i=0;i<trglen;i++){
+        for (int n=0;n<TM[trgdata->docword(s,i)].n;n++)
+            assert(TM[trgdata->docword(s,i)].W[n]>0); //weight zero must be prevented!!!
+        LogGaussBatch(trgdata->docword(s,i),X,srclen,A[s][i]);
+    }
+    
     //compute denominator for each source-target pair
     for (int j=0;j<srclen;j++){
         //cout << "j: " << srcdict->decode(srcdata->docword(s,j)) << "\n";
         den=0;
         for (int i=0;i<trglen;i++)
             for (int n=0;n<TM[trgdata->docword(s,i)].n;n++){
-                assert(TM[trgdata->docword(s,i)].W[n]>0); //weight zero must be prevented!!!
-                A[s][i][n][j]=LogGauss(D, W2V[srcdata->docword(s,j)],
-                                       TM[trgdata->docword(s,i)].G[n].M,
-                                       TM[trgdata->docword(s,i)].G[n].S) + log(TM[trgdata->docword(s,i)].W[n]);
-//                cerr <<  "rtarget: " << trgdict->decode(trgdata->docword(s,i))
-//                <<   " n: " << n << " W=" << TM[trgdata->docword(s,i)].W[n]
-//                << " A:" << A[s][i][n][j] << " den: " << den << "\n";
                 if (i==0 && n==0) //den must be initialized
                     den=A[s][i][n][j];
                 else
                     den=logsum(den,A[s][i][n][j]);
-                //                    cerr << trgdict->decode(trgdata->docword(s,i)) << " n:" << n << "\n";
-                //                    cerr << "DEN : " << den << "\n";
             }
         
         //update local likelihood
@@ -610,12 +751,7 @@ int cswam::train(char *srctrainfile, char*trgtrainfile,char *modelfile, int maxi
     int iter=0;
     
     cerr << "Starting training";
-    threadpool thpool=thpool_init(threads);
-    int numtasks=trgdict->size()>trgdata->numdoc()?trgdict->size():trgdata->numdoc();
-    task *t=new task[numtasks];
-    assert(numtasks>D); //multi-threading also distributed over D
-    
-    threadpool thpool1=thpool_init(1);
+    wspool pool=wspool_init(threads);
     
     //support variable to compute model denominator
     Den=new float*[trgdict->size()];
@@ -637,16 +773,12 @@ int cswam::train(char *srctrainfile, char*trgtrainfile,char *modelfile, int maxi
         
         
         cerr << "E-step: ";
+        initGauss(); //precompute terms of the current model
+        
         //compute expected counts in each single sentence
-        for (long long  s=0;s<srcdata->numdoc();s++){
-            //prepare and assign tasks to threads
-            t[s].ctx=this; t[s].argv=(void *)s;
-            thpool_add_work(thpool, &cswam::expected_counts_helper, (void *)&t[s]);
-            
-        }
-        //join all threads
-        thpool_wait(thpool);
+        wspool_parallel_for(pool,0,srcdata->numdoc(),0,&cswam::expected_counts_range,(void *)this);
         
+        freeGauss();
         
         //Reset model before update
         for (int e=0;e <trgdict->size();e++)
@@ -672,13 +804,8 @@ int cswam::train(char *srctrainfile, char*trgtrainfile,char *modelfile, int maxi
         
         
         cerr << "M-step: ";
-        for (long long d=0;d<D;d++){
-            t[d].ctx=this; t[d].argv=(void *)d;
-            thpool_add_work(thpool, &cswam::maximization_helper, (void *)&t[d]);
-        }
-        
-        //join all threads
-        thpool_wait(thpool);
+        //multi-threading is distributed over D
+        wspool_parallel_for(pool,0,D,1,&cswam::maximization_range,(void *)this);
 
         //some checks of the models here
         for (int e=0;e<trgdict->size();e++){
@@ -709,20 +836,14 @@ int cswam::train(char *srctrainfile, char*trgtrainfile,char *modelfile, int maxi
             
             for (long long e=0;e<trgdict->size();e++){
                 //check if to increase number of gaussians per target word
-                t[e].ctx=this; t[e].argv=(void *)e;
-                thpool_add_work(thpool1, &cswam::expansion_helper, (void *)&t[e]);
+                expansion((void *)e);
             }
-            //join all threads
-            thpool_wait(thpool1);
             
             cerr << "\nContraction step: ";
             for (long long e=0;e<trgdict->size();e++){
                 //check if to decrease number of gaussians per target word
-                t[e].ctx=this; t[e].argv=(void *)e;
-                thpool_add_work(thpool1, &cswam::contraction_helper, (void *)&t[e]);
+                contraction((void *)e);
             }
-            //join all threads
-            thpool_wait(thpool1);
             
             
         }
@@ -739,23 +860,53 @@ int cswam::train(char *srctrainfile, char*trgtrainfile,char *modelfile, int maxi
    //         cout << trgdict->decode(e) << " S: " << S[e][d] << " M: " << M[e][d]<< "\n";
 
     //destroy thread pool
-    thpool_destroy(thpool);
+    wspool_destroy(pool);
   
     freeAlpha();
 
     for (int e=0;e<trgdict->size();e++) delete [] Den[e]; delete [] Den;
     delete srcdata; delete trgdata;
-    delete [] t; delete [] localLL;
+    delete [] localLL;
     
     return 1;
 }
 
 
 
-void cswam::aligner(void *argv){
-    long long s=(long long) argv;
+void cswam::align(const int *src,int srclen,const int *trg,int trglen,int *out){
     static float maxfloat=std::numeric_limits<float>::max();
     
+    assert(trglen<MAX_LINE);
+    
+    //Viterbi alignment: find the most probable alignment for source
+    float best_score[srclen];
+    
+    const float *X[srclen];
+    for (int j=0;j<srclen;j++){
+        X[j]=W2V[src[j]];
+        best_score[j]=-maxfloat;out[j]=0;
+    }
+    
+    //buffer for the scores of all components of one target word
+    int maxn=1;
+    for (int i=0;i<trglen;i++) maxn=MAX(maxn,TM[trg[i]].n);
+    float buffer[maxn * srclen]; float *score[maxn];
+    for (int n=0;n<maxn;n++) score[n]=&buffer[n * srclen];
+    
+    for (int i=0;i<trglen;i++){
+        LogGaussBatch(trg[i],X,srclen,score);
+        for (int n=0;n<TM[trg[i]].n;n++)
+            for (int j=0;j<srclen;j++)
+                if (score[n][j] > best_score[j]){
+                    best_score[j]=score[n][j];
+                    out[j]=i;
+                }
+    }
+}
+
+
+void cswam::aligner(void *argv){
+    long long s=(long long) argv;
     
     if (! (s % 10000)) {cerr << ".";cerr.flush();}
     //fprintf(stderr,"Thread: %lu  Document: %d  (out of %d)\n",(long)pthread_self(),s,srcdata->numdoc());
@@ -763,32 +914,11 @@ void cswam::aligner(void *argv){
     int trglen=trgdata->doclen(s); // length of target sentence
     int srclen=srcdata->doclen(s); //length of source sentence
     
-    assert(trglen<MAX_LINE);
+    int src[srclen],trg[trglen];
+    for (int j=0;j<srclen;j++) src[j]=srcdata->docword(s,j);
+    for (int i=0;i<trglen;i++) trg[i]=trgdata->docword(s,i);
     
-    //Viterbi alignment: find the most probable alignment for source
-    float score; float best_score;int best_i;
-
-    for (int j=0;j<srclen;j++){
-        
-        best_score=-maxfloat;best_i=0;
-        
-        for (int i=0;i<trglen;i++)
-            for (int n=0;n<TM[trgdata->docword(s,i)].n;n++){
-                
-                score=LogGauss(D,
-                               W2V[srcdata->docword(s,j)],
-                               TM[trgdata->docword(s,i)].G[n].M,
-                               TM[trgdata->docword(s,i)].G[n].S)+log(TM[trgdata->docword(s,i)].W[n]);
-                //  cout << "\t " << srcdict->decode(srcdata->docword(s,j)) << "  " << dist << "\n";
-                //if (dist > -50) score=(float)exp(-dist)/norm;
-                if (score > best_score){
-                    best_score=score;
-                    best_i=i;
-                }
-            }
-        
-        alignments[s % bucket][j]=best_i;
-    }
+    align(src,srclen,trg,trglen,alignments[s % bucket]);
 }
 
 
@@ -812,44 +942,252 @@ int cswam::test(char *srctestfile, char *trgtestfile, char* modelfile, char* ali
     for (int s=0;s<BUCKET;s++)
         alignments[s]=new int[MAX_LINE];
     
-    threadpool thpool=thpool_init(threads);
-    task *t=new task[bucket];
+    initGauss();
+    
+    wspool pool=wspool_init(threads);
     
     cerr << "Start alignment\n";
     
-    for (long long s=0;s<srcdata->numdoc();s++){
+    for (long long s=0;s<srcdata->numdoc();s+=bucket){
         
-        t[s % bucket].ctx=this; t[s % bucket].argv=(void *)s;
-        thpool_add_work(thpool, &cswam::aligner_helper, (void *)&t[s % bucket]);
+        //align one bucket of sentences
+        int size=MIN(bucket,srcdata->numdoc()-s);
+        wspool_parallel_for(pool,s,s+size,0,&cswam::aligner_range,(void *)this);
         
-
-        if (((s % bucket) == (bucket-1)) || (s==(srcdata->numdoc()-1)) ){
-            //join all threads
-            thpool_wait(thpool);
-            
-            //cerr << "Start printing\n";
-            
-            if ((s % bucket) != (bucket-1))
-                    bucket=srcdata->numdoc() % bucket; //last bucket at end of file
-            
-                mfstream out(alignfile,ios::out | ios::app);
-                
-                for (int b=0;b<bucket;b++){ //includes the eof case of
-                    out << "Sentence: " << s-bucket+1+b;
-                    for (int j=0; j<srcdata->doclen(s-bucket+1+b); j++) out << " "  << j << "-" << alignments[b][j];
-                    out << "\n";
-                }
-        }
+        mfstream out(alignfile,ios::out | ios::app);
         
+        for (int b=0;b<size;b++){ //includes the eof case of
+            out << "Sentence: " << s+b;
+            for (int j=0; j<srcdata->doclen(s+b); j++) out << " "  << j << "-" << alignments[b][j];
+            out << "\n";
+        }
     }
     
     
     //destroy thread pool
-    thpool_destroy(thpool);
+    wspool_destroy(pool);
     
-    delete [] t;
     for (int s=0;s<BUCKET;s++) delete [] alignments[s];delete [] alignments;
     delete srcdata; delete trgdata;
+    freeGauss();
+    return 1;
+}
+
+
+//streaming aligner: a reader fills batches of sentence pairs, the thread
+//pool aligns them and a writer thread outputs them in order; at most a few
+//batches are in memory at any time
+
+struct cswabatch{
+    cswam* model;
+    long long first;             //index of first sentence pair
+    vector<int> src, trg;        //words of all pairs
+    vector<int> srcpos, trgpos;  //start of each pair, plus end
+    vector<int> align;           //alignment of each source word
+    
+    int size(){return srcpos.size()-1;}
+};
+
+
+//bounded blocking queue between pipeline stages; NULL marks end of data
+
+typedef bqueue<cswabatch> cswaqueue;
+
+
+struct cswastage{
+    wspool pool;
+    cswaqueue *input, *output;
+    mfstream *out;
+    
+    static void align_range(void *ctx,long long i){
+        cswabatch* b=(cswabatch *)ctx;
+        int srclen=b->srcpos[i+1]-b->srcpos[i], trglen=b->trgpos[i+1]-b->trgpos[i];
+        if (srclen==0 || trglen==0) return; //nothing to align
+        b->model->align(&b->src[b->srcpos[i]],srclen,&b->trg[b->trgpos[i]],trglen,
+                        &b->align[b->srcpos[i]]);
+    }
+    
+    static void *align(void *ctx){
+        cswastage* st=(cswastage *)ctx;
+        cswabatch* b;
+        while ((b=st->input->pop())!=NULL){
+            wspool_parallel_for(st->pool,0,b->size(),0,&cswastage::align_range,(void *)b);
+            st->output->push(b);
+        }
+        st->output->push(NULL);
+        return NULL;
+    }
+    
+    static void *write(void *ctx){
+        cswastage* st=(cswastage *)ctx;
+        cswabatch* b;
+        while ((b=st->output->pop())!=NULL){
+            for (int s=0;s<b->size();s++){
+                *st->out << "Sentence: " << b->first+s;
+                if (b->trgpos[s+1]>b->trgpos[s]) //empty line if no target words
+                    for (int j=b->srcpos[s]; j<b->srcpos[s+1]; j++)
+                        *st->out << " " << j-b->srcpos[s] << "-" << b->align[j];
+                *st->out << "\n";
+            }
+            st->out->flush();
+            delete b;
+        }
+        return NULL;
+    }
+};
+
+
+int cswam::stream(char *inputfile, char* modelfile, char* alignfile, int threads, int batchsize){
+    
+    loadModel(modelfile);
+    initGauss();
+    
+    int bod=trgdict->encode(trgdict->BoD());
+    int eod=trgdict->encode(trgdict->EoD());
+    
+    mfstream inp(inputfile,ios::in);
+    if (!inp){
+        std::stringstream ss_msg;
+        ss_msg << "cannot open " << inputfile << "\n";
+        exit_error(IRSTLM_ERROR_IO, ss_msg.str());
+    }
+    mfstream out(alignfile,ios::out);
+    
+    cswaqueue toalign(2), towrite(2);
+    cswastage stage;
+    stage.pool=wspool_init(threads);
+    stage.input=&toalign; stage.output=&towrite; stage.out=&out;
+    
+    pthread_t alignthread, writethread;
+    pthread_create(&alignthread,NULL,&cswastage::align,(void *)&stage);
+    pthread_create(&writethread,NULL,&cswastage::write,(void *)&stage);
+    
+    cerr << "Start streaming alignment\n";
+    
+    //each line holds a sentence pair: source words ||| target words
+    string line, word; long long n=0;
+    cswabatch* b=NULL;
+    while (getline(inp,line)){
+        if (b==NULL){
+            b=new cswabatch; b->model=this; b->first=n;
+            b->srcpos.push_back(0); b->trgpos.push_back(0);
+        }
+        istringstream words(line);
+        bool source=true;
+        if (use_null_word) b->trg.push_back(bod); //<d> as NULL word
+        while (words >> word){
+            if (word=="|||"){source=false;continue;}
+            if (source){
+                int f=srcdict->encode(word.c_str());
+                if (f!=srcBoD && f!=srcEoD) b->src.push_back(f);
+            }else{
+                int e=trgdict->encode(word.c_str());
+                if (e!=bod && e!=eod) b->trg.push_back(e);
+            }
+        }
+        if (source) cerr << "warn: missing target sentence (line " << n << ")\n";
+        b->srcpos.push_back(b->src.size()); b->trgpos.push_back(b->trg.size());
+        
+        if (!(++n % 10000)) {cerr << ".";cerr.flush();}
+        if (b->size()==batchsize){
+            b->align.resize(b->src.size());
+            toalign.push(b); b=NULL;
+        }
+    }
+    if (b!=NULL){
+        b->align.resize(b->src.size());
+        toalign.push(b);
+    }
+    toalign.push(NULL);
+    
+    pthread_join(alignthread,NULL);
+    pthread_join(writethread,NULL);
+    wspool_destroy(stage.pool);
+    
+    cerr << "\naligned " << n << " sentence pairs\n";
+    
+    freeGauss();
+    return 1;
+}
+
+
+//micro-benchmark of the Gaussian scoring kernel: compares the one-by-one
+//evaluation with LogGauss against the batched evaluation on a given corpus
+
+static double wallclock(){
+    struct timeval tv; gettimeofday(&tv,NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+int cswam::benchmark(char *srctestfile, char *trgtestfile, char* modelfile, int rounds){
+    
+    initModel(modelfile);
+    
+    srcdata=new doc(srcdict,srctestfile);
+    trgdata=new doc(trgdict,trgtestfile,use_null_word);
+    assert(srcdata->numdoc()==trgdata->numdoc());
+    
+    initGauss();
+    
+    //count evaluations and find maximum buffer size
+    long long evals=0; int maxn=1, maxlen=1;
+    for (int s=0;s<srcdata->numdoc();s++){
+        maxlen=MAX(maxlen,srcdata->doclen(s));
+        for (int i=0;i<trgdata->doclen(s);i++){
+            evals+=(long long)TM[trgdata->docword(s,i)].n * srcdata->doclen(s);
+            maxn=MAX(maxn,TM[trgdata->docword(s,i)].n);
+        }
+    }
+    
+    float *buffer=new float[maxn * maxlen]; float **score=new float* [maxn];
+    for (int n=0;n<maxn;n++) score[n]=&buffer[n * maxlen];
+    const float **X=new const float* [maxlen];
+    
+    double start,scalartime=0,batchtime=0,maxdiff=0;
+    
+    for (int r=0;r<rounds;r++){
+        
+        start=wallclock();
+        for (int s=0;s<srcdata->numdoc();s++)
+            for (int i=0;i<trgdata->doclen(s);i++){
+                int e=trgdata->docword(s,i);
+                for (int n=0;n<TM[e].n;n++)
+                    for (int j=0;j<srcdata->doclen(s);j++)
+                        score[n][j]=LogGauss(D,W2V[srcdata->docword(s,j)],TM[e].G[n].M,TM[e].G[n].S)+log(TM[e].W[n]);
+            }
+        scalartime+=wallclock()-start;
+        
+        start=wallclock();
+        for (int s=0;s<srcdata->numdoc();s++){
+            for (int j=0;j<srcdata->doclen(s);j++) X[j]=W2V[srcdata->docword(s,j)];
+            for (int i=0;i<trgdata->doclen(s);i++)
+                LogGaussBatch(trgdata->docword(s,i),X,srcdata->doclen(s),score);
+        }
+        batchtime+=wallclock()-start;
+    }
+    
+    //check agreement of the two kernels
+    for (int s=0;s<srcdata->numdoc();s++){
+        for (int j=0;j<srcdata->doclen(s);j++) X[j]=W2V[srcdata->docword(s,j)];
+        for (int i=0;i<trgdata->doclen(s);i++){
+            int e=trgdata->docword(s,i);
+            LogGaussBatch(e,X,srcdata->doclen(s),score);
+            for (int n=0;n<TM[e].n;n++)
+                for (int j=0;j<srcdata->doclen(s);j++){
+                    double diff=fabs(score[n][j]-LogGauss(D,X[j],TM[e].G[n].M,TM[e].G[n].S)-log(TM[e].W[n]));
+                    if (diff>maxdiff) maxdiff=diff;
+                }
+        }
+    }
+    
+    cout << "evaluations per round: " << evals << "\n";
+    cout << "scalar kernel:  " << scalartime << " s (" << (evals * rounds)/scalartime << " evals/s)\n";
+    cout << "batched kernel: " << batchtime << " s (" << (evals * rounds)/batchtime << " evals/s)\n";
+    cout << "speedup: " << scalartime/batchtime << " max abs difference: " << maxdiff << "\n";
+    
+    delete [] X; delete [] score; delete [] buffer;
+    delete srcdata; delete trgdata;
+    freeGauss();
     return 1;
 }
 
@@ -49,6 +49,9 @@ class cswam {
     //model
     TransModel *TM;
     
+    //precomputed terms for batched Gaussian evaluation
+    float **iS;        //inverse variances of all components: [e][n*D+d]
+    float **lN;        //log normaliser plus log weight of each component: [e][n]
     
     //settings
     bool normalize_vectors;
@@ -69,11 +72,6 @@ class cswam {
     int threads;       //number of threads
     int bucket;        //size of bucket
 
-    struct task {      //basic task info to run task
-        void *ctx;
-        void *argv;
-    };
-
     
 public:
     
@@ -90,41 +88,40 @@ public:
     void freeAlpha();
     
     float LogGauss(const int dim,const float* x,const float *m, const float *s);
+    
+    void initGauss();
+    void freeGauss();
+    void LogGaussBatch(int e,const float **X,int len,float **out);
         
     void expected_counts(void *argv);
-    static void *expected_counts_helper(void *argv){
-        task t=*(task *)argv;
-        ((cswam *)t.ctx)->expected_counts(t.argv);return NULL;
+    static void expected_counts_range(void *ctx,long long i){
+        ((cswam *)ctx)->expected_counts((void *)i);
     };
 
     void maximization(void *argv);
-    static void *maximization_helper(void *argv){
-        task t=*(task *)argv;
-        ((cswam *)t.ctx)->maximization(t.argv);return NULL;
+    static void maximization_range(void *ctx,long long i){
+        ((cswam *)ctx)->maximization((void *)i);
     };
 
     void expansion(void *argv);
-    static void *expansion_helper(void *argv){
-        task t=*(task *)argv;
-        ((cswam *)t.ctx)->expansion(t.argv);return NULL;
-    };
     
     void contraction(void *argv);
-    static void *contraction_helper(void *argv){
-        task t=*(task *)argv;
-        ((cswam *)t.ctx)->contraction(t.argv);return NULL;
-    };
     
     int train(char *srctrainfile,char *trgtrainfile,char* modelfile, int maxiter,int threads=1);
     
+    void align(const int *src,int srclen,const int *trg,int trglen,int *out);
+    
     void aligner(void *argv);
-    static void *aligner_helper(void *argv){
-        task t=*(task *)argv;
-        ((cswam *)t.ctx)->aligner(t.argv);return NULL;
+    static void aligner_range(void *ctx,long long i){
+        ((cswam *)ctx)->aligner((void *)i);
     };
     
 
     int test(char *srctestfile, char* trgtestfile, char* modelfile,char* alignmentfile, int threads=1);
     
+    int stream(char *inputfile, char* modelfile, char* alignfile, int threads=1, int batchsize=1000);
+    
+    int benchmark(char *srctestfile, char* trgtestfile, char* modelfile, int rounds=1);
+    
 };
 
@@ -35,12 +35,107 @@
 
 using namespace std;
 
+dictindex::dictindex(size_t n)
+{
+	tab=NULL;
+	accesses=collisions=0;
+	reset(n);
+}
+
+dictindex::~dictindex()
+{
+	free(tab);
+}
+
+void dictindex::reset(size_t n)
+{
+	size_t size=16;
+	while (size < 2 * n) size*=2;
+	
+	free(tab);
+	tab=(slot *)malloc(size * sizeof(slot));
+	if (tab==NULL) {
+		exit_error(IRSTLM_ERROR_MEMORY, "dictindex: cannot allocate the index");
+	}
+	for (size_t i=0; i<size; i++) tab[i].pos=-1;
+	mask=size-1;
+}
+
+//64-bit MurmurHash (MurmurHash64A by Austin Appleby, public domain)
+unsigned long long dictindex::hash(const char* w)
+{
+	const unsigned long long m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	size_t len=strlen(w);
+	unsigned long long h = 0x8445d61a4e774912ULL ^ (len * m);
+	
+	const char* end = w + (len & ~(size_t)7);
+	for (; w != end; w += 8) {
+		unsigned long long k;
+		memcpy(&k, w, 8);
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	
+	switch (len & 7) {
+		case 7: h ^= (unsigned long long)((unsigned char)w[6]) << 48; //fall through
+		case 6: h ^= (unsigned long long)((unsigned char)w[5]) << 40; //fall through
+		case 5: h ^= (unsigned long long)((unsigned char)w[4]) << 32; //fall through
+		case 4: h ^= (unsigned long long)((unsigned char)w[3]) << 24; //fall through
+		case 3: h ^= (unsigned long long)((unsigned char)w[2]) << 16; //fall through
+		case 2: h ^= (unsigned long long)((unsigned char)w[1]) << 8; //fall through
+		case 1: h ^= (unsigned long long)((unsigned char)w[0]);
+			h *= m;
+	};
+	
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+int dictindex::find(const char* w,const dict_entry* tb)
+{
+	unsigned long long h=hash(w);
+	unsigned int fp=(unsigned int)(h >> 32);
+	
+	accesses++;
+	for (size_t i=h & mask; tab[i].pos!=-1; i=(i+1) & mask) {
+		if (tab[i].fp==fp && strcmp(tb[tab[i].pos].word,w)==0)
+			return tab[i].pos;
+		collisions++;
+	}
+	return -1;
+}
+
+void dictindex::insert(int pos,const dict_entry* tb)
+{
+	unsigned long long h=hash(tb[pos].word);
+	size_t i=h & mask;
+	
+	while (tab[i].pos!=-1) i=(i+1) & mask;
+	tab[i].fp=(unsigned int)(h >> 32);
+	tab[i].pos=pos;
+}
+
+void dictindex::stat() const
+{
+	cerr << "dictindex class statistics\n";
+	cerr << "size " << mask+1
+	<< " acc " << accesses
+	<< " coll " << collisions
+	<< " used memory " << used()/1024 << "Kb\n";
+}
+
 dictionary::dictionary(char *filename,int size, float lf)
 {
 	if (lf<=0.0) lf=DICTIONARY_LOAD_FACTOR;
 	load_factor=lf;
 	
-	htb = new HASHTABLE_t((size_t) (size/load_factor));
+	htb = new dictindex(size);
 	tb  = new dict_entry[size];
 	st  = new strstack(size * 10);
 	
@@ -53,6 +148,7 @@ dictionary::dictionary(char *filename,int size, float lf)
 	dubv = 0;
 	lim = size;
 	ifl=0;  //increment flag
+	scan_pos=0;
 	
 	if (filename==NULL) return;
 	
@@ -265,7 +361,6 @@ void dictionary::test(int* OOVchart, int* NwTest, int curvesize, const char *fil
 void dictionary::load(char* filename)
 {
 	char header[100];
-	char* addr;
 	char buffer[MAX_WORD];
 	int freqflag=0;
 	
@@ -299,15 +394,13 @@ void dictionary::load(char* filename)
 		else
 			tb[n].freq=0;
 		
-		//always insert without checking whether the word is already in
-		if ((addr=htb->insert((char*)&tb[n].word))) {
-			if (addr!=(char *)&tb[n].word) {
-				cerr << "dictionary::loadtxt wrong entry was found ("
-				<<  buffer << ") in position " << n << "\n";
-				//      exit(1);
-				continue;  // continue loading dictionary
-			}
+		if (htb->find(buffer,tb)>=0) {
+			cerr << "dictionary::loadtxt wrong entry was found ("
+			<<  buffer << ") in position " << n << "\n";
+			//      exit(1);
+			continue;  // continue loading dictionary
 		}
+		htb->insert(n,tb);
 		
 		N+=tb[n].freq;
 		
@@ -325,7 +418,6 @@ void dictionary::load(std::istream& inp)
 {
 	
 	char buffer[MAX_WORD];
-	char *addr;
 	int size;
 	
 	inp >> size;
@@ -339,14 +431,12 @@ void dictionary::load(std::istream& inp)
 		inp >> tb[n].freq;
 		N+=tb[n].freq;
 		
-		//always insert without checking whether the word is already in
-		if ((addr=htb->insert((char  *)&tb[n].word))) {
-			if (addr!=(char *)&tb[n].word) {
-				std::stringstream ss_msg;
-				ss_msg << "dictionary::loadtxt wrong entry was found (" <<  buffer << ") in position " << n;
-				exit_error(IRSTLM_ERROR_DATA, ss_msg.str());
-			}
+		if (htb->find(buffer,tb)>=0) {
+			std::stringstream ss_msg;
+			ss_msg << "dictionary::loadtxt wrong entry was found (" <<  buffer << ") in position " << n;
+			exit_error(IRSTLM_ERROR_DATA, ss_msg.str());
 		}
+		htb->insert(n,tb);
 		
 		if (strcmp(tb[n].word,OOV())==0)
 			oov_code=n;
@@ -389,10 +479,11 @@ dictionary::dictionary(dictionary* d,bool prune, int prunethresh)
 	oov_code=-1;   //code od oov must be re-defined	
 	ifl=0;         //increment flag=0;
 	dubv=d->dubv;  //dictionary upperbound transferred
+	scan_pos=0;
 	
 	//creates a sorted copy of the table
 	tb  = new dict_entry[lim];
-	htb = new HASHTABLE_t((size_t) (lim/load_factor));
+	htb = new dictindex(lim);
 	st  = new strstack(lim * 10);
 	
 	//copy in the entries with frequency > threshold
@@ -402,7 +493,7 @@ dictionary::dictionary(dictionary* d,bool prune, int prunethresh)
 			tb[n].code=n;
 			tb[n].freq=d->tb[i].freq;
 			tb[n].word=st->push(d->tb[i].word);
-			htb->insert((char*)&tb[n].word);
+			htb->insert(n,tb);
 			
 			if (d->oov_code==i) oov_code=n; //reassign oov_code
 			
@@ -413,9 +504,7 @@ dictionary::dictionary(dictionary* d,bool prune, int prunethresh)
 
 void dictionary::sort()
 {
-	if (htb != NULL )  delete htb;
-	
-	htb = new HASHTABLE_t((int) (lim/load_factor));
+	htb->reset(lim);
 	//sort all entries according to frequency
 	cerr << "sorting dictionary ...";
 	qsort(tb,n,sizeof(dict_entry),cmpdictentry);
@@ -426,7 +515,7 @@ void dictionary::sort()
 		if (oov_code==tb[i].code) oov_code=i;
 		tb[i].code=i;
 		//always insert without checking whether the word is already in
-		htb->insert((char*)&tb[i].word);
+		htb->insert(i,tb);
 	};
 	
 }
@@ -450,8 +539,6 @@ void dictionary::stat() const
 
 void dictionary::grow()
 {
-	delete htb;
-	
 	cerr << "+\b";
 	
 	int newlim=(int) (lim*GROWTH_STEP);
@@ -462,10 +549,10 @@ void dictionary::grow()
 	delete [] tb;
 	tb=tb2;
 	
-	htb=new HASHTABLE_t((size_t) ((newlim)/load_factor));
+	htb->reset(newlim);
 	for (int i=0; i<lim; i++) {
 		//always insert without checking whether the word is already in
-		htb->insert((char*)&tb[i].word);
+		htb->insert(i,tb);
 	}
 	
 	for (int i=lim; i<newlim; i++) tb[i].freq=0;
@@ -502,9 +589,9 @@ void dictionary::save(char *filename,int freqflag)
 
 int dictionary::getcode(const char *w)
 {
-	dict_entry* ptr=(dict_entry *)htb->find((char *)&w);
-	if (ptr==NULL) return -1;
-	return ptr->code;
+	int pos=htb->find(w,tb);
+	if (pos<0) return -1;
+	return tb[pos].code;
 }
 
 int dictionary::encode(const char *w)
@@ -516,16 +603,16 @@ int dictionary::encode(const char *w)
 	}
 	
 	
-	dict_entry* ptr;
+	int pos;
 	
-	if ((ptr=(dict_entry *)htb->find((char *)&w))!=NULL)
-		return ptr->code;
+	if ((pos=htb->find(w,tb))>=0)
+		return tb[pos].code;
 	else {
 		if (!ifl) { //do not extend dictionary
 			if (oov_code==-1) { //did not use OOV yet
 				cerr << "starting to use OOV words [" << w << "]\n";
 				tb[n].word=st->push(OOV());
-				htb->insert((char  *)&tb[n].word);
+				htb->insert(n,tb);
 				tb[n].code=n;
 				tb[n].freq=0;
 				oov_code=n;
@@ -535,7 +622,7 @@ int dictionary::encode(const char *w)
 			return encode(OOV());
 		} else { //extend dictionary
 			tb[n].word=st->push((char *)w);
-			htb->insert((char*)&tb[n].word);
+			htb->insert(n,tb);
 			tb[n].code=n;
 			tb[n].freq=0;
 			if (++n==lim) grow();
@@ -76,7 +76,46 @@ typedef struct {
 	long long freq;
 } dict_entry;
 
-typedef htable<char*> HASHTABLE_t;
+//! Index of the words of a dictionary
+/*! Open addressing with linear probing on a power-of-two table. Every
+    slot keeps the position of a word in the entry table and a
+    fingerprint of its 64-bit hash, so that strings are compared only
+    when the fingerprints match. Words themselves live in the strstack
+    of the dictionary; the table is kept at most half full.
+*/
+class dictindex
+{
+	typedef struct {
+		unsigned int fp; //!< high half of the hash
+		int        pos;  //!< position in the entry table, -1 if empty
+	} slot;
+	
+	slot      *tab;       //!< slots
+	size_t     mask;      //!< number of slots minus one
+	long    accesses;     //!< # of accesses
+	long  collisions;     //!< # of probed slots holding another word
+	
+public:
+	dictindex(size_t n);
+	~dictindex();
+	
+	static unsigned long long hash(const char* w);
+	
+	//! Position of w in tb, or -1
+	int find(const char* w,const dict_entry* tb);
+	
+	//! Adds the word in position pos of tb, without checking whether it is already in
+	void insert(int pos,const dict_entry* tb);
+	
+	//! Empties the index and makes room for n words
+	void reset(size_t n);
+	
+	void stat() const;
+	
+	size_t used() const {
+		return (mask+1) * sizeof(slot);
+	}
+};
 
 class strstack;
 
@@ -84,7 +123,7 @@ class dictionary
 {
 	strstack   *st;  //!< stack of strings
 	dict_entry *tb;  //!< entry table
-	HASHTABLE_t  *htb;  //!< hash table
+	dictindex  *htb;  //!< hash index of the words
 	int          n;  //!< number of entries
 	long long    N;  //!< total frequency
 	int        lim;  //!< limit of entries
@@ -92,6 +131,7 @@ class dictionary
 	char       ifl;  //!< increment flag
 	int        dubv; //!< dictionary size upper bound
 	float        load_factor; //!< dictionary loading factor
+	int     scan_pos; //!< scan support
 	char* oov_str;    //!< oov string
 	
 	void test(int* OOVchart, int* NwTest, int curvesize, const char *filename, int listflag=0);	// prepare into testOOV the OOV statistics computed on test set
@@ -233,7 +273,11 @@ public:
 	}
 	
 	inline dict_entry* scan(HT_ACTION action) {
-		return  (dict_entry*) htb->scan(action);
+		if (action == HT_INIT) {
+			scan_pos=0;
+			return NULL;
+		}
+		return (scan_pos<n)?&tb[scan_pos++]:NULL;
 	}
 };
 
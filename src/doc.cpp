@@ -25,6 +25,7 @@
 #include "dictionary.h"
 #include "n_gram.h"
 #include "doc.h"
+#include "tokenizer.h"
 
 using namespace std;
 
@@ -45,24 +46,19 @@ doc::doc(dictionary* d,char* docfname,bool use_null_word){
     int bod=d->encode(d->BoD());
     
     
-    ngram ng(d);
+    tokenizer tok(df);
     int n=0;  //track documents
     int m=0;  //track document length
     int w=0;  //track words in doc
     
     int tmp[MAXDOCLEN];
     
-    while (n<N && df >> ng)
-        if (ng.size>0){
-            w=*ng.wordp(1);
-            if (w==bod){
-                if (use_null_word){
-                    ng.size=1; //use <d> as NULL word
-                }else{
-                    ng.size=0; //skip <d>
-                    continue;
-                }
-            }
+    while (n<N && tok.getline()>=0){
+        int len=tok.encode(d);
+        for (int k=0; k<len && n<N; k++){
+            w=tok.code()[k];
+            if (w==bod && !use_null_word)
+                continue; //skip <d>, otherwise use it as NULL word
             if (w==eod && m>0){
                 M[n]=m;  //length of n-th document
                 V[n]=new int[m];
@@ -75,6 +71,7 @@ doc::doc(dictionary* d,char* docfname,bool use_null_word){
             if (m < MAXDOCLEN) tmp[m++]=w;
             if (m==MAXDOCLEN) {cerr<< "warn: clipping long document (line " << n << " )\n";exit(1);};
         }
+    }
     
     cerr << "uploaded " << n << " documents\n";
     
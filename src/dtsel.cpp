@@ -28,14 +28,23 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 
 
 #include <cmath>
+#include <climits>
 #include "util.h"
 #include <sstream>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <pthread.h>
 #include "mfstream.h"
 #include "mempool.h"
 #include "htable.h"
 #include "dictionary.h"
 #include "n_gram.h"
 #include "ngramtable.h"
+#include "ngramcache.h"
+#include "wspool.h"
+#include "bqueue.h"
+#include "tokenizer.h"
 #include "cmd.h"
 
 using namespace std;
@@ -61,45 +70,234 @@ void usage(const char *msg = 0)
 	}
 }
 
-double prob(ngramtable* ngt,ngram ng,int size,int cv){
+//cache: optional per-level memo of the backoff chain, keyed by n-gram and cv
+
+#define DTSEL_CACHE_SIZE 100000
+
+//discounted frequency and back-off weight of the size-gram of ng: its
+//probability is fstar plus lambda times the one of the (size-1)-gram
+
+void level(ngramtable* ngt,ngram ng,int size,int cv,double& fstar,double& lambda){
+	fstar=0.0; lambda=1.0;
+	ngram history=ng;
+	if (ngt->get(history,size,size-1) && history.freq>cv){
+		if (ngt->get(ng,size,size)){
+			cv=(cv>ng.freq)?ng.freq:cv;
+			if (ng.freq>cv){
+				fstar=(double)(ng.freq-cv)/(double)(history.freq -cv + history.succ);					
+				lambda=(double)history.succ/(double)(history.freq -cv + history.succ);
+			}else //ng.freq==cv
+				lambda=(double)(history.succ-1)/(double)(history.freq -cv + history.succ-1);
+		}
+		else
+			lambda=(double)history.succ/(double)(history.freq -cv + history.succ);			
+	}
+}
+
+double prob(ngramtable* ngt,ngram ng,int size,int cv,ngramcache** cache=NULL){
 	MY_ASSERT(size<=ngt->maxlevel() && size<=ng.size);	
+	
+	int key[MAX_NGRAM+1];
+	double pr;
+	if (cache){
+		memcpy(key,ng.wordp(size),size * sizeof(int)); key[size]=cv;
+		if (cache[size]->get(key,pr)) return pr;
+	}
+	
 	if (size>1){				
-		ngram history=ng;
-		if (ngt->get(history,size,size-1) && history.freq>cv){
-			double fstar=0.0;
-			double lambda;
-			if (ngt->get(ng,size,size)){
-				cv=(cv>ng.freq)?ng.freq:cv;
-				if (ng.freq>cv){
-					fstar=(double)(ng.freq-cv)/(double)(history.freq -cv + history.succ);					
-					lambda=(double)history.succ/(double)(history.freq -cv + history.succ);
-				}else //ng.freq==cv
-					lambda=(double)(history.succ-1)/(double)(history.freq -cv + history.succ-1);
-			}
-			else
-				lambda=(double)history.succ/(double)(history.freq -cv + history.succ);			
-			
-			return fstar + lambda * prob(ngt,ng,size-1,cv);
-		}
-		else return prob(ngt,ng,size-1,cv);
+		double fstar,lambda;
+		level(ngt,ng,size,cv,fstar,lambda);
+		pr=fstar + lambda * prob(ngt,ng,size-1,cv,cache);
 		
 	}else{ //unigram branch
 		if (ngt->get(ng,1,1) && ng.freq>cv)
-			return (double)(ng.freq-cv)/(ngt->totfreq()-1);
+			pr=(double)(ng.freq-cv)/(ngt->totfreq()-1);
 		else{
 			//cerr << "backoff to oov unigram " << ng.freq << " " << cv << "\n";
 			*ng.wordp(1)=ngt->dict->oovcode();
 			if (ngt->get(ng,1,1) && ng.freq>0)
-				return (double)ng.freq/ngt->totfreq();		
+				pr=(double)ng.freq/ngt->totfreq();		
 			else //use an automatic estimate of Pr(oov)
-				return (double)ngt->dict->size()/(ngt->totfreq()+ngt->dict->size());				
+				pr=(double)ngt->dict->size()/(ngt->totfreq()+ngt->dict->size());				
 		}
 
 	}
 	
+	if (cache){
+		if (cache[size]->isfull()) cache[size]->reset();
+		cache[size]->add(key,pr);
+	}
+	return pr;
 }
 
 
+//block of out-domain sentences flowing through the scoring pipeline
+
+struct dtblock{
+	vector<string> lines;   //original lines, written back with the score
+	vector<int> first;      //index of first n-gram of each sentence (plus end)
+	vector<int> sizes;      //size of each n-gram
+	vector<int> codes;      //ngsz codes of each n-gram, right aligned
+	vector<float> scores;   //score of each sentence
+};
+
+
+//bounded blocking queue between pipeline stages; NULL marks end of data
+
+typedef bqueue<dtblock> dtqueue;
+
+
+//scores the sentences of a block on a thread pool; tables are shared
+//read-only, each thread owns its caches of the backoff chains
+
+struct dtscorer{
+	ngramtable *indngt, *outdngt;
+	int model, cv, ngsz;
+	vector<int> indmap, outdmap;     //codes of the selection dict in each table
+	int indoovcode, outdoovcode;
+	double indoovpenalty, outdoovpenalty;
+	vector<ngramcache**> indcache, outdcache; //per thread and level
+	wspool pool;
+	dtblock* block;
+	dtqueue *input, *output;
+	
+	ngramcache** newcache(){
+		ngramcache** c=new ngramcache*[ngsz+1];
+		c[0]=NULL;
+		for (int l=1;l<=ngsz;l++) c[l]=new ngramcache(l+1,sizeof(double),DTSEL_CACHE_SIZE);
+		return c;
+	}
+	
+	void deletecache(ngramcache** c){
+		for (int l=1;l<=ngsz;l++) delete c[l];
+		delete [] c;
+	}
+	
+	//extend the code maps to new entries of the selection dictionary
+	void extendmaps(dictionary* dict){
+		for (int c=indmap.size();c<dict->size();c++){
+			indmap.push_back(indngt->dict->encode(dict->decode(c)));
+			outdmap.push_back(outdngt->dict->encode(dict->decode(c)));
+		}
+	}
+	
+	void score(long long s){
+		int th=wspool_thread_id();
+		ngram indng(indngt->dict), outdng(outdngt->dict);
+		float deltaH=0, deltaHoov=0; int length=0;
+		int code[MAX_NGRAM];
+		
+		for (int k=block->first[s];k<block->first[s+1];k++){
+			int size=block->sizes[k]; const int* ngp=&block->codes[(long long)k * ngsz + ngsz - size];
+			length++;
+			
+			for (int i=0;i<size;i++) code[i]=indmap[ngp[i]];
+			indng.size=0; indng.pushc(code,size);
+			
+			if (model==1){//compute cross-entropy
+				deltaH-=log(prob(indngt,indng,indng.size,0,indcache[th]));	
+				deltaHoov-=(*indng.wordp(1)==indoovcode?indoovpenalty:0);
+			}
+			
+			if (model==2){ //compute cross-entropy difference
+				for (int i=0;i<size;i++) code[i]=outdmap[ngp[i]];
+				outdng.size=0; outdng.pushc(code,size);
+				deltaH+=log(prob(outdngt,outdng,outdng.size,cv,outdcache[th]))-log(prob(indngt,indng,indng.size,0,indcache[th]));	
+				deltaHoov+=(*outdng.wordp(1)==outdoovcode?outdoovpenalty:0)-(*indng.wordp(1)==indoovcode?indoovpenalty:0);
+			}
+		}
+		block->scores[s]=(deltaH + deltaHoov)/length;
+	}
+	
+	static void score_helper(void* ctx,long long s){
+		((dtscorer *)ctx)->score(s);
+	}
+	
+	//scoring stage of the pipeline
+	static void *run(void* ctx){
+		dtscorer* sc=(dtscorer *)ctx;
+		dtblock* b;
+		while ((b=sc->input->pop())!=NULL){
+			sc->block=b;
+			b->scores.resize(b->lines.size());
+			wspool_parallel_for(sc->pool,0,b->lines.size(),0,&dtscorer::score_helper,ctx);
+			sc->output->push(b);
+		}
+		sc->output->push(NULL);
+		return NULL;
+	}
+};
+
+
+//reads sentences into blocks and encodes their n-grams; the history of
+//the first word of a line is the last word of the previous one
+
+struct dtreader{
+	tokenizer* tok;
+	ngram* ng;
+	int bos, ngsz;
+	bool useindex;
+	long long words;
+	
+	//reads at least maxwords words (or up to end of file) into b;
+	//returns false if no line was read
+	bool read(dtblock* b,int maxwords){
+		const char* line; size_t len; int blockwords=0;
+		
+		while (blockwords<maxwords && (line=tok->readline(len))!=NULL){
+			
+			b->lines.push_back(string(line,len));
+			
+			//skip the index
+			tok->split();
+			int n=tok->encode(ng->dict,useindex?1:0);
+			
+			// reset ngram at begin of sentence
+			ng->size=1;
+			b->first.push_back(b->sizes.size());
+			
+			for (int k=0;k<n;k++){
+				
+				ng->pushc(tok->code()[k]);
+				
+				if (*ng->wordp(1)==bos) continue;
+				
+				words++; blockwords++;
+				
+				if ((words % 1000000)==0) cerr << ".";				
+				
+				if (ng->size>ngsz) ng->size=ngsz;
+				
+				b->sizes.push_back(ng->size);
+				b->codes.resize(b->codes.size()+ngsz-ng->size,0); //padding
+				b->codes.insert(b->codes.end(),ng->wordp(ng->size),ng->wordp(ng->size)+ng->size);
+			}
+		}
+		b->first.push_back(b->sizes.size());
+		return b->lines.size()>0;
+	}
+};
+
+
+//writing stage of the pipeline
+
+struct dtwriter{
+	mfstream* out;
+	dtqueue* input;
+	
+	static void *run(void* ctx){
+		dtwriter* w=(dtwriter *)ctx;
+		dtblock* b;
+		while ((b=w->input->pop())!=NULL){
+			for (size_t s=0;s<b->lines.size();s++)
+				*w->out << b->scores[s] << " " << b->lines[s] << "\n";
+			delete b;
+		}
+		return NULL;
+	}
+};
+
+
 double computePP(ngramtable* train,ngramtable* test,double oovpenalty,double& oovrate,int cv=0){
 	
 	
@@ -122,6 +320,249 @@ double computePP(ngramtable* train,ngramtable* test,double oovpenalty,double& oo
 }
 
 
+//incremental selection: sentences are selected greedily, block by block,
+//by cross-entropy difference between the in-domain model and a model of
+//the data selected so far, which is updated with each accepted block.
+//Candidates are kept in memory with their n-gram codes. The in-domain
+//part of each score never changes and is computed once. After an update,
+//the sentences using an n-gram or a history (of two words or more) whose
+//counts have changed are marked as stale, and are rescored only when they
+//reach the top of the queue. Changes of unigram counts and of the total
+//count, which move all scores alike, are not tracked.
+
+#define DTSEL_CHANGED_BITS 20
+#define DTSEL_RESCORE_BATCH 64
+
+//key of the n-gram of the first n codes; collisions only cause extra work
+static inline unsigned long long dtkey(const int* w,int n){
+	unsigned long long h=n;
+	for (int i=0;i<n;i++) h=(h ^ (unsigned int) w[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+//sentence using an n-gram or history with the given key
+struct dtref{
+	unsigned long long key;
+	int s;
+	bool operator<(const dtref& r) const {
+		return key<r.key || (key==r.key && s<r.s);
+	}
+	bool operator==(const dtref& r) const {
+		return key==r.key && s==r.s;
+	}
+};
+
+//cached level of the selected-data model, with the generation of the
+//model it was computed on
+struct dtlevel{
+	float fstar, lambda;
+	int gen;
+};
+
+struct dtselector{
+	ngramtable *indngt, *selngt;
+	dictionary* dict;
+	int ngsz, bos;
+	vector<int> indmap;
+	int indoovcode, seloovcode;
+	double indoovpenalty, seloovpenalty;
+	dtblock* data;                   //candidate sentences
+	vector<float> indH;              //in-domain part of the score
+	vector<float> score;             //current score of each sentence
+	vector<char> stale;              //sentences whose score is out of date
+	vector<int> todo;                //stale sentences being rescored
+	vector<dtref> index;             //sentences by n-gram and history keys
+	int gen;                         //updates of the selected-data model
+	vector<int> changed;             //last update changing the keys hashed to each slot
+	vector<ngramcache**> indcache, selcache; //per thread and level
+	wspool pool;
+	
+	ngramcache** newcache(int keyplus,int infosize){
+		ngramcache** c=new ngramcache*[ngsz+1];
+		c[0]=NULL;
+		for (int l=1;l<=ngsz;l++) c[l]=new ngramcache(l+keyplus,infosize,DTSEL_CACHE_SIZE);
+		return c;
+	}
+	
+	void deletecache(ngramcache** c){
+		for (int l=1;l<=ngsz;l++) delete c[l];
+		delete [] c;
+	}
+	
+	inline int length(int s){
+		return data->first[s+1]-data->first[s];
+	}
+	
+	inline const int* ngram_codes(int k){
+		return &data->codes[(long long)k * ngsz + ngsz - data->sizes[k]];
+	}
+	
+	inline bool unchanged(const int* w,int n,int g){
+		return changed[dtkey(w,n) & (changed.size()-1)]<=g;
+	}
+	
+	//as prob() with cv=0; the levels above the unigram are cached and stay
+	//valid until an update changes the counts of the n-gram or its history
+	double selprob(ngram& ng,int size,ngramcache** cache){
+		if (size==1) return prob(selngt,ng,1,0);
+		
+		const int* w=ng.wordp(size);
+		dtlevel lv; char* found=cache[size]->get(w,(int*) &lv);
+		if (!found || (lv.gen<gen && !(unchanged(w,size,lv.gen) && unchanged(w,size-1,lv.gen)))){
+			double fstar,lambda;
+			level(selngt,ng,size,0,fstar,lambda);
+			lv.fstar=fstar; lv.lambda=lambda; lv.gen=gen;
+			if (found) cache[size]->set(found,(int*) &lv);
+			else{
+				if (cache[size]->isfull()) cache[size]->reset();
+				cache[size]->add(w,(int*) &lv);
+			}
+		}
+		return lv.fstar + lv.lambda * selprob(ng,size-1,cache);
+	}
+	
+	void indscore(long long s){
+		int th=wspool_thread_id(); if (th<0) th=0;
+		ngram indng(indngt->dict);
+		float H=0; int code[MAX_NGRAM];
+		
+		for (int k=data->first[s];k<data->first[s+1];k++){
+			int size=data->sizes[k]; const int* ngp=ngram_codes(k);
+			for (int i=0;i<size;i++) code[i]=indmap[ngp[i]];
+			indng.size=0; indng.pushc(code,size);
+			H-=log(prob(indngt,indng,indng.size,0,indcache[th]));
+			H-=(*indng.wordp(1)==indoovcode?indoovpenalty:0);
+		}
+		indH[s]=H;
+	}
+	
+	void selscore(long long s){
+		int th=wspool_thread_id(); if (th<0) th=0;
+		ngram selng(dict);
+		float H=indH[s];
+		
+		for (int k=data->first[s];k<data->first[s+1];k++){
+			int size=data->sizes[k];
+			selng.size=0; selng.pushc((int*) ngram_codes(k),size);
+			H+=log(selprob(selng,selng.size,selcache[th]));
+			H+=(*selng.wordp(1)==seloovcode?seloovpenalty:0);
+		}
+		score[s]=H/length(s);
+	}
+	
+	static void init_helper(void* ctx,long long s){
+		((dtselector *)ctx)->indscore(s);
+		((dtselector *)ctx)->selscore(s);
+	}
+	
+	static void rescore_helper(void* ctx,long long i){
+		dtselector* sel=(dtselector *)ctx;
+		sel->selscore(sel->todo[i]);
+	}
+	
+	//keys of the n-grams of each sentence and of their histories
+	void makeindex(){
+		for (int s=0;s<(int)data->lines.size();s++){
+			size_t from=index.size();
+			for (int k=data->first[s];k<data->first[s+1];k++){
+				int size=data->sizes[k]; const int* ngp=ngram_codes(k);
+				dtref r; r.s=s;
+				if (size>=2){ r.key=dtkey(ngp,size); index.push_back(r); }
+				if (size>=3){ r.key=dtkey(ngp,size-1); index.push_back(r); }
+			}
+			sort(index.begin()+from,index.end());
+			index.erase(unique(index.begin()+from,index.end()),index.end());
+		}
+		sort(index.begin(),index.end());
+	}
+	
+	//add the n-grams of the selected sentences to the selected-data model
+	//and mark the sentences whose n-grams or histories have changed
+	void update(vector<int>& block){
+		ngram ng(dict);
+		vector<unsigned long long> keys;
+		gen++;
+		for (size_t i=0;i<block.size();i++)
+			for (int k=data->first[block[i]];k<data->first[block[i]+1];k++){
+				int size=data->sizes[k];
+				ng.size=0;
+				for (int l=size;l<ngsz;l++) ng.pushc(bos);
+				ng.pushc((int*) ngram_codes(k),size);
+				ng.freq=1;
+				selngt->put(ng);
+				
+				//counts change along the path of the n-gram
+				const int* w=ng.wordp(ngsz);
+				for (int l=1;l<=ngsz;l++){
+					unsigned long long key=dtkey(w,l);
+					changed[key & (changed.size()-1)]=gen;
+					if (l>=2) keys.push_back(key);
+				}
+			}
+		sort(keys.begin(),keys.end());
+		keys.erase(unique(keys.begin(),keys.end()),keys.end());
+		
+		size_t j=0;
+		for (size_t i=0;i<keys.size();i++){
+			while (j<index.size() && index[j].key<keys[i]) j++;
+			for (;j<index.size() && index[j].key==keys[i];j++)
+				stale[index[j].s]=1;
+		}
+	}
+	
+	void select(mfstream& output,int blocksize,long long maxwords){
+		int n=data->lines.size();
+		indH.resize(n); score.resize(n); stale.assign(n,0);
+		gen=0; changed.assign(1<<DTSEL_CHANGED_BITS,0);
+		
+		cerr << "scoring " << n << " sentences\n";
+		wspool_parallel_for(pool,0,n,0,&dtselector::init_helper,(void *)this);
+		makeindex();
+		
+		priority_queue< pair<float,int>, vector< pair<float,int> >, greater< pair<float,int> > > queue;
+		for (int s=0;s<n;s++)
+			if (length(s)>0) queue.push(make_pair(score[s],s));
+		
+		//stale sentences reaching the top are rescored in batches
+		//of fixed size, so that the selection does not depend on threads
+		int batch=DTSEL_RESCORE_BATCH;
+		int blocks=0, rescored=0;
+		long long selwords=0, blockwords=0;
+		vector<int> block;
+		
+		while (!queue.empty() && (!maxwords || selwords<maxwords)){
+			int s=queue.top().second;
+			
+			if (stale[s]){ //stale score: recompute and requeue
+				todo.clear();
+				while (!queue.empty() && stale[queue.top().second] && (int)todo.size()<batch){
+					todo.push_back(queue.top().second); queue.pop();
+				}
+				wspool_parallel_for(pool,0,todo.size(),0,&dtselector::rescore_helper,(void *)this);
+				for (size_t i=0;i<todo.size();i++){
+					stale[todo[i]]=0;
+					queue.push(make_pair(score[todo[i]],todo[i]));
+				}
+				rescored+=todo.size();
+				continue;
+			}
+			queue.pop();
+			
+			output << score[s] << " " << data->lines[s] << "\n";
+			block.push_back(s);
+			blockwords+=length(s); selwords+=length(s);
+			
+			if (blockwords>=blocksize){
+				update(block);
+				blocks++;
+				cerr << "block " << blocks << " words " << selwords << " rescored " << rescored << "\n";
+				block.clear(); blockwords=0; rescored=0;
+			}
+		}
+	}
+};
+
+
 int main(int argc, char **argv)
 {
 	char *indom=NULL;   //indomain data: one sentence per line
@@ -137,8 +578,11 @@ int main(int argc, char **argv)
 	int cv=1;              //cross-validation parameter: 1 only in-domain cross-entropy, 
 
 	int blocksize=100000; //block-size in words
+	int threads=1;        //number of scoring threads
 	int verbose=0;
 	int useindex=0; //provided score file includes and index
+	int incremental=0; //select incrementally against the selected data
+	long long maxwords=0; //maximum number of words to select incrementally
 	double convergence_treshold=0;
 	
 	bool help=false;
@@ -174,12 +618,21 @@ int main(int argc, char **argv)
 				  "block-size", CMDINTTYPE|CMDMSG, &blocksize, "block-size in words, default: 100000",
 				  "bs", CMDINTTYPE|CMDMSG, &blocksize, "block-size in words, default: 100000",
 				  
+				  "threads", CMDINTTYPE|CMDMSG, &threads, "number of threads used for scoring, default: 1",
+				  "th", CMDINTTYPE|CMDMSG, &threads, "number of threads used for scoring, default: 1",
+				  
 				  "convergence-threshold", CMDDOUBLETYPE|CMDMSG, &convergence_treshold, "convergence threshold, default: 0",
 				  "c", CMDDOUBLETYPE|CMDMSG, &convergence_treshold, "convergence threshold, default: 0",
 				  
 				  "index", CMDSUBRANGETYPE|CMDMSG, &useindex,0,1, "provided score file includes and index, default: 0",
 				  "x", CMDSUBRANGETYPE|CMDMSG, &useindex,0,1, "provided score file includes and index, default: 0",
 
+				  "incremental", CMDSUBRANGETYPE|CMDMSG, &incremental,0,1, "select blocks of sentences against a model of the data selected so far, default: 0",
+				  "inc", CMDSUBRANGETYPE|CMDMSG, &incremental,0,1, "select blocks of sentences against a model of the data selected so far, default: 0",
+				  
+				  "max-words", CMDLONGLONGTYPE|CMDMSG, &maxwords, "maximum number of words selected in incremental mode, default: 0 (all)",
+				  "mw", CMDLONGLONGTYPE|CMDMSG, &maxwords, "maximum number of words selected in incremental mode, default: 0 (all)",
+				  
 				  "verbose", CMDSUBRANGETYPE|CMDMSG, &verbose,0,2, "verbose level, default: 0",
 				  "v", CMDSUBRANGETYPE|CMDMSG, &verbose,0,2, "verbose level, default: 0",
 								"Help", CMDBOOLTYPE|CMDMSG, &help, "print this help",
@@ -234,6 +687,48 @@ int main(int argc, char **argv)
 		ngram indng(indngt->dict);
 		int indoovcode=indngt->dict->oovcode();
 		
+		if (incremental){
+			
+			//build empty model of the selected data, sharing codes with dict
+			dict->genoovcode();
+			ngramtable *selngt=new ngramtable(NULL,ngsz,NULL,dict,NULL,0,0,NULL,0,table_type);
+			int bos=dict->encode(dict->BoS());
+			
+			//load all candidate sentences
+			mfstream inp(outdom,ios::in); ngram ng(dict); tokenizer tok(inp);
+			dtreader reader;
+			reader.tok=&tok; reader.ng=&ng; reader.bos=bos; reader.ngsz=ngsz;
+			reader.useindex=useindex; reader.words=0;
+			dtblock* data=new dtblock;
+			reader.read(data,INT_MAX);
+			
+			dtselector selector;
+			selector.indngt=indngt; selector.selngt=selngt; selector.dict=dict;
+			selector.ngsz=ngsz; selector.bos=bos; selector.data=data;
+			for (int c=0;c<dict->size();c++)
+				selector.indmap.push_back(indngt->dict->encode(dict->decode(c)));
+			selector.indoovcode=indoovcode; selector.indoovpenalty=indoovpenalty;
+			selector.seloovcode=dict->oovcode(); selector.seloovpenalty=-log(dub-dict->size());
+			selector.pool=wspool_init(threads);
+			for (int t=0;t<threads;t++){
+				selector.indcache.push_back(selector.newcache(1,sizeof(double)));
+				selector.selcache.push_back(selector.newcache(0,sizeof(dtlevel)));
+			}
+			
+			mfstream output(scorefile,ios::out);
+			selector.select(output,blocksize,maxwords);
+			output.close();
+			
+			wspool_destroy(selector.pool);
+			for (int t=0;t<threads;t++){
+				selector.deletecache(selector.indcache[t]);
+				selector.deletecache(selector.selcache[t]);
+			}
+			delete data;
+			delete selngt;
+			exit_error(IRSTLM_NO_ERROR);
+		}
+		
 		//build out-domain table restricted to the in-domain dictionary
 		char command[1000]="";
 			
@@ -251,53 +746,50 @@ int main(int argc, char **argv)
 		cerr << "dict size idom: " << indngt->dict->size() << " odom: " << outdngt->dict->size() << "\n";
 		cerr << "oov penalty idom: " << indoovpenalty << " odom: " << outdoovpenalty << "\n";
 		
-		//go through the odomain sentences 
+		//go through the odomain sentences: reading, scoring and writing
+		//of blocks of sentences run in a pipeline
 		int bos=dict->encode(dict->BoS());
-		mfstream inp(outdom,ios::in); ngram ng(dict);
-		mfstream txt(outdom,ios::in);
+		mfstream inp(outdom,ios::in); ngram ng(dict); tokenizer tok(inp);
 		mfstream output(scorefile,ios::out);
-					
-
-		int linenumber=1; string line;	
-		int length=0;
-		float deltaH=0;
-		float deltaHoov=0;
-		int words=0;string index;
-
-		while (getline(inp,line)){
-
-			istringstream lninp(line);
-	
-			linenumber++;
-			
-			if (useindex) lninp >> index;
-			
-			// reset ngram at begin of sentence
-			ng.size=1; deltaH=0;deltaHoov=0; length=0;
-			
-			while(lninp>>ng){
-			
-				if (*ng.wordp(1)==bos) continue;
-											
-				length++; words++;
-				
-				if ((words % 1000000)==0) cerr << ".";				
-				
-				if (ng.size>ngsz) ng.size=ngsz;
-				indng.trans(ng);outdng.trans(ng);
-				
-				if (model==1){//compute cross-entropy
-					deltaH-=log(prob(indngt,indng,indng.size,0));	
-					deltaHoov-=(*indng.wordp(1)==indoovcode?indoovpenalty:0);
-				}
-				
-				if (model==2){ //compute cross-entropy difference
-					deltaH+=log(prob(outdngt,outdng,outdng.size,cv))-log(prob(indngt,indng,indng.size,0));	
-					deltaHoov+=(*outdng.wordp(1)==outdoovcode?outdoovpenalty:0)-(*indng.wordp(1)==indoovcode?indoovpenalty:0);
-				}											
-			}
+		
+		dtscorer scorer;
+		scorer.indngt=indngt; scorer.outdngt=outdngt;
+		scorer.model=model; scorer.cv=cv; scorer.ngsz=ngsz;
+		scorer.indoovcode=indoovcode; scorer.outdoovcode=outdoovcode;
+		scorer.indoovpenalty=indoovpenalty; scorer.outdoovpenalty=outdoovpenalty;
+		scorer.pool=wspool_init(threads);
+		for (int t=0;t<threads;t++){
+			scorer.indcache.push_back(scorer.newcache());
+			scorer.outdcache.push_back(scorer.newcache());
+		}
+		dtqueue toscore(2), towrite(2);
+		scorer.input=&toscore; scorer.output=&towrite;
+		dtwriter writer; writer.out=&output; writer.input=&towrite;
+		
+		pthread_t scorethread, writethread;
+		pthread_create(&scorethread,NULL,&dtscorer::run,(void *)&scorer);
+		pthread_create(&writethread,NULL,&dtwriter::run,(void *)&writer);
 
-			output << (deltaH + deltaHoov)/length  << " " << line << "\n";													
+		dtreader reader;
+		reader.tok=&tok; reader.ng=&ng; reader.bos=bos; reader.ngsz=ngsz;
+		reader.useindex=useindex; reader.words=0;
+		
+		dtblock* block=new dtblock;
+		while (reader.read(block,blocksize)){
+			scorer.extendmaps(dict); //only this thread encodes
+			toscore.push(block);
+			block=new dtblock;
+		}
+		delete block;
+		toscore.push(NULL);
+		
+		pthread_join(scorethread,NULL);
+		pthread_join(writethread,NULL);
+		
+		wspool_destroy(scorer.pool);
+		for (int t=0;t<threads;t++){
+			scorer.deletecache(scorer.indcache[t]);
+			scorer.deletecache(scorer.outdcache[t]);
 		}
 	}
 	else{
@@ -333,9 +825,7 @@ int main(int argc, char **argv)
 			
 		long totwords=0; long totlines=0; long nextstep=blocksize; 
 
-		double score; string index;
-		
-		mfstream outd(scorefile,ios::in); string line;
+		mfstream outd(scorefile,ios::in); tokenizer tok(outd);
 		
 		//initialize n-gram	
 		ngram ng(outdngt->dict); for (int i=1;i<ngsz;i++) ng.pushc(bos); ng.freq=1;
@@ -344,14 +834,14 @@ int main(int argc, char **argv)
 		
 		if (!dict) outddict->incflag(1);
 		
-		while (getline(outd,line)){
-			
-			istringstream lninp(line);
+		while (tok.getline()>=0){
 			
 			//skip score and eventually the index
-			lninp >> score; if (useindex) lninp >> index;
+			int n=tok.encode(ng.dict,useindex?2:1);
 
-			while (lninp >> ng){
+			for (int k=0;k<n;k++){
+				
+				ng.pushc(tok.code()[k]);
 				
 				if (*ng.wordp(1) == bos) continue; 
 				
@@ -30,6 +30,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #include "ngramtable.h"
 #include "normcache.h"
 #include "interplm.h"
+#include "tokenizer.h"
 	
 using namespace std;
 
@@ -384,45 +385,52 @@ void interplm::test_txt(char* filename,int size,bool /* unused parameter: backof
   if (checkpr)
     cerr << "checking probabilities\n";
 
-  while(inp >> ng)
-    if (ng.size>=1) {
+  tokenizer tok(inp);
+  while(tok.getline()>=0) {
+    for (int k=0, len=tok.encode(ng.dict); k<len; k++) {
+      ng.pushc(tok.code()[k]);
+      ng.freq=1;
 
-      ng.size=ng.size>size?size:ng.size;
+      if (ng.size>=1) {
 
-      if (dict->encode(dict->BoS()) != dict->oovcode()) {
-        if (*ng.wordp(1) == dict->encode(dict->BoS())) {
-          ng.size=1; //reset n-grams starting with BoS
-          continue;
+        ng.size=ng.size>size?size:ng.size;
+
+        if (dict->encode(dict->BoS()) != dict->oovcode()) {
+          if (*ng.wordp(1) == dict->encode(dict->BoS())) {
+            ng.size=1; //reset n-grams starting with BoS
+            continue;
+          }
         }
-      }
 
-      pr=prob(ng,ng.size);
+        pr=prob(ng,ng.size);
+
+        if (outpr)
+          outp << ng << "[" << ng.size << "-gram]" << " " << pr << " " << log(pr)/log(10.0) << std::endl;
 
-      if (outpr)
-        outp << ng << "[" << ng.size << "-gram]" << " " << pr << " " << log(pr)/log(10.0) << std::endl;
+        lp-=log(pr);
 
-      lp-=log(pr);
+        n++;
 
-      n++;
+        if (((int) n % 10000)==0) cerr << ".";
 
-      if (((int) n % 10000)==0) cerr << ".";
+        if (*ng.wordp(1) == dict->oovcode()) oov++;
 
-      if (*ng.wordp(1) == dict->oovcode()) oov++;
+        if (checkpr) {
+          double totp=0.0;
+          int oldw=*ng.wordp(1);
+          for (int c=0; c<dict->size(); c++) {
+            *ng.wordp(1)=c;
+            totp+=prob(ng,ng.size);
+          }
+          *ng.wordp(1)=oldw;
 
-      if (checkpr) {
-        double totp=0.0;
-        int oldw=*ng.wordp(1);
-        for (int c=0; c<dict->size(); c++) {
-          *ng.wordp(1)=c;
-          totp+=prob(ng,ng.size);
+          if ( totp < (1.0 - 1e-5) || totp > (1.0 + 1e-5))
+            cout << ng << " " << pr << " [t="<< totp << "] ***\n";
         }
-        *ng.wordp(1)=oldw;
 
-        if ( totp < (1.0 - 1e-5) || totp > (1.0 + 1e-5))
-          cout << ng << " " << pr << " [t="<< totp << "] ***\n";
       }
-
     }
+  }
 
   if (oov && dict->dub()>obswrd())
     lp += oov * log(dict->dub() - obswrd());
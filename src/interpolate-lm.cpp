@@ -29,6 +29,7 @@
 #include "util.h"
 #include "math.h"
 #include "lmContainer.h"
+#include "wspool.h"
 
 #define MAX_N   100
 /********************************/
@@ -43,6 +44,120 @@ inline void error(const char* message)
 
 lmContainer* load_lm(std::string file,int requiredMaxlev,int dub,int memmap, float nlf, float dlf);
 
+
+//n-grams of the development set and their LM probabilities, for weight estimation
+
+struct learnset {
+  dictionary* dict;
+  std::vector<int> codes;        //codes of all n-grams in dict, oldest word first
+  std::vector<long long> start;  //start of each n-gram in codes, plus end
+  std::vector<int> bucket;       //history bucket of each n-gram
+  std::vector<long long> pos;    //column of each n-gram in the probability matrix
+  std::vector<long long> bstart; //first column of each bucket, plus end
+
+  lmContainer** lmt;             //LMs in use for the current range
+  std::vector< std::vector<int> > map; //code of each word of dict in each LM
+  float* P;                      //probability matrix: one row of size() columns per LM
+  long long first, last;         //range of n-grams to collect
+  int parts;                     //the range is split in parts, collected by separate tasks
+
+  learnset() {
+    start.push_back(0);
+  }
+
+  long long size() const {
+    return bucket.size();
+  }
+
+  //histories are bucketed by their length
+  void add(ngram& ng, int buckets) {
+    for (int k=ng.size; k>=1; k--) codes.push_back(*ng.wordp(k));
+    start.push_back(codes.size());
+    bucket.push_back((ng.size-1 < buckets-1)? ng.size-1 : buckets-1);
+  }
+
+  //columns of the same bucket are made contiguous
+  void group(int buckets) {
+    bstart.assign(buckets+1,0);
+    for (long long k=0; k<size(); k++) bstart[bucket[k]+1]++;
+    for (int b=0; b<buckets; b++) bstart[b+1]+=bstart[b];
+    std::vector<long long> next(bstart.begin(),bstart.end()-1);
+    pos.resize(size());
+    for (long long k=0; k<size(); k++) pos[k]=next[bucket[k]]++;
+  }
+
+  //maps the words of dict into the LMs in use
+  void remap(int N) {
+    map.resize(N);
+    for (int i=0; i<N; i++) {
+      dictionary* _dict=lmt[i]->getDict();
+      map[i].resize(dict->size());
+      for (int c=0; c<dict->size(); c++) map[i][c]=_dict->encode(dict->decode(c));
+    }
+  }
+
+  //task t fills part t % parts of the current range in the row of LM
+  //t / parts; caches are checked only if the LM is used by one task
+  static void collect(void* ctx, long long t) {
+    learnset* d=(learnset*) ctx;
+    int i=t / d->parts, p=t % d->parts;
+    lmContainer* lm=d->lmt[i];
+    const std::vector<int>& map=d->map[i];
+    long long n=d->last-d->first;
+    long long b=d->first+n*p/d->parts, e=d->first+n*(p+1)/d->parts;
+
+    float* row=d->P+(size_t)i*d->size();
+    int _ng[MAX_NGRAM];
+    for (long long k=b; k<e; k++) {
+      int sz=d->start[k+1]-d->start[k];
+      for (int j=0; j<sz; j++) _ng[j]=map[d->codes[d->start[k]+j]];
+      row[d->pos[k]]=(float) pow(10.0,lm->clprob(_ng,sz)); //LM log-prob (using caches if available)
+      if (d->parts==1 && !((k+1) % 10000)) lm->check_caches_levels();
+    }
+    if (d->parts==1) lm->check_caches_levels();
+  }
+};
+
+
+//EM estimation of the weights w of N LMs on columns [b0,b1) of the M columns of P
+
+void em(const float* P, long long M, int N, long long b0, long long b1, double* w)
+{
+  long long n=b1-b0;
+  std::vector<double> den(n), c(N);
+  double variation=1.0; // global variation between new old params
+
+  while( variation > 0.01 ) {
+
+    //denominators of EM formula
+    for (long long k=0; k<n; k++) den[k]=0.0;
+    for (int j=0; j<N; j++) {
+      const float* p=P+(size_t)j*M+b0;
+      double wj=w[j];
+      for (long long k=0; k<n; k++) den[k]+=wj*p[k];
+    }
+
+    //expected counts
+    double norm=0.0;
+    for (int j=0; j<N; j++) {
+      const float* p=P+(size_t)j*M+b0;
+      double sum=0.0;
+      for (long long k=0; k<n; k++) sum+=p[k]/den[k];
+      c[j]=w[j]*sum;
+      norm+=c[j];
+    }
+
+    //update weights and compute distance
+    variation=0.0;
+    for (int j=0; j<N; j++) {
+      c[j]/=norm; //c[j] is now the new weight
+      variation+=(w[j]>c[j]?(w[j]-c[j]):(c[j]-w[j]));
+      w[j]=c[j]; //update weights
+    }
+    std::cerr << "Variation " << variation << std::endl;
+  }
+}
+
 void print_help(int TypeFlag=0){
   std::cerr << std::endl << "interpolate-lm - interpolates language models" << std::endl;
   std::cerr << std::endl << "USAGE:"  << std::endl;
@@ -81,6 +196,8 @@ int main(int argc, char **argv)
 	
 	int order = 0;
 	int debug = 0;
+  int threads = 1;
+  int buckets = 1;
   int memmap = 0;
   int requiredMaxlev = 1000;
   int dub = 10000000;
@@ -96,6 +213,10 @@ int main(int argc, char **argv)
 		"l", CMDSTRINGTYPE|CMDMSG, &slearn, "learn optimal interpolation for text-file; default is false",
 		"order", CMDINTTYPE|CMDMSG, &order, "order of n-grams used in --learn (optional)",
 		"o", CMDINTTYPE|CMDMSG, &order, "order of n-grams used in --learn (optional)",						
+		"threads", CMDINTTYPE|CMDMSG, &threads, "number of threads computing LM probabilities in --learn; default is 1",
+		"th", CMDINTTYPE|CMDMSG, &threads, "number of threads computing LM probabilities in --learn; default is 1",
+		"buckets", CMDINTTYPE|CMDMSG, &buckets, "number of history lengths with their own weights in --learn; default is 1",
+		"b", CMDINTTYPE|CMDMSG, &buckets, "number of history lengths with their own weights in --learn; default is 1",
                 "eval", CMDSTRINGTYPE|CMDMSG, &seval, "computes perplexity of the specified text file",
 		"e", CMDSTRINGTYPE|CMDMSG, &seval, "computes perplexity of the specified text file",
 								
@@ -175,6 +296,8 @@ int main(int argc, char **argv)
   std::string lmf[MAX_N]; //lm filenames
 
   float w[MAX_N]; //interpolation weights
+  std::vector<double> bucketw; //interpolation weights of each history bucket, if any
+  int nbuckets=1;
   int N;
 
 
@@ -213,6 +336,23 @@ int main(int argc, char **argv)
     start_lmt[i] = lmt[i] = load_lm(lmf[i],requiredMaxlev,dub,memmap,ngramcache_load_factor,dictionary_load_factor);
   }
 
+  //optional weights of history buckets: ###interpolate-lm:bucket b w1 ... wN
+  while (inptxt.getline(line,BUFSIZ,'\n')) {
+    std::istringstream lstream(line);
+    std::string token;
+    int b;
+    if (!(lstream >> token >> b) || token != "###interpolate-lm:bucket" || b != (int)(bucketw.size()/N))
+      continue;
+    for (int i=0; i<N; i++) {
+      double wi=0.0;
+      lstream >> wi;
+      bucketw.push_back(wi);
+    }
+    nbuckets=b+1;
+  }
+  if (bucketw.empty()) nbuckets=1;
+  else std::cerr << "history buckets: " << nbuckets << std::endl;
+
   inptxt.close();
 
   int maxorder = 0;
@@ -230,16 +370,18 @@ int main(int argc, char **argv)
 
   //Learning mixture weights
   if (learn) {
-    std::vector<float> *p = new std::vector<float>[N]; //LM probabilities
-    float c[N]; //expected counts
-    float den,norm; //inner denominator, normalization term
-    float variation=1.0; // global variation between new old params
+    if (buckets < 1) buckets=1;
 
     dictionary* dict=new dictionary(slearn,1000000,dictionary_load_factor);
     ngram ng(dict);
     int bos=ng.dict->encode(ng.dict->BoS());
     std::ifstream dev(slearn,std::ios::in);
 
+    //first collect the n-grams of the dev set, and the LM replacements found in it
+    learnset data;
+    data.dict=dict;
+    std::vector<long long> replace_at; std::vector<int> replace_id; std::vector<std::string> replace_lm;
+
     for(;;) {
       std::string line;
       getline(dev, line);
@@ -255,13 +397,9 @@ int main(int argc, char **argv)
         lstream >> token >> id >> newlm;
         if(id <= 0 || id > N) {
           std::cerr << "LM id out of range." << std::endl;
-	  delete[] p;
           return 1;
         }
-        id--; // count from 0 now
-        if(lmt[id] != start_lmt[id])
-          delete lmt[id];
-        lmt[id] = load_lm(newlm,requiredMaxlev,dub,memmap,ngramcache_load_factor,dictionary_load_factor);
+        replace_at.push_back(data.size()); replace_id.push_back(id-1); replace_lm.push_back(newlm);
         continue;
       }
       while(lstream >> ng) {
@@ -272,52 +410,82 @@ int main(int argc, char **argv)
           continue;
         }
         if (order > 0 && ng.size > order) ng.size=order;
-        for (int i=0; i<N; i++) {
-          ngram ong(lmt[i]->getDict());
-          ong.trans(ng);
-          double logpr;
-          logpr = lmt[i]->clprob(ong); //LM log-prob (using caches if available)
-          p[i].push_back(pow(10.0,logpr));
-        }
+        data.add(ng,buckets);
       }
-
-      for (int i=0; i<N; i++) lmt[i]->check_caches_levels();
     }
     dev.close();
 
-    while( variation > 0.01 ) {
-
-      for (int i=0; i<N; i++) c[i]=0;	//reset counters
-
-      for(unsigned i = 0; i < p[0].size(); i++) {
-        den=0.0;
-        for(int j = 0; j < N; j++)
-          den += w[j] * p[j][i]; //denominator of EM formula
-        //update expected counts
-        for(int j = 0; j < N; j++)
-          c[j] += w[j] * p[j][i] / den;
+    //LM probabilities: one row of the matrix per LM, points grouped by bucket
+    long long M=data.size();
+    data.group(buckets);
+    std::vector<float> P((size_t)N*M);
+    data.P=M?&P[0]:NULL;
+
+    wspool pool=(threads>1)?wspool_init(threads):NULL;
+    long long first=0;
+    for (size_t r=0; r<=replace_at.size(); r++) {
+      long long last=(r<replace_at.size())?replace_at[r]:M;
+      if (first < last) {
+        data.lmt=lmt; data.first=first; data.last=last;
+        data.remap(N);
+
+        //parts of the range of the same LM are collected concurrently only
+        //if LMs are read-only, as in compile-lm --eval; otherwise each LM
+        //is used by one task
+        bool split=(pool!=NULL);
+        for (int i=0; i<N; i++)
+          if (lmt[i]->getLanguageModelType() != _IRSTLM_LMTABLE) split=false;
+#if defined(PS_CACHE_ENABLE) || defined(LMT_CACHE_ENABLE)
+        split=false;
+#endif
+        data.parts=split?4*threads:1;
+
+        if (pool) wspool_parallel_for(pool,0,(long long)N*data.parts,1,&learnset::collect,(void*)&data);
+        else for (int i=0; i<N; i++) learnset::collect((void*)&data,i);
       }
-
-      norm=0.0;
-      for (int i=0; i<N; i++) norm+=c[i];
-
-      //update weights and compute distance
-      variation=0.0;
-      for (int i=0; i<N; i++) {
-        c[i]/=norm; //c[i] is now the new weight
-        variation+=(w[i]>c[i]?(w[i]-c[i]):(c[i]-w[i]));
-        w[i]=c[i]; //update weights
+      first=last;
+      if (r<replace_at.size()) {
+        int id=replace_id[r];
+        if(lmt[id] != start_lmt[id])
+          delete lmt[id];
+        lmt[id] = load_lm(replace_lm[r],requiredMaxlev,dub,memmap,ngramcache_load_factor,dictionary_load_factor);
       }
-      std::cerr << "Variation " << variation << std::endl;
+    }
+    if (pool) wspool_destroy(pool);
+
+    //EM iterations, independently for each bucket of histories
+    bucketw.assign((size_t)buckets*N,0.0);
+    for (int b=0; b<buckets; b++) {
+      for (int i=0; i<N; i++) bucketw[b*N+i]=w[i];
+      if (data.bstart[b] == data.bstart[b+1]) continue; //no data: filled below
+      em(&P[0],M,N,data.bstart[b],data.bstart[b+1],&bucketw[b*N]);
     }
 
+    //global weights are the ones of the most frequent bucket when buckets are used
+    int top=0;
+    for (int b=1; b<buckets; b++)
+      if (data.bstart[b+1]-data.bstart[b] > data.bstart[top+1]-data.bstart[top]) top=b;
+    for (int i=0; i<N; i++) w[i]=bucketw[top*N+i];
+    for (int b=0; b<buckets; b++)
+      if (data.bstart[b] == data.bstart[b+1])
+        for (int i=0; i<N; i++) bucketw[b*N+i]=w[i];
+
     //Saving results
     std::cerr << "Saving in " << outfile << "..." << std::endl;
     std::fstream outtxt(outfile.c_str(),std::ios::out);
     outtxt << "LMINTERPOLATION " << N << "\n";
     for (int i=0; i<N; i++) outtxt << w[i] << " " << lmf[i] << "\n";
+    if (buckets > 1)
+      for (int b=0; b<buckets; b++) {
+        outtxt << "###interpolate-lm:bucket " << b;
+        for (int i=0; i<N; i++) outtxt << " " << bucketw[b*N+i];
+        outtxt << "\n";
+      }
     outtxt.close();
-    delete[] p;
+    delete dict;
+
+    nbuckets=buckets;
+    if (nbuckets == 1) bucketw.clear();
   }
 
   for(int i = 0; i < N; i++)
@@ -343,6 +511,10 @@ int main(int argc, char **argv)
     //normalize weights
     for (i=0,Pr=0; i<N; i++) Pr+=w[i];
     for (i=0; i<N; i++) w[i]/=Pr;
+    for (int b=0; b<(int)bucketw.size()/N; b++) {
+      for (i=0,Pr=0; i<N; i++) Pr+=bucketw[b*N+i];
+      for (i=0; i<N; i++) bucketw[b*N+i]/=Pr;
+    }
 
     dictionary* dict=new dictionary(NULL,1000000,dictionary_load_factor);
     dict->incflag(1);
@@ -372,6 +544,7 @@ int main(int argc, char **argv)
           }
           lstream >> w[i];
         }
+        bucketw.clear(); nbuckets=1;
         continue;
       }
       if(line.substr(0, 29) == "###interpolate-lm:replace-lm ") {
@@ -410,6 +583,15 @@ int main(int argc, char **argv)
           bool OOV_any_flag=false; //OOV flag wrt any LM[i]
           float logpr;
 
+          //weights of the history bucket, if any
+          const float* _w=w;
+          float wb[MAX_N];
+          if (!bucketw.empty()) {
+            int b=(ng.size-1 < nbuckets-1)? ng.size-1 : nbuckets-1;
+            for (i=0; i<N; i++) wb[i]=bucketw[b*N+i];
+            _w=wb;
+          }
+
           Pr = 0.0;
           for (i=0; i<N; i++) {
 
@@ -418,7 +600,7 @@ int main(int argc, char **argv)
             logpr = lmt[i]->clprob(ong,&bow,&bol,&msp,&statesize); //actual prob of the interpolation
             //logpr = lmt[i]->clprob(ong,&bow,&bol); //LM log-prob
 
-            Pr+=w[i] * pow(10.0,logpr); //actual prob of the interpolation
+            Pr+=_w[i] * pow(10.0,logpr); //actual prob of the interpolation
             if (bol < minbol) minbol=bol; //backoff of LM[i]
 
             if (*ong.wordp(1) != lmt[i]->getDict()->oovcode()) OOV_all_flag=false; //OOV wrt LM[i]
@@ -70,6 +70,7 @@ inline void error(const char* message)
 lmContainer::lmContainer()
 {
   requiredMaxlev=1000;
+  allocpolicy=PALLOC_DEFAULT;
 	lmtype=_IRSTLM_LMUNKNOWN;
 	maxlev=0;
 }
@@ -155,6 +156,7 @@ bool lmContainer::filter(const string sfilter, lmContainer*& sublmC, const strin
     //let know that table has inverted n-grams
     sublmC->is_inverted(is_inverted());
     sublmC->setMaxLoadedLevel(getMaxLoadedLevel());
+    sublmC->setAllocPolicy(getAllocPolicy());
     sublmC->maxlevel(maxlevel());
 
     bool res=((lmtable*) this)->filter(sfilter, (lmtable*) sublmC, skeepunigrams);
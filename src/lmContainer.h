@@ -50,6 +50,7 @@ protected:
   int          lmtype; //auto reference to its own type
   int          maxlev; //maximun order of sub LMs;
   int  requiredMaxlev; //max loaded level, i.e. load up to requiredMaxlev levels
+  int  allocpolicy; //allocation policy (PALLOC_*) of the in-memory tables
 
 public:
 
@@ -101,6 +102,14 @@ public:
     return requiredMaxlev;
   };
 
+  //to be set before load(); levels accessed via memory map are not affected
+  inline virtual void setAllocPolicy(int policy) {
+    allocpolicy=policy;
+  };
+  inline virtual int getAllocPolicy() {
+    return allocpolicy;
+  };
+
   virtual bool is_inverted(const bool flag) {
     UNUSED(flag);
     return false;
@@ -129,6 +138,17 @@ public:
   };
 
 
+  //log-probabilities of a batch of n-grams: ng[k] holds the ngsize[k] codes of the k-th n-gram
+  virtual void clprob_batch(int** ng, int* ngsize, int n, double* logpr) {
+    for (int k=0; k<n; k++) logpr[k]=clprob(ng[k],ngsize[k]);
+  };
+
+  //number of threads used by clprob_batch, for containers supporting it
+  virtual void setThreads(int n) {
+    UNUSED(n);
+  };
+
+
   virtual const char *cmaxsuffptr(ngram ng, unsigned int* statesize=NULL)
   {
     UNUSED(ng);
@@ -25,6 +25,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <sstream>
 #include "lmContainer.h"
 #include "lmInterpolation.h"
 #include "util.h"
@@ -46,6 +47,8 @@ lmInterpolation::lmInterpolation(float nlf, float dlf)
   order=0;
   memmap=0;
   isInverted=false;
+  m_buckets=1;
+  m_pool=NULL;
 }
 
 void lmInterpolation::load(const std::string &filename,int mmap)
@@ -113,9 +116,31 @@ void lmInterpolation::load(const std::string &filename,int mmap)
   }
   getDict()->genoovcode();
 	
+  //optional weights of history buckets, as written by interpolate-lm: ###interpolate-lm:bucket b w1 ... wN
+  m_bucketweight.clear();
+  m_buckets=1;
+  while (inp.getline(line,MAX_LINE,'\n')) {
+    std::istringstream lstream(line);
+    std::string token;
+    int b;
+    if (!(lstream >> token >> b) || token != "###interpolate-lm:bucket" || b != (int)(m_bucketweight.size()/m_number_lm))
+      continue;
+    for (int i=0; i<m_number_lm; i++) {
+      double wi=0.0;
+      lstream >> wi;
+      m_bucketweight.push_back(wi);
+    }
+    m_buckets=b+1;
+  }
+  if (!m_bucketweight.empty())
+    VERBOSE(2,"lmInterpolation::load(const std::string &filename,int mmap) m_buckets:"<< m_buckets << std::endl;);
+	
   getDict()->incflag(1);
   inp.close();
 	
+  m_map.resize(m_number_lm);
+  update_maps();
+	
   int maxorder = 0;
   for (int i=0; i<m_number_lm; i++) {
     maxorder = (maxorder > m_lm[i]->maxlevel())?maxorder:m_lm[i]->maxlevel();
@@ -140,6 +165,7 @@ lmContainer* lmInterpolation::load_lm(int i,int memmap, float nlf, float dlf)
   lmt->is_inverted(m_isinverted[i]);  //set inverted flag for each LM
 	
   lmt->setMaxLoadedLevel(requiredMaxlev);
+  lmt->setAllocPolicy(allocpolicy);
 	
   lmt->load(m_file[i], memmap);
 	
@@ -148,6 +174,17 @@ lmContainer* lmInterpolation::load_lm(int i,int memmap, float nlf, float dlf)
 }
 
 
+//extends the code remapping tables to the words added to dict since last call
+void lmInterpolation::update_maps()
+{
+  for (int i=0; i<m_number_lm; i++) {
+    dictionary *_dict=m_lm[i]->getDict();
+    for (int c=m_map[i].size(); c<dict->size(); c++)
+      m_map[i].push_back(_dict->encode(dict->decode(c)));
+  }
+}
+
+
 double lmInterpolation::clprob(ngram ng, double* bow,int* bol,char** maxsuffptr,unsigned int* statesize,bool* extendible)
 {
 	
@@ -161,10 +198,24 @@ double lmInterpolation::clprob(ngram ng, double* bow,int* bol,char** maxsuffptr,
 	bool _extendible=false;
   bool actualextendible=false;
 	
+  //bring the n-gram into the interpolated dictionary, then map it
+  //into each sub LM with integer lookups only
+  if (ng.dict != dict) {
+    ngram _ng(dict);
+    _ng.trans(ng);
+    ng=_ng;
+  }
+  for (int k=1; k<=ng.size; ++k)
+    if (*ng.wordp(k) >= (int)m_map[0].size()) update_maps();
+	
+  const double* w=weights(ng.size);
+	
   for (size_t i=0; i<m_lm.size(); i++) {
 		
-    ngram _ng(m_lm[i]->getDict());
-    _ng.trans(ng);
+    ngram _ng(m_lm[i]->getDict(),ng.size);
+    const int *map=&m_map[i][0];
+    for (int k=1; k<=ng.size; ++k)
+      *_ng.wordp(k)=map[*ng.wordp(k)];
     _logpr=m_lm[i]->clprob(_ng,&_bow,&_bol,&_maxsuffptr,&_statesize,&_extendible);
 		
     /*
@@ -185,8 +236,8 @@ double lmInterpolation::clprob(ngram ng, double* bow,int* bol,char** maxsuffptr,
     //What is the prob of a LM interpolation? The weighted sum of the prob of the submodels
     //What is the extendible flag of a LM interpolation? true if the extendible flag is one for any LM
 		
-    pr+=m_weight[i]*pow(10.0,_logpr);
-    actualbow+=m_weight[i]*pow(10.0,_bow);
+    pr+=w[i]*pow(10.0,_logpr);
+    actualbow+=w[i]*pow(10.0,_bow);
 		
     if(_statesize > actualstatesize || i == 0) {
       actualmaxsuffptr = _maxsuffptr;
@@ -227,6 +278,65 @@ double lmInterpolation::clprob(int* codes, int sz, double* bow,int* bol,char** m
   return clprob(ong, bow, bol, maxsuffptr, statesize, extendible);
 }
 
+//batch evaluation: each sub LM scores the whole batch on its own, so that
+//sub LMs can run concurrently while each of them is used by one thread only
+
+struct lmibatch {
+  lmInterpolation* lmi;
+  int** ng;
+  int* ngsize;
+  int n;
+  double* logpr; //log-probabilities of all sub LMs: [i*n+k]
+};
+
+void lmInterpolation::clprob_batch_range(void *ctx, long long i)
+{
+  lmibatch* b=(lmibatch*) ctx;
+  const int *map=&b->lmi->m_map[i][0];
+  int _ng[MAX_NGRAM];
+	
+  for (int k=0; k<b->n; k++) {
+    for (int j=0; j<b->ngsize[k]; j++) _ng[j]=map[b->ng[k][j]];
+    b->logpr[i*b->n+k]=b->lmi->m_lm[i]->clprob(_ng,b->ngsize[k]);
+  }
+}
+
+void lmInterpolation::clprob_batch(int** ng, int* ngsize, int n, double* logpr)
+{
+  if (n <= 0) return;
+	
+  //extend the remapping tables before workers read them
+  for (int k=0; k<n; k++) {
+    MY_ASSERT(ngsize[k] <= MAX_NGRAM);
+    for (int j=0; j<ngsize[k]; j++)
+      if (ng[k][j] >= (int)m_map[0].size()) update_maps();
+  }
+	
+  std::vector<double> _logpr(m_number_lm*n);
+  lmibatch b;
+  b.lmi=this; b.ng=ng; b.ngsize=ngsize; b.n=n; b.logpr=&_logpr[0];
+	
+  if (m_pool)
+    wspool_parallel_for(m_pool,0,m_number_lm,1,&lmInterpolation::clprob_batch_range,(void*)&b);
+  else
+    for (int i=0; i<m_number_lm; i++) clprob_batch_range((void*)&b,i);
+	
+  for (int k=0; k<n; k++) {
+    double pr=0.0;
+    const double* w=weights(ngsize[k]);
+    for (int i=0; i<m_number_lm; i++) pr+=w[i]*pow(10.0,_logpr[i*n+k]);
+    logpr[k]=log(pr)/M_LN10;
+  }
+}
+
+void lmInterpolation::setThreads(int n)
+{
+  if (m_pool) wspool_destroy(m_pool);
+  m_pool=NULL;
+  if (n > m_number_lm) n=m_number_lm;
+  if (n > 1) m_pool=wspool_init(n);
+}
+
 double lmInterpolation::setlogOOVpenalty(int dub)
 {
   MY_ASSERT(dub > dict->size());
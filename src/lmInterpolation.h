@@ -33,6 +33,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #include "dictionary.h"
 #include "n_gram.h"
 #include "lmContainer.h"
+#include "wspool.h"
 
 	
 namespace irstlm {
@@ -53,6 +54,8 @@ class lmInterpolation: public lmContainer
   int memmap;  //level from which n-grams are accessed via mmap
 
   std::vector<double> m_weight;
+  std::vector<double> m_bucketweight; //weights of each history bucket, if any: [b*m_number_lm+i]
+  int m_buckets;
   std::vector<std::string> m_file;
   std::vector<bool> m_isinverted;
   std::vector<lmContainer*> m_lm;
@@ -64,10 +67,34 @@ class lmInterpolation: public lmContainer
 
   dictionary *dict; // dictionary for all interpolated LMs
 
+  //code of each word of dict in the dictionary of each sub LM: m_map[i][code]
+  std::vector< std::vector<int> > m_map;
+
+  void update_maps();
+
+  inline int mapcode(int i, int code) {
+    if (code >= (int)m_map[i].size()) update_maps();
+    return m_map[i][code];
+  }
+
+  //weights for an n-gram of the given size: histories are bucketed by their length
+  inline const double* weights(int size) {
+    if (m_buckets <= 1) return &m_weight[0];
+    int b=((size < maxlev)? size : maxlev) - 1;
+    if (b > m_buckets-1) b=m_buckets-1;
+    return &m_bucketweight[b*m_number_lm];
+  }
+
+  wspool m_pool; //persistent workers evaluating the sub LMs of a batch
+
+  static void clprob_batch_range(void *ctx, long long i);
+
 public:
 
   lmInterpolation(float nlf=0.0, float dlfi=0.0);
-  virtual ~lmInterpolation() {};
+  virtual ~lmInterpolation() {
+    if (m_pool) wspool_destroy(m_pool);
+  };
 
   void load(const std::string &filename,int mmap=0);
   lmContainer* load_lm(int i, int memmap, float nlf, float dlf);
@@ -75,6 +102,9 @@ public:
   virtual double clprob(ngram ng,            double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL);
   virtual double clprob(int* ng, int ngsize, double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL);
 
+  virtual void clprob_batch(int** ng, int* ngsize, int n, double* logpr);
+  virtual void setThreads(int n);
+
   int maxlevel() const {
     return maxlev;
   };
@@ -82,6 +112,7 @@ public:
   virtual inline void setDict(dictionary* d) {
 		if (dict) delete dict;
     dict=d;
+    for (size_t i=0; i<m_map.size(); i++) m_map[i].clear();
   };
 	
   virtual inline dictionary* getDict() const {
@@ -119,8 +150,7 @@ public:
 
   inline virtual bool is_OOV(int code) { //returns true if the word is OOV for each subLM
     for (int i=0; i<m_number_lm; i++) {
-      int _code=m_lm[i]->getDict()->encode(getDict()->decode(code));
-      if (m_lm[i]->is_OOV(_code) == false) return false;
+      if (m_lm[i]->is_OOV(mapcode(i,code)) == false) return false;
     }
     return true;
   }
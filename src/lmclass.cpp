@@ -53,15 +53,15 @@ namespace irstlm {
 lmclass::lmclass(float nlf, float dlfi):lmtable(nlf,dlfi)
 {
   MaxMapSize=1000000;
-  MapScore= (double *)malloc(MaxMapSize*sizeof(double));// //array of probabilities
-  memset(MapScore,0,MaxMapSize*sizeof(double));
+  Map= (lmclass_map_t *)malloc(MaxMapSize*sizeof(lmclass_map_t));// //array of classes and probabilities
+  memset(Map,0,MaxMapSize*sizeof(lmclass_map_t));
   MapScoreN=0;
   dict = new dictionary((char *)NULL,MaxMapSize); //word to cluster dictionary
 };
 
 lmclass::~lmclass()
 {
-  free (MapScore);
+  free (Map);
   delete dict;
 }
 
@@ -172,7 +172,7 @@ void lmclass::loadMap(istream& inW2C)
     }
     loadMapElement(words[0],words[1],lprob);
 
-    //check if the are available position in MapScore
+    //check if the are available position in Map
     checkMap();
   }
 
@@ -185,7 +185,7 @@ void lmclass::checkMap()
 {
   if (MapScoreN > MaxMapSize) {
     MaxMapSize=2*MapScoreN;
-    MapScore = (double*) reallocf(MapScore, sizeof(double)*(MaxMapSize));
+    Map = (lmclass_map_t*) reallocf(Map, sizeof(lmclass_map_t)*(MaxMapSize));
     VERBOSE(2,"In lmclass::checkMap(...) MaxMapSize=" <<  MaxMapSize  << " MapScoreN=" <<  MapScoreN  << "\n");
   }
 }
@@ -195,27 +195,74 @@ void lmclass::loadMapElement(const char* in, const char* out, double sc)
   //freq of word (in) encodes the ID of the class (out)
   //save the probability associated with the pair (in,out)
   int wcode=dict->encode(in);
-  dict->freq(wcode,lmtable::dict->encode(out));
-  MapScore[wcode]=sc;
+  int ccode=lmtable::dict->encode(out);
+  dict->freq(wcode,ccode);
+  Map[wcode].ccode=ccode;
+  Map[wcode].score=sc;
   VERBOSE(3,"In lmclass::loadMapElement(...) in=" << in  << " wcode=" <<  wcode << " out=" << out << " ccode=" << lmtable::dict->encode(out) << " MapScoreN=" << MapScoreN  << "\n");
 
-  if (wcode >= MapScoreN) MapScoreN++; //increment size of the array MapScore if the element is new
+  if (wcode >= MapScoreN) MapScoreN++; //increment size of the array Map if the element is new
 }
 
 double lmclass::lprob(ngram ong,double* bow, int* bol, char** maxsuffptr,unsigned int* statesize,bool* extendible)
 {
-  double lpr=getMapScore(*ong.wordp(1));
+  //only the most recent words are relevant
+  int sz=(ong.size<maxlev)?ong.size:maxlev;
+  return clprob(ong.wordp(sz),sz,bow,bol,maxsuffptr,statesize,extendible);
+}
+
+//the class n-gram is built in a local array; results are cached on the word n-gram
+double lmclass::clprob(int* codes, int sz, double* bow, int* bol, char** state,unsigned int* statesize,bool* extendible)
+{
+  if (sz>maxlev) {
+    codes+=sz-maxlev;
+    sz=maxlev;
+  }
+
+  if (sz==0) {
+    if (statesize!=NULL) *statesize=0;
+    if (state!=NULL) *state=NULL;
+    if (extendible!=NULL) *extendible=false;
+    return 0.0;
+  }
+
+#ifdef PS_CACHE_ENABLE
+  prob_and_state_t pst;
+
+  //cache hit
+  if (prob_and_state_cache[sz] && prob_and_state_cache[sz]->get(codes,pst)) {
+    if (bow) *bow = pst.bow;
+    if (bol) *bol = pst.bol;
+    if (state) *state = pst.state;
+    if (statesize) *statesize = pst.statesize;
+    if (extendible) *extendible = pst.extendible;
+    return pst.logpr;
+  }
+#endif
+
+  int ccodes[LMTMAXLEV+1];
+  for (int i=0; i<sz; i++) ccodes[i]=getMap(codes[i]);
+
+  double lpr=getMapScore(codes[sz-1]);
+  VERBOSE(3,"In lmclass::clprob(...) Mapscore    = " <<  lpr  << "\n");
 
-  VERBOSE(3,"In lmclass::lprob(...) Mapscore    = " <<  lpr  << "\n");
+#ifdef PS_CACHE_ENABLE
+  //cache miss: the cache is keyed on words, hence the class LM is queried without it
+  pst.logpr = lpr + lmtable::lprob(ccodes, sz, &(pst.bow), &(pst.bol), &(pst.state), &(pst.statesize), &(pst.extendible));
 
-  //convert ong to it's clustered encoding
-  ngram mapped_ng(lmtable::getDict());
-  //  mapped_ng.trans_freq(ong);
-  mapping(ong,mapped_ng);
+  if (bow) *bow = pst.bow;
+  if (bol) *bol = pst.bol;
+  if (state) *state = pst.state;
+  if (statesize) *statesize = pst.statesize;
+  if (extendible) *extendible = pst.extendible;
 
-  lpr+=lmtable::clprob(mapped_ng,bow,bol,maxsuffptr,statesize, extendible);
+  if (prob_and_state_cache[sz]) prob_and_state_cache[sz]->add(codes,pst);
+  lpr=pst.logpr;
+#else
+  lpr+=lmtable::clprob(ccodes,sz,bow,bol,state,statesize,extendible);
+#endif
 
-  VERBOSE(3,"In lmclass::lprob(...) global prob  = " <<  lpr  << "\n");
+  VERBOSE(3,"In lmclass::clprob(...) global prob  = " <<  lpr  << "\n");
   return lpr;
 }
 
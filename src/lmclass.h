@@ -38,10 +38,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #define LMCLASS_MAX_TOKEN 2
 
 namespace irstlm {
+
+//entry of the word-to-class map
+typedef struct {
+  double score; //log10 prob of the word given its class
+  int ccode;    //code of the class in the dictionary of the LM
+} lmclass_map_t;
+
 class lmclass: public lmtable
 {
   dictionary     *dict; // dictionary (words - macro tags)
-  double *MapScore;
+  lmclass_map_t *Map;   // map entries, indexed by word code
   int MapScoreN;
   int MaxMapSize;
 
@@ -55,7 +62,7 @@ protected:
     if (wcode >= MapScoreN) {
       wcode = getDict()->oovcode();
     }
-    return MapScore[wcode];
+    return Map[wcode].score;
   };
 
   inline size_t getMap(int wcode) {
@@ -63,7 +70,7 @@ protected:
     if (wcode >= MapScoreN) {
       wcode = getDict()->oovcode();
     }
-    return dict->freq(wcode);
+    return Map[wcode].ccode;
   };
 
   void checkMap();
@@ -79,11 +86,7 @@ public:
   inline double clprob(ngram ng,double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL) {
     return lprob(ng,bow,bol,maxsuffptr,statesize,extendible);
   };
-  inline double clprob(int* ng, int ngsize, double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL) {
-    ngram ong(getDict());
-    ong.pushc(ng,ngsize);
-    return lprob(ong,bow,bol,maxsuffptr,statesize,extendible);
-  };
+  double clprob(int* ng, int ngsize, double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL);
 
   inline bool is_OOV(int code) {
     //a word is consisdered OOV if its mapped value is OOV
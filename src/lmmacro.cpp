@@ -54,14 +54,103 @@ lmmacro::lmmacro(float nlf, float dlfi):lmtable(nlf,dlfi)
 {
   dict = new dictionary((char *)NULL,1000000); // dict of micro tags
   getDict()->incflag(1);
+
+  microInfo=NULL;
+  microInfoN=0;
+  pthread_mutex_init(&microInfoLock, NULL);
+  transformcache=NULL;
 };
 
 lmmacro::~lmmacro()
 {
+  if (transformcache) delete transformcache;
+  free((microinfo *)microInfo);
+  for (size_t i=0; i<microInfoOld.size(); i++) free(microInfoOld[i]);
+  pthread_mutex_destroy(&microInfoLock);
   if (mapFlag) unloadmap();
 }
 
 
+void lmmacro::init_caches(int uptolev)
+{
+  lmtable::init_caches(uptolev);
+  if (transformcache==NULL)
+    transformcache=new NGRAMCACHE_t(maxlev,(maxlev+2)*sizeof(int),400000,GetNgramcacheLoadFactor());
+}
+
+void lmmacro::check_caches_levels()
+{
+  lmtable::check_caches_levels();
+  if (transformcache && transformcache->isfull())
+    transformcache->reset(transformcache->cursize());
+}
+
+void lmmacro::reset_caches()
+{
+  lmtable::reset_caches();
+  if (transformcache)
+    transformcache->reset(MAX(transformcache->cursize(),transformcache->maxsize()));
+}
+
+
+//computes the info of all micro codes up to code (included);
+//tables are replaced rather than reallocated, so that concurrent
+//readers never see freed memory
+void lmmacro::extendinfo(int code)
+{
+  pthread_mutex_lock(&microInfoLock);
+
+  if (code >= microInfoN) {
+    int n=getDict()->size();
+    if (n <= code) n=code+1;
+    microinfo* table=(microinfo *)malloc(n*sizeof(microinfo));
+    if (table==NULL) error((char*)"ERROR: cannot allocate the micro token table\n");
+    if (microInfoN) memcpy(table,microInfo,microInfoN*sizeof(microinfo));
+    for (int i=microInfoN; i<n; i++) table[i].field=-1;
+    if (microInfo) microInfoOld.push_back((microinfo *)microInfo);
+    __sync_synchronize();
+    microInfo=table;
+    __sync_synchronize();
+    microInfoN=n;
+  }
+
+  if (microInfo[code].field < 0) {
+    const char* token=getDict()->decode(code);
+
+    int len=strlen(token)-1;
+    int chunk=0;
+    if (len>=0) {
+      if (token[len]=='(' || token[len]=='+' || (token[0]=='(' && token[len]!=')'))
+        chunk|=LMMACRO_CHUNK_OPEN;
+      if (token[len]=='+' || (token[len]==')' && token[0]!='('))
+        chunk|=LMMACRO_CHUNK_CONT;
+    }
+    microInfo[code].chunk=chunk;
+
+    int field=code;
+    if (selectedField >= 0 &&
+        strcmp(token,"<s>") &&
+        strcmp(token,"</s>") &&
+        strcmp(token,"_unk_")) {
+      char curr_token[BUFSIZ];
+      strcpy(curr_token, token);
+      char *f = strtok(curr_token, "#");
+      int j=0;
+      while (j<selectedField && f != NULL) {
+        f = strtok(0, "#");
+        j++;
+      }
+      //see field_selection() for tokens without the selected field
+      field=getDict()->encode(f?f:"_unk_");
+    }
+    __sync_synchronize();
+    microInfo[code].field=field;
+  }
+
+  pthread_mutex_unlock(&microInfoLock);
+}
+
+
 void lmmacro::load(const std::string &filename,int memmap)
 {
   VERBOSE(2,"lmmacro::load(const std::string &filename,int memmap)" << std::endl);
@@ -364,6 +453,20 @@ bool lmmacro::transform(ngram &in, ngram &out)
 {
   VERBOSE(3,"lmmacro::transform(ngram &in, ngram &out), in = <" <<  in << ">\n");
 
+  //collapsed macro n-grams are cached on the micro n-gram, left padded with -1;
+  //the cached info is: collapse flag, size, codes
+  int key[LMTMAXLEV+1], info[LMTMAXLEV+3];
+  bool cached = (transformcache != NULL && in.size <= maxlev);
+  if (cached) {
+    for (int i=0; i<maxlev-in.size; i++) key[i]=-1;
+    memcpy(key+maxlev-in.size,in.wordp(in.size),in.size*sizeof(int));
+    if (transformcache->get(key,info)) {
+      out.size=0;
+      out.pushc(info+2,info[1]);
+      return info[0];
+    }
+  }
+
   //step 1: selection of the correct field
   ngram field_ng(getDict());
   if (selectedField >= 0)
@@ -387,6 +490,13 @@ bool lmmacro::transform(ngram &in, ngram &out)
 
   if (out.size>lmtable::maxlevel()) out.size=lmtable::maxlevel();
 
+  if (cached) {
+    info[0]=collapsed;
+    info[1]=out.size;
+    memcpy(info+2,out.wordp(out.size),out.size*sizeof(int));
+    transformcache->add(key,info);
+  }
+
   VERBOSE(3,"lmmacro::transform(ngram &in, ngram &out), out = <" <<  out << ">\n");
   return collapsed;
 }
@@ -397,52 +507,12 @@ void lmmacro::field_selection(ngram &in, ngram &out)
 {
   VERBOSE(3,"In lmmacro::field_selection(ngram &in, ngram &out) in    = " <<  in  << "\n");
 
+  //tokens without the selected field are mapped into _unk_, see extendinfo()
   int microsize = in.size;
 
-  for (int i=microsize; i>0; i--) {
-
-    char curr_token[BUFSIZ];
-    strcpy(curr_token, getDict()->decode(*in.wordp(i)));
-    char *field;
-    if (strcmp(curr_token,"<s>") &&
-        strcmp(curr_token,"</s>") &&
-        strcmp(curr_token,"_unk_")) {
-      field = strtok(curr_token, "#");
-      int j=0;
-      while (j<selectedField && field != NULL) {
-        field = strtok(0, "#");
-        j++;
-      }
-    } else {
-      field = curr_token;
-    }
-
+  for (int i=microsize; i>0; i--)
+    out.pushc(getinfo(*in.wordp(i)).field);
 
-    if (field) {
-      out.pushw(field);
-    } else {
-
-      out.pushw((char*)"_unk_");
-
-      // cerr << *in << "\n";
-      // error((char*)"ERROR: Malformed input: selected field does not exist in token\n");
-
-      /**
-      We can be here in 2 cases:
-
-      a. effectively when the token is malformed, that is the selected
-      field does not exist
-
-      b. in case of verbatim translation, that is the source word is
-      not known to the phrase table and moses transfers it as it is
-      to the target side: in this case, no assumption can be made on its
-      format, which means that the selected field can not exist
-
-      The possibility of case (b) makes incorrect the error exit from
-      the code at this point: correct, on the contrary, push the _unk_ string
-      **/
-    }
-  }
   VERBOSE(3,"In lmmacro::field_selection(ngram &in, ngram &out) out    = " <<  out  << "\n");
   return;
 }
@@ -578,52 +648,8 @@ void lmmacro::map(ngram *in, ngram *out)
     Micro2MacroMapping(in, out);
 
   else if (selectedField<10) { // select the field "selectedField" from tokens (separator is assumed to be "#")
-    ngram field_ng(((lmmacro *)this)->getDict());
-    int microsize = in->size;
-
-    for (int i=microsize; i>0; i--) {
-
-      char curr_token[BUFSIZ];
-      strcpy(curr_token, ((lmmacro *)this)->getDict()->decode(*(in->wordp(i))));
-      char *field;
-      if (strcmp(curr_token,"<s>") &&
-          strcmp(curr_token,"</s>") &&
-          strcmp(curr_token,"_unk_")) {
-        field = strtok(curr_token, "#");
-        int j=0;
-        while (j<selectedField && field != NULL) {
-          field = strtok(0, "#");
-          j++;
-        }
-      } else {
-        field = curr_token;
-      }
-
-      if (field)
-        field_ng.pushw(field);
-      else {
-
-        field_ng.pushw((char*)"_unk_");
-
-        // cerr << *in << "\n";
-        // error((char*)"ERROR: Malformed input: selected field does not exist in token\n");
-
-        /**
-            We can be here in 2 cases:
-
-            a. effectively when the token is malformed, that is the selected
-            field does not exist
-
-            b. in case of verbatim translation, that is the source word is
-            not known to the phrase table and moses transfers it as it is
-            to the target side: in this case, no assumption can be made on its
-            format, which means that the selected field can not exist
-
-            The possibility of case (b) makes incorrect the error exit from
-            the code at this point: correct, on the contrary, push the _unk_ string
-        **/
-      }
-    }
+    ngram field_ng(getDict());
+    field_selection(*in, field_ng);
     if (microMacroMapN>0)
       Micro2MacroMapping(&field_ng, out);
     else
@@ -718,33 +744,22 @@ void lmmacro::Micro2MacroMapping(ngram *in, ngram *out)
   VERBOSE(2,"In Micro2MacroMapping, in    = " <<  *in  << "\n");
 
   // map microtag sequence (in) into the corresponding sequence of macrotags (possibly shorter) (out)
+  // a tag is dropped if it continues the chunk opened by the previous one
 
   for (int i=microsize; i>0; i--) {
 
     int curr_code = *(in->wordp(i));
-    const char *curr_macrotag = lmtable::getDict()->decode((curr_code<microMacroMapN)?microMacroMap[curr_code]:lmtable::getDict()->oovcode());
+    int curr_macro = macrocode(curr_code);
 
     if (i==microsize) {
-      out->pushw(curr_macrotag);
+      out->pushc(curr_macro);
 
     } else {
       int prev_code = *(in->wordp(i+1));
 
-      const char *prev_microtag = getDict()->decode(prev_code);
-      const char *curr_microtag = getDict()->decode(curr_code);
-      const char *prev_macrotag = lmtable::getDict()->decode((prev_code<microMacroMapN)?microMacroMap[prev_code]:lmtable::getDict()->oovcode());
-
-
-      int prev_len = strlen(prev_microtag)-1;
-      int curr_len = strlen(curr_microtag)-1;
-
-      if (strcmp(curr_macrotag,prev_macrotag) != 0 ||
-          !(
-            (( prev_microtag[prev_len]== '(' || ( prev_microtag[0]== '(' && prev_microtag[prev_len]!= ')' )) &&  ( curr_microtag[curr_len]==')' && curr_microtag[0]!='(')) ||
-            (( prev_microtag[prev_len]== '(' || ( prev_microtag[0]== '(' && prev_microtag[prev_len]!= ')' )) &&  curr_microtag[curr_len]=='+' ) ||
-            (prev_microtag[prev_len]== '+' &&  curr_microtag[curr_len]=='+' ) ||
-            (prev_microtag[prev_len]== '+' &&  ( curr_microtag[curr_len]==')' && curr_microtag[0]!='(' ))))
-        out->pushw(curr_macrotag);
+      if (curr_macro != macrocode(prev_code) ||
+          !((getinfo(prev_code).chunk & LMMACRO_CHUNK_OPEN) && (getinfo(curr_code).chunk & LMMACRO_CHUNK_CONT)))
+        out->pushc(curr_macro);
     }
   }
   return;
@@ -29,6 +29,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #include <sys/mman.h>
 #endif
 
+#include <pthread.h>
+#include <vector>
 #include "util.h"
 #include "ngramcache.h"
 #include "dictionary.h"
@@ -37,6 +39,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 	
 #define MAX_TOKEN_N_MAP 5
 
+//chunk role of a micro tag, see Micro2MacroMapping
+#define LMMACRO_CHUNK_OPEN 1 //it can be continued by the next tag
+#define LMMACRO_CHUNK_CONT 2 //it can continue the previous tag
+
 namespace irstlm {
 	
 class lmmacro: public lmtable
@@ -54,6 +60,29 @@ class lmmacro: public lmtable
   bool           *collapsableMap;
   bool           *collapsatorMap;
 
+  //integer view of the micro dictionary, filled lazily:
+  //the selected field of each token and its chunk role
+  typedef struct {
+    int field;   //micro code of the selected field, -1 if not computed yet
+    int chunk;   //LMMACRO_CHUNK_* flags of the token as a micro tag
+  } microinfo;
+
+  microinfo * volatile microInfo;
+  volatile int         microInfoN;
+  std::vector<microinfo*> microInfoOld; //replaced tables, freed at the end
+  pthread_mutex_t      microInfoLock;
+
+  NGRAMCACHE_t   *transformcache; //micro n-gram -> collapsed macro n-gram
+
+  void extendinfo(int code);
+  inline const microinfo& getinfo(int code) {
+    if (code >= microInfoN || microInfo[code].field < 0) extendinfo(code);
+    return microInfo[code];
+  }
+  inline int macrocode(int code) const {
+    return (code<microMacroMapN)?microMacroMap[code]:lmtable::getDict()->oovcode();
+  }
+
 #ifdef DLEXICALLM
   int             selectedFieldForLexicon;
   int            *lexicaltoken2classMap;
@@ -76,6 +105,10 @@ public:
 
   void load(const std::string &filename,int mmap=0);
 
+  void init_caches(int uptolev);
+  void check_caches_levels();
+  void reset_caches();
+
   double lprob(ngram ng);
   double clprob(ngram ng,double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL);
   double clprob(int* ng, int ngsize, double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL);
@@ -93,15 +126,8 @@ public:
 #endif
 
 	inline bool is_OOV(int code) {
-		ngram word_ng(getDict());
-		ngram field_ng(getDict());
-		word_ng.pushc(code); 
-		if (selectedField >= 0)
-			field_selection(word_ng, field_ng);
-		else
-			field_ng = word_ng;
-		int field_code=*field_ng.wordp(1);
-		VERBOSE(2,"inline virtual bool lmmacro::is_OOV(int code) word_ng:" << word_ng << " field_ng:" << field_ng << std::endl);
+		int field_code=getinfo(code).field;
+		VERBOSE(2,"inline virtual bool lmmacro::is_OOV(int code) code:" << code << " field_code:" << field_code << std::endl);
 		//the selected field(s) of a token is considered OOV 
 		//either if unknown by the microMacroMap
 		//or if its mapped macroW is OOV
@@ -38,6 +38,14 @@
 #include "lmContainer.h"
 #include "lmtable.h"
 #include "util.h"
+#include "wspool.h"
+#include <sys/resource.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 //special value for pruned iprobs
 #define NOPROB ((float)-1.329227995784915872903807060280344576e36)
@@ -66,6 +74,93 @@ void print(prob_and_state_t* pst, std::ostream& out)
 	}
 }
 
+//slot of the calling thread, used to address its counters: a slot is
+//taken by one live thread at a time and released when the thread exits,
+//so that its counts are kept for the next one; threads beyond
+//LMT_INSTR_MAXTHREADS share slot LMT_INSTR_MAXTHREADS
+static __thread int lmt_thread_slot=-1;
+static int lmt_slot_busy[LMT_INSTR_MAXTHREADS];
+static pthread_key_t lmt_thread_key;
+static pthread_once_t lmt_thread_once=PTHREAD_ONCE_INIT;
+
+//hardware counters of the calling thread: cycles and LLC misses;
+//-2 if not opened yet, -1 if not available
+static __thread int lmt_perf_fd[2]={-2,-2};
+
+//releases the slot and the hardware counters of an exiting thread
+static void lmt_thread_exit(void* arg)
+{
+	long slot=(long) arg - 1;
+#ifdef __linux__
+	for (int i=0; i<2; i++)
+		if (lmt_perf_fd[i]>=0) close(lmt_perf_fd[i]);
+#endif
+	lmt_perf_fd[0]=lmt_perf_fd[1]=-2;
+	if (slot<LMT_INSTR_MAXTHREADS) __sync_lock_release(&lmt_slot_busy[slot]);
+	lmt_thread_slot=-1;
+}
+
+static void lmt_thread_init()
+{
+	pthread_key_create(&lmt_thread_key,lmt_thread_exit);
+}
+
+//takes the first free slot for the calling thread
+static int lmt_thread_enter()
+{
+	pthread_once(&lmt_thread_once,lmt_thread_init);
+	int slot=0;
+	while (slot<LMT_INSTR_MAXTHREADS && (lmt_slot_busy[slot] || !__sync_bool_compare_and_swap(&lmt_slot_busy[slot],0,1)))
+		slot++;
+	pthread_setspecific(lmt_thread_key,(void*) (long) (slot+1)); //non NULL, to get the destructor called
+	return lmt_thread_slot=slot;
+}
+
+//adds v to a counter of the calling thread and returns its value; the
+//shared slot is updated atomically
+static inline unsigned long long lmt_count(unsigned long long& c,unsigned long long v=1)
+{
+	if (lmt_thread_slot<LMT_INSTR_MAXTHREADS) return c+=v;
+	return __sync_add_and_fetch(&c,v);
+}
+
+#ifdef __linux__
+static int perf_open(unsigned int type,unsigned long long config)
+{
+	struct perf_event_attr pe;
+	memset(&pe,0,sizeof(pe));
+	pe.type=type;
+	pe.size=sizeof(pe);
+	pe.config=config;
+	pe.exclude_kernel=1;
+	pe.exclude_hv=1;
+	return (int) syscall(__NR_perf_event_open,&pe,0,-1,-1,0);
+}
+#endif
+
+//reads both hardware counters; false if they are not available
+static bool perf_read(unsigned long long* c)
+{
+#ifdef __linux__
+	if (lmt_perf_fd[0]==-2) {
+		lmt_perf_fd[0]=perf_open(PERF_TYPE_HARDWARE,PERF_COUNT_HW_CPU_CYCLES);
+		lmt_perf_fd[1]=perf_open(PERF_TYPE_HARDWARE,PERF_COUNT_HW_CACHE_MISSES);
+		if (lmt_perf_fd[0]<0 || lmt_perf_fd[1]<0) {
+			if (lmt_perf_fd[0]>=0) close(lmt_perf_fd[0]);
+			if (lmt_perf_fd[1]>=0) close(lmt_perf_fd[1]);
+			lmt_perf_fd[0]=lmt_perf_fd[1]=-1;
+			VERBOSE(1,"lmtable: hardware counters are not available" << std::endl);
+		}
+	}
+	if (lmt_perf_fd[0]<0) return false;
+	return read(lmt_perf_fd[0],&c[0],sizeof(c[0]))==sizeof(c[0]) &&
+	       read(lmt_perf_fd[1],&c[1],sizeof(c[1]))==sizeof(c[1]);
+#else
+	UNUSED(c);
+	return false;
+#endif
+}
+
 namespace irstlm {
 	
 	//instantiate an empty lm table
@@ -74,6 +169,7 @@ namespace irstlm {
 		ngramcache_load_factor = nlf;
 		dictionary_load_factor = dlf;
 		isInverted=false;
+		isQtable=false;
 		configure(1,false);
 		
 		dict=new dictionary((char *)NULL,1000000,dictionary_load_factor);
@@ -81,6 +177,8 @@ namespace irstlm {
 		
 		memset(table, 0, sizeof(table));
 		memset(tableGaps, 0, sizeof(tableGaps));
+		memset(tableAlloc, 0, sizeof(tableAlloc));
+		memset(tableSize, 0, sizeof(tableSize));
 		memset(cursize, 0, sizeof(cursize));
 		memset(tbltype, 0, sizeof(tbltype));
 		memset(maxsize, 0, sizeof(maxsize));
@@ -91,6 +189,8 @@ namespace irstlm {
 		max_cache_lev=0;
 		for (int i=0; i<LMTMAXLEV+1; i++) lmtcache[i]=NULL;
 		for (int i=0; i<LMTMAXLEV+1; i++) prob_and_state_cache[i]=NULL;
+		memset(prunekeep, 0, sizeof(prunekeep));
+		memset(prunebow, 0, sizeof(prunebow));
 		//		prob_and_state_cache=NULL;
 		
 #ifdef TRACE_CACHELM
@@ -106,7 +206,8 @@ namespace irstlm {
 		isInverted=false;
 		
 		//statistics
-		for (int i=0; i<=LMTMAXLEV+1; i++) totget[i]=totbsearch[i]=0;
+		instr=LMT_INSTR_COUNTS;
+		memset(tstats, 0, sizeof(tstats));
 		
 		logOOVpenalty=0.0; //penalty for OOV words (default 0)
 		
@@ -117,6 +218,9 @@ namespace irstlm {
 	lmtable::~lmtable()
 	{
 		delete_caches();
+		prune_free();
+		for (int t=0; t<=LMT_INSTR_MAXTHREADS; t++)
+			if (tstats[t]) free(tstats[t]);
 		
 #ifdef TRACE_CACHELM
 		cacheout->close();
@@ -128,7 +232,7 @@ namespace irstlm {
 				if (memmap > 0 && l >= memmap)
 					Munmap(table[l]-tableGaps[l],cursize[l]*nodesize(tbltype[l])+tableGaps[l],0);
 				else
-					delete [] table[l];
+					free_level(l);
 			}
 			if (isQtable) {
 				if (Pcenters[l]) delete [] Pcenters[l];
@@ -140,6 +244,24 @@ namespace irstlm {
 		if (delete_dict) delete dict;
 	};
 	
+	//allocates an in-memory level according to the allocation policy
+	char* lmtable::alloc_level(int level,table_pos_t size)
+	{
+		table[level]=(char*) PAlloc(size,allocpolicy,&tableAlloc[level]);
+		if (table[level]==NULL) exit_error(IRSTLM_ERROR_MEMORY, "lmtable::alloc_level: cannot allocate table");
+		tableSize[level]=size;
+		VERBOSE(2,"level " << level << ": " << size << " bytes, allocation " << PAllocName(tableAlloc[level]) << std::endl);
+		return table[level];
+	}
+	
+	void lmtable::free_level(int level)
+	{
+		PFree(table[level],tableSize[level],tableAlloc[level]);
+		table[level]=NULL;
+		tableAlloc[level]=PALLOC_DEFAULT;
+		tableSize[level]=0;
+	}
+	
 	void lmtable::init_prob_and_state_cache()
 	{
 #ifdef PS_CACHE_ENABLE
@@ -288,6 +410,38 @@ namespace irstlm {
 	}
 	
 	
+	bool lmtable::prob_and_state_cache_stat(int lev,long long& acc,long long& hits,long long& evicted) const
+	{
+		acc=hits=evicted=0;
+#ifdef PS_CACHE_ENABLE
+		if (lev>=1 && lev<=max_cache_lev && prob_and_state_cache[lev]) {
+			acc=prob_and_state_cache[lev]->naccesses();
+			hits=prob_and_state_cache[lev]->nhits();
+			evicted=prob_and_state_cache[lev]->nevicted();
+			return true;
+		}
+#else
+		UNUSED(lev);
+#endif
+		return false;
+	}
+	
+	bool lmtable::lmtcache_stat(int lev,long long& acc,long long& hits,long long& evicted) const
+	{
+		acc=hits=evicted=0;
+#ifdef LMT_CACHE_ENABLE
+		if (lev>=2 && lev<=max_cache_lev && lmtcache[lev]) {
+			acc=lmtcache[lev]->naccesses();
+			hits=lmtcache[lev]->nhits();
+			evicted=lmtcache[lev]->nevicted();
+			return true;
+		}
+#else
+		UNUSED(lev);
+#endif
+		return false;
+	}
+	
 	void lmtable::check_prob_and_state_cache_levels() const
 	{
 #ifdef PS_CACHE_ENABLE
@@ -781,7 +935,7 @@ namespace irstlm {
 					yetconfigured=true;
 					//allocate space for loading the table of this level
 					for (int i=1; i<=maxlev; i++)
-						table[i] = new char[(table_pos_t) maxsize[i] * nodesize(tbltype[i])];
+						alloc_level(i,(table_pos_t) maxsize[i] * nodesize(tbltype[i]));
 				}
 				
 				loadtxt_level(inp,Order);
@@ -858,6 +1012,73 @@ namespace irstlm {
 	}
 	
 	
+	void lmtable::loadarray_init(int n,bool quantized)
+	{
+		isQtable=quantized;
+		configure(n,quantized);
+	}
+	
+	void lmtable::loadarray_centers(int level,int nc,const double* pcenters,const double* bcenters)
+	{
+		NumCenters[level]=nc;
+		Pcenters[level]=new float[nc];
+		Bcenters[level]=(level<maxlev?new float[nc]:NULL);
+		
+		for (int c=0; c<nc; c++) {
+			Pcenters[level][c]=(float)pcenters[c];
+			if (level<maxlev) Bcenters[level][c]=(float)bcenters[c];
+		}
+	}
+	
+	//allocates a level of n entries and its support vector, as loadtxt_level
+	void lmtable::loadarray_alloc(int level,table_entry_pos_t n)
+	{
+		maxsize[level]=n;
+		alloc_level(level,(table_pos_t) n * nodesize(tbltype[level]));
+		
+		if (maxlev>1 && level<maxlev) {
+			startpos[level]=new table_entry_pos_t[n];
+			for (table_entry_pos_t c=0; c<n; c++) {
+				startpos[level][c]=BOUND_EMPTY1;
+			}
+		}
+	}
+	
+	void lmtable::loadarray_level(int level,table_entry_pos_t n,const int* codes,const float* prob,const float* bow)
+	{
+		VERBOSE(2, level << "-grams: " << n << " entries from memory" << std::endl);
+		loadarray_alloc(level,n);
+		
+		ngram ng(lmtable::getDict());
+		for (table_entry_pos_t c=0; c<n; c++) {
+			ng.size=0;
+			ng.pushc((int*)codes + (size_t) c * level,level);
+			add(ng, prob[c], (bow?bow[c]:0.0));
+		}
+		
+		if (maxlev>1 && level>1) {
+			checkbounds(level-1);
+		}
+	}
+	
+	void lmtable::loadarray_level(int level,table_entry_pos_t n,const int* codes,const unsigned short* qprob,const unsigned short* qbow)
+	{
+		VERBOSE(2, level << "-grams: " << n << " quantized entries from memory" << std::endl);
+		loadarray_alloc(level,n);
+		
+		ngram ng(lmtable::getDict());
+		for (table_entry_pos_t c=0; c<n; c++) {
+			ng.size=0;
+			ng.pushc((int*)codes + (size_t) c * level,level);
+			add(ng, (qfloat_t)qprob[c], (qfloat_t)(qbow?qbow[c]:0));
+		}
+		
+		if (maxlev>1 && level>1) {
+			checkbounds(level-1);
+		}
+	}
+	
+	
 	void lmtable::expand_level(int level, table_entry_pos_t size, const char* outfilename, int mmap)
 	{
 		if (mmap>0)
@@ -918,7 +1139,7 @@ namespace irstlm {
 	{
 		VERBOSE(2,"lmtable::expand_level_nommap START level:" << level << " size:" << size << endl);
 		maxsize[level]=size;
-		table[level] = new char[(table_pos_t) maxsize[level] * nodesize(tbltype[level])];
+		alloc_level(level,(table_pos_t) maxsize[level] * nodesize(tbltype[level]));
 		if (maxlev>1 && level<maxlev) {
 			startpos[level]=new table_entry_pos_t[maxsize[level]];
 			/*
@@ -1290,14 +1511,18 @@ namespace irstlm {
 		table_entry_pos_t idx=0; // index returned by mybsearch
 		*found=NULL;	//initialize output variable
 		
-		totbsearch[lev]++;
+		lmt_stats_t* ts=(instr?thread_stats():NULL);
+		int probes=0;
 		switch(action) {
 			case LMT_FIND:
 				//    if (!tb || !mybsearch(tb,n,sz,(unsigned char *)w,&idx)) return NULL;
 				
-				if (!tb || !mybsearch(tb,n,sz,w,&idx)) {
+				if (ts) lmt_count(ts->bsearch[lev]);
+				if (!tb || !mybsearch(tb,n,sz,w,&idx,&probes)) {
+					if (ts) lmt_count(ts->probes[lev][MIN(probes,LMT_INSTR_MAXPROBES)]);
 					return NULL;
 				} else {
+					if (ts) lmt_count(ts->probes[lev][MIN(probes,LMT_INSTR_MAXPROBES)]);
 					//      return *found=tb + (idx * sz);
 					return *found=tb + ((table_pos_t)idx * sz);
 				}
@@ -1310,11 +1535,13 @@ namespace irstlm {
 	
 	/* returns idx with the first position in ar with entry >= key */
 	
-	int lmtable::mybsearch(char *ar, table_entry_pos_t n, int size, char *key, table_entry_pos_t *idx)
+	int lmtable::mybsearch(char *ar, table_entry_pos_t n, int size, char *key, table_entry_pos_t *idx, int *probes)
 	{
+		if (probes) *probes=0;
 		if (n==0) return 0;
 		
 		*idx=0;
+		int np=0; //number of probed entries
 		register table_entry_pos_t low=0, high=n;
 		register unsigned char *p;
 		int result;
@@ -1355,17 +1582,21 @@ namespace irstlm {
 			
 			p = (unsigned char *) (ar + (*idx * size));
 			result=codecmp((char *)key,(char *)p);
+			np++;
 			
 			if (result < 0)
 				high = *idx;
 			
 			else if (result > 0)
 				low = ++(*idx);
-			else
+			else {
+				if (probes) *probes=np;
 				return 1;
+			}
 		}
 		
 		*idx=low;
+		if (probes) *probes=np;
 		
 		return 0;
 		
@@ -1374,14 +1605,138 @@ namespace irstlm {
 	
 	// generates a LM copy for a smaller dictionary
 	
-	void lmtable::cpsublm(lmtable* slmt, dictionary* subdict,bool keepunigr)
+	void lmtable::cpsublm(lmtable* slmt, dictionary* subdict,bool keepunigr,int threads)
+	{
+		lmt_filter_t* f=filter_select(subdict,keepunigr,threads);
+		filter_copy(f,slmt);
+		filter_free(f);
+	}
+	
+	typedef struct {
+		lmtable* lmt;
+		lmt_filter_t* f;
+	} lmt_filter_ctx_t;
+	
+	//vocabulary filtering: an n-gram is kept if all its words are in the
+	//vocabulary (unigrams are all kept if keepunigr); the subtrees of the
+	//unigrams are visited in parallel and decisions are stored in bitmaps.
+	//Kept words are renumbered in their original order, hence the successor
+	//lists of the filtered LM stay sorted.
+	lmt_filter_t* lmtable::filter_select(dictionary* subdict,bool keepunigr,int threads)
 	{
+		lmt_filter_t* f=new lmt_filter_t;
+		memset(f,0,sizeof(lmt_filter_t));
+		f->keepunigr=keepunigr;
 		
-		//keepunigr=false;
-		//let slmt inherit all features of this lmtable
+		dict->genoovcode();
+		subdict->genoovcode();
+		
+		f->dict=keepunigr?new dictionary(dict,false):new dictionary((char *)NULL);
+		f->dict->incflag(1);
+		f->remap=new int[dict->size()];
+		for (int c=0; c<dict->size(); c++) {
+			if (c != dict->oovcode() && subdict->encode(dict->decode(c)) == subdict->oovcode())
+				f->remap[c]=-1; // words of this->dict that are not in the vocabulary
+			else if (keepunigr)
+				f->remap[c]=c;
+			else {
+				f->remap[c]=f->dict->encode(dict->decode(c));
+				f->dict->freq(f->remap[c],dict->freq(c));
+			}
+		}
+		f->dict->incflag(0);
+		f->dict->genoovcode();
 		
+		for (int l=1; l<=maxlev; l++) {
+			table_entry_pos_t n=(cursize[l]+31)/32;
+			f->keep[l]=(unsigned int*) calloc((n>0?n:1),sizeof(unsigned int));
+			if (f->keep[l]==NULL) exit_error(IRSTLM_ERROR_MEMORY, "lmtable::filter_select: cannot allocate keep flags");
+		}
+		
+		LMT_TYPE ndt=tbltype[1];
+		int ndsz=nodesize(ndt);
+		for (table_entry_pos_t i=0; i<cursize[1]; i++)
+			if (keepunigr || f->remap[word(table[1]+(table_pos_t)i*ndsz)]!=-1)
+				f->keep[1][i>>5]|=1u << (i&31);
+		
+		if (maxlev>1) {
+			lmt_filter_ctx_t fc;
+			fc.lmt=this;
+			fc.f=f;
+			if (threads>1) {
+				wspool pool=wspool_init(threads);
+				wspool_parallel_for(pool, 0, cursize[1], 64, filter_range, &fc);
+				wspool_destroy(pool);
+			} else
+				for (table_entry_pos_t i=0; i<cursize[1]; i++) filter_range(&fc, i);
+		}
+		
+		for (int l=1; l<=maxlev; l++) {
+			f->cnt[l]=0;
+			for (table_entry_pos_t k=0; k<(cursize[l]+31)/32; k++)
+				f->cnt[l]+=__builtin_popcount(f->keep[l][k]);
+			VERBOSE(1, "lmtable::filter_select: level " << l << " kept " << f->cnt[l] << " of " << cursize[l] << " n-grams" << std::endl);
+		}
+		return f;
+	}
+	
+	//selects the successors of unigram i
+	void lmtable::filter_range(void *ctx,long long i)
+	{
+		lmt_filter_ctx_t* fc=(lmt_filter_ctx_t*) ctx;
+		lmtable* lmt=fc->lmt;
+		node ndp=lmt->table[1]+(table_pos_t)i*lmt->nodesize(lmt->tbltype[1]);
+		if (fc->f->remap[lmt->word(ndp)]!=-1)
+			lmt->filter_successors(fc->f,ndp,1);
+	}
+	
+	void lmtable::filter_successors(lmt_filter_t* f,node ndp,int l)
+	{
+		table_entry_pos_t isucc,esucc;
+		succrange(ndp,l,&isucc,&esucc);
+		
+		int ndsz=nodesize(tbltype[l+1]);
+		for (table_entry_pos_t j=isucc; j<esucc; j++) {
+			node sndp=table[l+1]+(table_pos_t)j*ndsz;
+			if (f->remap[word(sndp)]==-1) continue;
+			//neighbouring subtrees can share a word of the bitmap
+			__sync_fetch_and_or(&f->keep[l+1][j>>5], 1u << (j&31));
+			if (l+1<maxlev) filter_successors(f,sndp,l+1);
+		}
+	}
+	
+	//copies up to maxn kept entries of level l into buf, starting from entry i;
+	//j and nsucc track the scan of level l+1 needed to recompute the bounds
+	table_entry_pos_t lmtable::filter_level(lmt_filter_t* f,int l,table_entry_pos_t& i,table_entry_pos_t& j,table_entry_pos_t& nsucc,char* buf,table_entry_pos_t maxn)
+	{
+		LMT_TYPE ndt=tbltype[l];
+		int ndsz=nodesize(ndt);
+		table_entry_pos_t nb=0;
+		
+		for (; i<cursize[l] && nb<maxn; i++) {
+			if (!((f->keep[l][i>>5] >> (i&31)) & 1)) continue;
+			node ndp=table[l]+(table_pos_t)i*ndsz;
+			node bp=buf+(table_pos_t)nb*ndsz;
+			memcpy(bp, ndp, ndsz);
+			if (!f->keepunigr) word(bp, f->remap[word(ndp)]);
+			if (l<maxlev) {
+				table_entry_pos_t esucc;
+				succrange(ndp, l, NULL, &esucc);
+				for (; j<esucc; j++) if ((f->keep[l+1][j>>5] >> (j&31)) & 1) nsucc++;
+				bound(bp, ndt, nsucc);
+			}
+			nb++;
+		}
+		return nb;
+	}
+	
+	//builds the filtered LM in memory; slmt takes the dictionary of the filter
+	void lmtable::filter_copy(lmt_filter_t* f,lmtable* slmt)
+	{
 		slmt->configure(maxlev,isQtable);
-		slmt->dict=new dictionary((keepunigr?dict:subdict),false);
+		slmt->isQtable=isQtable;
+		slmt->dict=f->dict;
+		f->dict=NULL;
 		
 		if (isQtable) {
 			for (int i=1; i<=maxlev; i++)  {
@@ -1396,102 +1751,64 @@ namespace irstlm {
 			}
 		}
 		
-		//manage dictionary information
-		
-		//generate OOV codes and build dictionary lookup table
-		dict->genoovcode();
-		slmt->dict->genoovcode();
-		subdict->genoovcode();
+		for (int l=1; l<=maxlev; l++) {
+			table_pos_t sz=(table_pos_t) f->cnt[l] * nodesize(tbltype[l]);
+			slmt->alloc_level(l,sz);
+			table_entry_pos_t i=0,j=0,nsucc=0;
+			slmt->cursize[l]=filter_level(f,l,i,j,nsucc,slmt->table[l],f->cnt[l]);
+		}
+	}
+	
+	//saves the filtered LM in binary form without building it in memory
+	void lmtable::filter_savebin(lmt_filter_t* f,const char *filename)
+	{
+		VERBOSE(2,"lmtable::filter_savebin START " << filename << "\n");
 		
-		int* lookup=new int [dict->size()];
+		fstream out(filename,ios::out);
+		if (!out) exit_error(IRSTLM_ERROR_IO, std::string("lmtable::filter_savebin: cannot open ")+filename);
 		
-		for (int c=0; c<dict->size(); c++) {
-			lookup[c]=subdict->encode(dict->decode(c));
-			if (c != dict->oovcode() && lookup[c] == subdict->oovcode())
-				lookup[c]=-1; // words of this->dict that are not in slmt->dict
+		if (isQtable) {
+			out << "Qblmt" << (isInverted?"I":"") << " " << maxlev;
+			for (int i=1; i<=maxlev; i++) out << " " << f->cnt[i];
+			out << "\nNumCenters";
+			for (int i=1; i<=maxlev; i++)  out << " " << NumCenters[i];
+			out << "\n";
+		} else {
+			out << "blmt" << (isInverted?"I":"") << " " << maxlev;
+			char buff[100];
+			for (int i=1; i<=maxlev; i++){
+				sprintf(buff," %10d",f->cnt[i]);
+				out << buff;
+			}
+			out << "\n";
 		}
 		
-		//variables useful to navigate in the lmtable structure
-		LMT_TYPE ndt,pndt;
-		int ndsz,pndsz;
-		char *entry, *newentry;
-		table_entry_pos_t start, end, origin;
+		f->dict->save(out);
 		
+		const table_entry_pos_t bufentries=1<<16;
 		for (int l=1; l<=maxlev; l++) {
-			
-			slmt->cursize[l]=0;
-			slmt->table[l]=NULL;
-			
-			if (l==1) { //1-gram level
-				
-				ndt=tbltype[l];
-				ndsz=nodesize(ndt);
-				
-				for (table_entry_pos_t p=0; p<cursize[l]; p++) {
-					
-					entry=table[l] + (table_pos_t) p * ndsz;
-					if (lookup[word(entry)]!=-1 || keepunigr) {
-						
-						if ((slmt->cursize[l] % slmt->dict->size()) ==0)
-							slmt->table[l]=(char *)reallocf(slmt->table[l],((table_pos_t) slmt->cursize[l] + (table_pos_t) slmt->dict->size()) * ndsz);
-						
-						newentry=slmt->table[l] + (table_pos_t) slmt->cursize[l] * ndsz;
-						memcpy(newentry,entry,ndsz);
-						if (!keepunigr) //do not change encoding if keepunigr is true
-							slmt->word(newentry,lookup[word(entry)]);
-						
-						if (l<maxlev)
-							slmt->bound(newentry,ndt,p); //store in bound the entry itself (**) !!!!
-						slmt->cursize[l]++;
-					}
-				}
-			}
-			
-			else { //n-grams n>1: scan lower order table
-				
-				pndt=tbltype[l-1];
-				pndsz=nodesize(pndt);
-				ndt=tbltype[l];
-				ndsz=nodesize(ndt);
-				
-				for (table_entry_pos_t p=0; p<slmt->cursize[l-1]; p++) {
-					
-					//determine start and end of successors of this entry
-					origin=slmt->bound(slmt->table[l-1] + (table_pos_t)p * pndsz,pndt); //position of n-1 gram in this table (**)
-					if (origin == 0) start=0;                              //succ start at first pos in table[l]
-					else start=bound(table[l-1] + (table_pos_t)(origin-1) * pndsz,pndt);//succ start after end of previous entry
-					end=bound(table[l-1] + (table_pos_t)origin * pndsz,pndt);           //succ end where indicated
-					
-					if (!keepunigr || lookup[word(table[l-1] + (table_pos_t)origin * pndsz)]!=-1) {
-						while (start < end) {
-							
-							entry=table[l] + (table_pos_t) start * ndsz;
-							
-							if (lookup[word(entry)]!=-1) {
-								
-								if ((slmt->cursize[l] % slmt->dict->size()) ==0)
-									slmt->table[l]=(char *)reallocf(slmt->table[l],(table_pos_t) (slmt->cursize[l]+slmt->dict->size()) * ndsz);
-								
-								newentry=slmt->table[l] + (table_pos_t) slmt->cursize[l] * ndsz;
-								memcpy(newentry,entry,ndsz);
-								if (!keepunigr) //do not change encoding if keepunigr is true
-									slmt->word(newentry,lookup[word(entry)]);
-								
-								if (l<maxlev)
-									slmt->bound(newentry,ndt,start); //store in bound the entry itself!!!!
-								slmt->cursize[l]++;
-							}
-							start++;
-						}
-					}
-					
-					//updated bound information of incoming entry
-					slmt->bound(slmt->table[l-1] + (table_pos_t) p * pndsz, pndt,slmt->cursize[l]);
-				}
+			if (isQtable) {
+				out.write((char*)Pcenters[l],NumCenters[l] * sizeof(float));
+				if (l<maxlev)
+					out.write((char *)Bcenters[l],NumCenters[l] * sizeof(float));
 			}
+			char* buf=new char[(table_pos_t)bufentries*nodesize(tbltype[l])];
+			table_entry_pos_t i=0,j=0,nsucc=0,nb;
+			while ((nb=filter_level(f,l,i,j,nsucc,buf,bufentries))>0)
+				out.write(buf, (table_pos_t)nb*nodesize(tbltype[l]));
+			delete [] buf;
 		}
 		
-		return;
+		VERBOSE(2,"lmtable::filter_savebin: END\n");
+	}
+	
+	void lmtable::filter_free(lmt_filter_t* f)
+	{
+		for (int l=0; l<=LMTMAXLEV; l++)
+			if (f->keep[l]) free(f->keep[l]);
+		delete [] f->remap;
+		if (f->dict) delete f->dict;
+		delete f;
 	}
 	
 	
@@ -1830,7 +2147,7 @@ namespace irstlm {
 	
 	void lmtable::delete_level_nommap(int level)
 	{
-		delete table[level];
+		free_level(level);
 		maxsize[level]=cursize[level]=0;
 	}
 	
@@ -1897,10 +2214,12 @@ namespace irstlm {
 		//recompute exact filesize
 		table_pos_t filesize=(table_pos_t) cursize[level] * nodesize(tbltype[level]);
 		
-		char* ptr = new char[filesize];
-		memcpy(ptr,table[level],filesize);
-		delete table[level];
-		table[level]=ptr;
+		char* ptr = table[level];
+		int kind = tableAlloc[level];
+		table_pos_t size = tableSize[level];
+		alloc_level(level,filesize);
+		memcpy(table[level],ptr,filesize);
+		PFree(ptr,size,kind);
 		maxsize[level]=cursize[level];
 		
 		VERBOSE(2,"lmtable::resize_level_nommap END Level " << level << "\n");
@@ -2022,7 +2341,7 @@ namespace irstlm {
 		if ((memmap == 0) || (level < memmap))
 		{
 			VERBOSE(2,"loading " << cursize[level] << " " << level << "-grams" << std::endl);
-			table[level]=new char[(table_pos_t) cursize[level] * nodesize(tbltype[level])];
+			alloc_level(level,(table_pos_t) cursize[level] * nodesize(tbltype[level]));
 			inp.read(table[level],(table_pos_t) cursize[level] * nodesize(tbltype[level]));
 		} else {
 			
@@ -2042,10 +2361,29 @@ namespace irstlm {
 		VERBOSE(2,"done (level " << level << std::endl);
 	}
 	
-	int lmtable::get(ngram& ng,int n,int lev)
+	//trie search of the first lev words of the n codes, oldest first (as ngram::wordp(n))
+	int lmtable::get(int* codes,int n,int lev,lmt_search_t& st)
 	{
-		totget[lev]++;
+		if (lev > maxlev) error((char*)"get: lev exceeds maxlevel");
+		if (!instr) return get_trie(codes,n,lev,st);
+		
+		lmt_stats_t* ts=thread_stats();
+		if (!(instr & LMT_INSTR_PERF) || (lmt_count(ts->get[lev]) % LMT_INSTR_SAMPLING)) return get_trie(codes,n,lev,st);
 		
+		//sampled call
+		unsigned long long c0[2],c1[2];
+		if (!perf_read(c0)) return get_trie(codes,n,lev,st);
+		int found=get_trie(codes,n,lev,st);
+		if (perf_read(c1)) {
+			lmt_count(ts->sampled);
+			lmt_count(ts->cycles,c1[0]-c0[0]);
+			lmt_count(ts->llcmisses,c1[1]-c0[1]);
+		}
+		return found;
+	}
+	
+	int lmtable::get_trie(int* codes,int n,int lev,lmt_search_t& st)
+	{
 		if (lev > maxlev) error((char*)"get: lev exceeds maxlevel");
 		if (n < lev) error((char*)"get: ngram is too small");
 		
@@ -2055,8 +2393,8 @@ namespace irstlm {
 		//information of table entries
 		char* found;
 		LMT_TYPE ndt;
-		ng.link=NULL;
-		ng.lev=0;
+		st.link=NULL;
+		st.lev=0;
 		
 		for (int l=1; l<=lev; l++) {
 			
@@ -2066,14 +2404,14 @@ namespace irstlm {
 			
 #ifdef LMT_CACHE_ENABLE
 			bool hit = false;
-			if (lmtcache[l] && lmtcache[l]->get(ng.wordp(n),found)) {
+			if (lmtcache[l] && lmtcache[l]->get(codes,found)) {
 				hit=true;
 			} else {
 				search(l,
 							 offset,
 							 (limit-offset),
 							 nodesize(ndt),
-							 ng.wordp(n-l+1),
+							 codes+l-1,
 							 LMT_FIND,
 							 &found);
 			}
@@ -2086,14 +2424,14 @@ namespace irstlm {
 			//insert only not found items!!!
 			if (lmtcache[l] && hit==false) {
 				const char* found2=found;
-				lmtcache[l]->add(ng.wordp(n),found2);
+				lmtcache[l]->add(codes,found2);
 			}
 #else
 			search(l,
 						 offset,
 						 (limit-offset),
 						 nodesize(ndt),
-						 ng.wordp(n-l+1),
+						 codes+l-1,
 						 LMT_FIND,
 						 &found);
 #endif
@@ -2103,12 +2441,12 @@ namespace irstlm {
 			float pr = prob(found,ndt);
 			if (pr==NOPROB) return 0; //pruned n-gram
 			
-			ng.path[l]=found; //store path of found entries
-			ng.bow=(l<maxlev?bow(found,ndt):0);
-			ng.prob=pr;
-			ng.link=found;
-			ng.info=ndt;
-			ng.lev=l;
+			st.path[l]=found; //store path of found entries
+			st.bow=(l<maxlev?bow(found,ndt):0);
+			st.prob=pr;
+			st.link=found;
+			st.info=ndt;
+			st.lev=l;
 			
 			if (l<maxlev) { //set start/end point for next search
 				
@@ -2126,10 +2464,159 @@ namespace irstlm {
 		}
 		
 		
+		st.succ=(lev<maxlev?limit-offset:0);
+		return 1;
+	}
+	
+	
+	//batched trie search: up to LMT_BATCH_GROUP searches are kept in flight
+	//and each of them is advanced in turn by one probe; the entry a search
+	//compares next is prefetched one round before, so that the cache misses
+	//of different searches overlap instead of adding up
+	void lmtable::get_batch(int** codes,int* lev,int n,lmt_search_t* st,int* found)
+	{
+		lmt_lookup_t q[LMT_BATCH_GROUP];
+		int slot[LMT_BATCH_GROUP]; //searches in flight, then free states
+		lmt_stats_t* ts=(instr?thread_stats():NULL);
+		int active=0,k=0;
+		
+		for (int i=0; i<LMT_BATCH_GROUP; i++) slot[i]=i;
+		while (active>0 || k<n) {
+			for (; active<LMT_BATCH_GROUP && k<n; k++) {
+				lmt_lookup_t& r=q[slot[active]];
+				r.codes=codes[k];
+				r.lev=lev[k];
+				r.st=&st[k];
+				r.found=&found[k];
+				if (!lookup_start(r,ts)) active++;
+			}
+			for (int i=0; i<active; ) {
+				if (lookup_step(q[slot[i]],ts)) {
+					int t=slot[i];
+					slot[i]=slot[--active];
+					slot[active]=t;
+				} else i++;
+			}
+		}
+	}
+	
+	//prefetches the unigram of a search; true if the search is over
+	bool lmtable::lookup_start(lmt_lookup_t& q,lmt_stats_t* ts)
+	{
+		if (q.lev > maxlev) error((char*)"get: lev exceeds maxlevel");
+		if (ts) lmt_count(ts->get[q.lev]);
+		
+		q.st->link=NULL;
+		q.st->lev=0;
+		*q.found=0;
+		q.l=1;
+		q.offset=0;
+		q.limit=cursize[1];
+		
+		//unigrams are a 1-1 map of the vocabulary (see search)
+		if (!(q.codes[0] < (float) q.limit)) return true;
+		q.probe=table[1] + (table_pos_t) q.codes[0] * nodesize(tbltype[1]);
+		LMT_PREFETCH(q.probe);
+		return false;
+	}
+	
+	//compares the prefetched entry, as one iteration of mybsearch, and
+	//prefetches the next one; true if the search is over
+	bool lmtable::lookup_step(lmt_lookup_t& q,lmt_stats_t* ts)
+	{
+		if (q.l>1) {
+			int w=word(q.probe);
+			q.np++;
+			if (w!=q.key) {
+				if (q.key < w) q.high=q.idx;
+				else q.low=q.idx+1;
+				if (q.low >= q.high) {
+					if (ts) lmt_count(ts->probes[q.l][MIN(q.np,LMT_INSTR_MAXPROBES)]);
+					return true;
+				}
+				q.idx=(q.low+q.high)/2;
+				q.probe=q.base + (table_pos_t) q.idx * q.sz;
+				LMT_PREFETCH(q.probe);
+				return false;
+			}
+			if (ts) lmt_count(ts->probes[q.l][MIN(q.np,LMT_INSTR_MAXPROBES)]);
+		}
+		return lookup_found(q,ts);
+	}
+	
+	//records the entry found at level q.l, as get_trie does, and starts the
+	//binary search of the next level; true if the search is over
+	bool lmtable::lookup_found(lmt_lookup_t& q,lmt_stats_t* ts)
+	{
+		int l=q.l;
+		char* found=q.probe;
+		LMT_TYPE ndt=tbltype[l];
+		lmt_search_t* st=q.st;
+		
+		float pr = prob(found,ndt);
+		if (pr==NOPROB) return true; //pruned n-gram
+		
+		st->path[l]=found;
+		st->bow=(l<maxlev?bow(found,ndt):0);
+		st->prob=pr;
+		st->link=found;
+		st->info=ndt;
+		st->lev=l;
+		
+		if (l<maxlev) {
+			if (q.offset+1==cursize[l]) q.limit=cursize[l+1];
+			else q.limit=bound(found,ndt);
+			
+			if (found==table[l]) q.offset=0;
+			else q.offset=bound((found - nodesize(ndt)),ndt);
+		}
+		
+		if (l==q.lev) {
+			st->succ=(q.lev<maxlev?q.limit-q.offset:0);
+			*q.found=1;
+			return true;
+		}
+		
+		q.l=++l;
+		if (ts) lmt_count(ts->bsearch[l]);
+		q.sz=nodesize(tbltype[l]);
+		q.base=table[l] + (table_pos_t) q.offset * q.sz;
+		q.low=0;
+		q.high=q.limit-q.offset;
+		q.np=0;
+		if (!q.base || q.high==0) {
+			if (ts) lmt_count(ts->probes[l][0]);
+			return true;
+		}
+		char w[LMTCODESIZE]; //the code as stored in the table
+		putmem(w,q.codes[l-1],0,LMTCODESIZE);
+		q.key=word(w);
+		q.idx=(q.low+q.high)/2;
+		q.probe=q.base + (table_pos_t) q.idx * q.sz;
+		LMT_PREFETCH(q.probe);
+		return false;
+	}
+	
+	//search of the first lev words of ng, as get(codes,...); the result is put inside ng
+	int lmtable::get(ngram& ng,int n,int lev)
+	{
+		lmt_search_t st;
+		int found=get(ng.wordp(n),n,lev,st);
+		
+		ng.link=st.link;
+		ng.lev=st.lev;
+		for (int l=1; l<=st.lev; l++) ng.path[l]=st.path[l];
+		if (st.lev>0) {
+			ng.bow=st.bow;
+			ng.prob=st.prob;
+			ng.info=st.info;
+		}
+		if (!found) return 0;
+		
 		//put information inside ng
 		ng.size=n;
 		ng.freq=0;
-		ng.succ=(lev<maxlev?limit-offset:0);
+		ng.succ=st.succ;
 		
 #ifdef TRACE_CACHELM
 		if (ng.size==maxlev && sentence_id>0) {
@@ -2203,6 +2690,48 @@ namespace irstlm {
 		}
 	}
 	
+	void lmtable::getngrams(int lev, std::vector<int>& codes)
+	{
+		MY_ASSERT(lev>=1 && lev<=maxlev);
+		ngram ng(lmtable::getDict(),0);
+		if (cursize[1]>0) getngrams(codes,ng,1,lev,0,cursize[1]);
+	}
+	
+	//same traversal of dumplm
+	void lmtable::getngrams(std::vector<int>& codes,ngram ng, int ilev, int elev, table_entry_pos_t ipos,table_entry_pos_t epos)
+	{
+		LMT_TYPE ndt=tbltype[ilev];
+		int ndsz=nodesize(ndt);
+		
+		MY_ASSERT(ng.size==ilev-1);
+		MY_ASSERT(epos<=cursize[ilev]);
+		ng.pushc(0);
+		
+		for (table_entry_pos_t i=ipos; i<epos; i++) {
+			char* found=table[ilev]+ (table_pos_t) i * ndsz;
+			*ng.wordp(1)=word(found);
+			
+			//skip pruned n-grams
+			if(isPruned && prob(found,ndt)==NOPROB) continue;
+			
+			if (ilev<elev) {
+				//get first and last successor position
+				table_entry_pos_t isucc=(i>0?bound(table[ilev]+ (table_pos_t) (i-1) * ndsz,ndt):0);
+				table_entry_pos_t esucc=bound(found,ndt);
+				
+				if (isucc < esucc) //there are successors!
+					getngrams(codes,ng,ilev+1,elev,isucc,esucc);
+			} else {
+				// if table is inverted then revert n-gram
+				if (isInverted && (ng.size>1)) {
+					for (int k=1; k<=ng.size; k++) codes.push_back(*ng.wordp(k));
+				} else {
+					for (int k=ng.size; k>=1; k--) codes.push_back(*ng.wordp(k));
+				}
+			}
+		}
+	}
+	
 	//succscan iteratively returns all successors of an ngram h for which
 	//get(h,h.size,h.size) returned true.
 	
@@ -2253,43 +2782,51 @@ namespace irstlm {
 	{
 		VERBOSE(3,"const char *lmtable::maxsuffptr(ngram ong, unsigned int* size)\n");
 		
-		if (ong.size==0) {
+		return maxsuffptr(ong.wordp(ong.size),ong.size,size);
+	}
+	
+	
+	//this function works as maxsuffptr(ngram, ...) on an array of codes, without creating any ngram
+	const char *lmtable::maxsuffptr(int* codes, int sz, unsigned int* size)
+	{
+		if (sz==0) {
 			if (size!=NULL) *size=0;
 			return (char*) NULL;
 		}
 		
+		lmt_search_t st;
 		
 		if (isInverted) {
-			if (ong.size>maxlev) ong.size=maxlev; //if larger than maxlen reduce size
-			ngram ing=ong; //inverted ngram
-			
-			ing.invert(ong);
+			if (sz>maxlev) { //if larger than maxlen reduce size
+				codes+=sz-maxlev;
+				sz=maxlev;
+			}
+			int icodes[LMTMAXLEV+1]; //inverted ngram
+			for (int i=0; i<sz; i++) icodes[i]=codes[sz-1-i];
 			
-			get(ing,ing.size,ing.size); // dig in the trie
-			if (ing.lev > 0) { //found something?
-				unsigned int isize = MIN(ing.lev,(ing.size-1)); //find largest n-1 gram suffix
+			get(icodes,sz,sz,st); // dig in the trie
+			if (st.lev > 0) { //found something?
+				unsigned int isize = MIN(st.lev,(sz-1)); //find largest n-1 gram suffix
 				if (size!=NULL)  *size=isize;
-				return ing.path[isize];
+				return st.path[isize];
 			} else { // means a real unknown word!
 				if (size!=NULL)  *size=0;     //default statesize for zero-gram!
 				return NULL; //default stateptr for zero-gram!
 			}
 		} else {
-			if (ong.size>0) ong.size--; //always reduced by 1 word
+			//always reduced by 1 word, and again if still larger or equals to maxlen
+			int n=(sz-1<maxlev-1)?sz-1:maxlev-1;
+			codes+=sz-n;
 			
-			if (ong.size>=maxlev) ong.size=maxlev-1; //if still larger or equals to maxlen reduce again
-			
-			if (size!=NULL) *size=ong.size; //will return the largest found ong.size
-			for (ngram ng=ong; ng.size>0; ng.size--) {
-				if (get(ng,ng.size,ng.size)) {
-					//					if (ng.succ==0) (*size)--;
-					//					if (size!=NULL) *size=ng.size;
+			if (size!=NULL) *size=n; //will return the largest found size
+			for (; n>0; n--,codes++) {
+				if (get(codes,n,n,st)) {
 					if (size!=NULL)
 					{
-						if (ng.succ==0) *size=ng.size-1;
-						else *size=ng.size;
+						if (st.succ==0) *size=n-1;
+						else *size=n;
 					}
-					return ng.link;
+					return st.link;
 				}
 			}
 			if (size!=NULL) *size=0;
@@ -2325,7 +2862,7 @@ namespace irstlm {
 		
 		//cache miss
 		unsigned int isize; //internal state size variable
-		char* found=(char *)maxsuffptr(ong,&isize);
+		char* found=(char *)maxsuffptr(ong.wordp(ong.size),ong.size,&isize);
 		
 		//cache insert
 		//IMPORTANT: this function updates only two fields (state, statesize) of the entry of the cache; the reminaing fields (logpr, bow, bol, extendible) are undefined; hence, it should not be used before the corresponding clprob()
@@ -2341,7 +2878,7 @@ namespace irstlm {
 		if (size!=NULL) *size=isize;
 		return found;
 #else
-		return (char *)maxsuffptr(ong,size);
+		return (char *)maxsuffptr(ong.wordp(ong.size),ong.size,size);
 #endif
 	}
 	
@@ -2369,40 +2906,23 @@ namespace irstlm {
 			return pst.state;
 		}
 		
-		//create the actual ngram
-		ngram ong(dict);
-		ong.pushc(codes,sz);
-		MY_ASSERT (ong.size == sz);
-		
 		//cache miss
 		unsigned int isize; //internal state size variable
-		char* found=(char *)maxsuffptr(ong,&isize);
+		char* found=(char *)maxsuffptr(codes,sz,&isize);
 		
 		//cache insert
 		//IMPORTANT: this function updates only two fields (state, statesize) of the entry of the cache; the reminaing fields (logpr, bow, bol, extendible) are undefined; hence, it should not be used before the corresponding clprob()
-		if (ong.size>=maxlev) ong.size=maxlev;
 		//		if (prob_and_state_cache && ong.size==maxlev) {
 		if (prob_and_state_cache[sz]) {
 			pst.state=found;
 			pst.statesize=isize;
 			//			prob_and_state_cache->add(ong.wordp(maxlev),pst);
-			prob_and_state_cache[sz]->add(ong.wordp(ong.size),pst);
+			prob_and_state_cache[sz]->add(codes,pst);
 		}
 		if (size!=NULL) *size=isize;
 		return found;
 #else
-		//create the actual ngram
-		ngram ong(dict);
-		ong.pushc(codes,sz);
-		MY_ASSERT (ong.size == sz);
-		/*
-		 unsigned int isize; //internal state size variable
-		 char* found=(char *) maxsuffptr(ong,&isize);
-		 char* found2=(char *) maxsuffptr(ong,size);
-		 if (size!=NULL) *size=isize;
-		 return found;
-		 */
-		return maxsuffptr(ong,size);
+		return maxsuffptr(codes,sz,size);
 #endif
 	}
 	
@@ -2424,8 +2944,32 @@ namespace irstlm {
 	{
 		VERBOSE(3," lmtable::lprob(ngram) ong " << ong  << "\n");
 		
-		if (ong.size==0) return 0.0; //sanity check
 		if (ong.size>maxlev) ong.size=maxlev; //adjust n-gram level to table size
+		return lprob(ong.wordp(ong.size),ong.size,bow,bol,maxsuffptr,statesize,extendible,lastbow);
+	}
+	
+	
+	//this function works as lprob(ngram, ...) on an array of codes, oldest first, without creating any ngram
+	double lmtable::lprob(int* codes, int sz, double* bow, int* bol, char** maxsuffptr,unsigned int* statesize,
+												bool* extendible, double *lastbow)
+	{
+		if (!instr || sz==0) return lprob_trie(codes,sz,bow,bol,maxsuffptr,statesize,extendible,lastbow);
+		
+		int lbol=0;
+		double lpr=lprob_trie(codes,sz,bow,&lbol,maxsuffptr,statesize,extendible,lastbow);
+		if (bol) *bol=lbol;
+		lmt_count(thread_stats()->bol[MIN(sz,maxlev)][lbol]);
+		return lpr;
+	}
+	
+	double lmtable::lprob_trie(int* codes, int sz, double* bow, int* bol, char** maxsuffptr,unsigned int* statesize,
+												bool* extendible, double *lastbow)
+	{
+		if (sz==0) return 0.0; //sanity check
+		if (sz>maxlev) { //adjust n-gram level to table size
+			codes+=sz-maxlev;
+			sz=maxlev;
+		}
 		
 		if (bow) *bow=0; //initialize back-off weight
 		if (bol) *bol=0; //initialize bock-off level
@@ -2433,42 +2977,41 @@ namespace irstlm {
 		
 		double rbow=0,lpr=0; //output back-off weight and logprob
 		float ibow,iprob;    //internal back-off weight and logprob
+		lmt_search_t st;     //trie search state
 		
 		
 		if (isInverted) {
-			ngram ing=ong; //Inverted ngram TRIE
-			
-			ing.invert(ong);
-			get(ing,ing.size,ing.size); // dig in the trie
-			if (ing.lev >0) { //found something?
-				iprob=ing.prob;
-				lpr = (double)(isQtable?Pcenters[ing.lev][(qfloat_t)iprob]:iprob);
-				if (*ong.wordp(1)==dict->oovcode()) lpr-=logOOVpenalty; //add OOV penalty
-				if (statesize)  *statesize=MIN(ing.lev,(ing.size-1)); //find largest n-1 gram suffix
-				if (maxsuffptr) *maxsuffptr=ing.path[MIN(ing.lev,(ing.size-1))];
-				if (extendible) *extendible=succrange(ing.path[ing.lev],ing.lev)>0;
-				if (lastbow) *lastbow=(double) (isQtable?Bcenters[ing.lev][(qfloat_t)ing.bow]:ing.bow);
+			int icodes[LMTMAXLEV+1]; //Inverted ngram TRIE
+			for (int i=0; i<sz; i++) icodes[i]=codes[sz-1-i];
+			
+			get(icodes,sz,sz,st); // dig in the trie
+			if (st.lev >0) { //found something?
+				iprob=st.prob;
+				lpr = (double)(isQtable?Pcenters[st.lev][(qfloat_t)iprob]:iprob);
+				if (codes[sz-1]==dict->oovcode()) lpr-=logOOVpenalty; //add OOV penalty
+				if (statesize)  *statesize=MIN(st.lev,(sz-1)); //find largest n-1 gram suffix
+				if (maxsuffptr) *maxsuffptr=st.path[MIN(st.lev,(sz-1))];
+				if (extendible) *extendible=succrange(st.path[st.lev],st.lev)>0;
+				if (lastbow) *lastbow=(double) (isQtable?Bcenters[st.lev][(qfloat_t)st.bow]:st.bow);
 			} else { // means a real unknown word!
 				lpr=-log(UNIGRAM_RESOLUTION)/M_LN10;
 				if (statesize)  *statesize=0;     //default statesize for zero-gram!
 				if (maxsuffptr) *maxsuffptr=NULL; //default stateptr for zero-gram!
 			}
 			
-			if (ing.lev < ing.size) { //compute backoff weight
-				int depth=(ing.lev>0?ing.lev:1); //ing.lev=0 (real unknown word) is still a 1-gram
-				if (bol) *bol=ing.size-depth;
-				ing.size--; //get n-gram context
-				get(ing,ing.size,ing.size); // dig in the trie
-				if (ing.lev>0) { //found something?
+			if (st.lev < sz) { //compute backoff weight
+				int depth=(st.lev>0?st.lev:1); //st.lev=0 (real unknown word) is still a 1-gram
+				if (bol) *bol=sz-depth;
+				get(icodes+1,sz-1,sz-1,st); // dig in the trie for the n-gram context
+				if (st.lev>0) { //found something?
 					//collect back-off weights
-					for (int l=depth; l<=ing.lev; l++) {
+					for (int l=depth; l<=st.lev; l++) {
 						//start from first back-off level
-						MY_ASSERT(ing.path[l]!=NULL); //check consistency of table
-						ibow=this->bow(ing.path[l],tbltype[l]);
+						MY_ASSERT(st.path[l]!=NULL); //check consistency of table
+						ibow=this->bow(st.path[l],tbltype[l]);
 						rbow+= (double) (isQtable?Bcenters[l][(qfloat_t)ibow]:ibow);
 						//avoids bad quantization of bow of <unk>
-						//    if (isQtable && (*ing.wordp(1)==dict->oovcode())) {
-						if (isQtable && (*ing.wordp(ing.size)==dict->oovcode())) {
+						if (isQtable && (icodes[1]==dict->oovcode())) {
 							rbow-=(double)Bcenters[l][(qfloat_t)ibow];
 						}
 					}
@@ -2481,33 +3024,34 @@ namespace irstlm {
 		else {
 			MY_ASSERT((extendible == NULL) || (extendible && *extendible==false));
 			//		MY_ASSERT(lastbow==NULL);
-			for (ngram ng=ong; ng.size>0; ng.size--) {
-				if (get(ng,ng.size,ng.size)) {
-					iprob=ng.prob;
-					lpr = (double)(isQtable?Pcenters[ng.size][(qfloat_t)iprob]:iprob);
-					if (*ng.wordp(1)==dict->oovcode()) lpr-=logOOVpenalty; //add OOV penalty
-					if (maxsuffptr || statesize) { //one extra step is needed if ng.size=ong.size
-						if (ong.size==ng.size) {
-							ng.size--;
-							get(ng,ng.size,ng.size);
+			for (int n=sz; n>0; n--,codes++) {
+				if (get(codes,n,n,st)) {
+					iprob=st.prob;
+					lpr = (double)(isQtable?Pcenters[n][(qfloat_t)iprob]:iprob);
+					if (codes[n-1]==dict->oovcode()) lpr-=logOOVpenalty; //add OOV penalty
+					if (maxsuffptr || statesize) { //one extra step is needed if n=sz
+						int ssize=n;
+						if (sz==n) {
+							ssize--;
+							get(codes+1,ssize,ssize,st);
 						}
-						if (statesize)  *statesize=ng.size;
-						if (maxsuffptr) *maxsuffptr=ng.link; //we should check ng.link != NULL
+						if (statesize)  *statesize=ssize;
+						if (maxsuffptr) *maxsuffptr=st.link; //we should check st.link != NULL
 					}
 					return rbow+lpr;
 				} else {
-					if (ng.size==1) { //means a real unknow word!
+					if (n==1) { //means a real unknow word!
 						if (maxsuffptr) *maxsuffptr=NULL; //default stateptr for zero-gram!
 						if (statesize)  *statesize=0;
 						return rbow -log(UNIGRAM_RESOLUTION)/M_LN10;
 					} else { //compute backoff
 						if (bol) (*bol)++; //increase backoff level
-						if (ng.lev==(ng.size-1)) { //if search stopped at previous level
-							ibow=ng.bow;
-							rbow+= (double) (isQtable?Bcenters[ng.lev][(qfloat_t)ibow]:ibow);
+						if (st.lev==(n-1)) { //if search stopped at previous level
+							ibow=st.bow;
+							rbow+= (double) (isQtable?Bcenters[st.lev][(qfloat_t)ibow]:ibow);
 							//avoids bad quantization of bow of <unk>
-							if (isQtable && (*ng.wordp(2)==dict->oovcode())) {
-								rbow-=(double)Bcenters[ng.lev][(qfloat_t)ibow];
+							if (isQtable && (codes[n-2]==dict->oovcode())) {
+								rbow-=(double)Bcenters[st.lev][(qfloat_t)ibow];
 							}
 						}
 						if (bow) (*bow)=rbow;
@@ -2522,6 +3066,82 @@ namespace irstlm {
 	}
 	
 	
+	//log-probabilities of a batch of n-grams, as clprob: the n-grams are
+	//searched together by get_batch; those which back off are searched
+	//again in the next round, one word shorter. Caches, inverted tries and
+	//derived models (lmmacro, lmclass) are served by clprob.
+	void lmtable::clprob_batch(int** ng, int* ngsize, int n, double* logpr)
+	{
+		bool serial=isInverted || n<2 || lmtype!=_IRSTLM_LMTABLE;
+		for (int l=1; l<=maxlev; l++)
+			if (prob_and_state_cache[l] || lmtcache[l]) serial=true;
+		if (serial) {
+			for (int k=0; k<n; k++) logpr[k]=clprob(ng[k],ngsize[k]);
+			return;
+		}
+		
+		std::vector<int*> codes(n),qcodes(n);
+		std::vector<int> size(n),lev(n),bol(n),pending(n),qlev(n),qfound(n);
+		std::vector<double> rbow(n);
+		std::vector<lmt_search_t> qst(n);
+		lmt_stats_t* ts=(instr?thread_stats():NULL);
+		
+		int m=0;
+		for (int k=0; k<n; k++) {
+			int sz=(ngsize[k]>maxlev?maxlev:ngsize[k]); //as in clprob
+			if (sz==0) {
+				logpr[k]=0.0;
+				continue;
+			}
+			codes[k]=ng[k]+(ngsize[k]-sz); //keep the most recent words, as lprob_trie
+			size[k]=lev[k]=sz;
+			bol[k]=0;
+			rbow[k]=0;
+			pending[m++]=k;
+		}
+		
+		while (m>0) {
+			for (int i=0; i<m; i++) {
+				qcodes[i]=codes[pending[i]];
+				qlev[i]=lev[pending[i]];
+			}
+			get_batch(&qcodes[0],&qlev[0],m,&qst[0],&qfound[0]);
+			
+			//same steps as lprob_trie on a direct trie
+			int next=0;
+			for (int i=0; i<m; i++) {
+				int k=pending[i];
+				int l=lev[k];
+				int* c=codes[k];
+				lmt_search_t& st=qst[i];
+				if (qfound[i]) {
+					float iprob=st.prob;
+					double lpr=(double)(isQtable?Pcenters[l][(qfloat_t)iprob]:iprob);
+					if (c[l-1]==dict->oovcode()) lpr-=logOOVpenalty; //add OOV penalty
+					logpr[k]=rbow[k]+lpr;
+				} else if (l==1) { //real unknown word
+					logpr[k]=rbow[k] -log(UNIGRAM_RESOLUTION)/M_LN10;
+				} else { //back-off
+					bol[k]++;
+					if (st.lev==(l-1)) {
+						float ibow=st.bow;
+						rbow[k]+= (double) (isQtable?Bcenters[st.lev][(qfloat_t)ibow]:ibow);
+						//avoids bad quantization of bow of <unk>
+						if (isQtable && (c[l-2]==dict->oovcode())) {
+							rbow[k]-=(double)Bcenters[st.lev][(qfloat_t)ibow];
+						}
+					}
+					codes[k]++;
+					lev[k]--;
+					pending[next++]=k;
+					continue;
+				}
+				if (ts) lmt_count(ts->bol[size[k]][bol[k]]);
+			}
+			m=next;
+		}
+	}
+	
 	//return log10 probsL use cache memory
 	double lmtable::clprob(ngram ong,double* bow, int* bol, char** state,unsigned int* statesize,bool* extendible)
 	{
@@ -2563,7 +3183,7 @@ namespace irstlm {
 		//cache miss
 		
 		prob_and_state_t pst_add;
-		logpr = pst_add.logpr = lmtable::lprob(ong, &(pst_add.bow), &(pst_add.bol), &(pst_add.state), &(pst_add.statesize), &(pst_add.extendible));
+		logpr = pst_add.logpr = lmtable::lprob(ong.wordp(ong.size), ong.size, &(pst_add.bow), &(pst_add.bol), &(pst_add.state), &(pst_add.statesize), &(pst_add.extendible));
 		
 		
 		if (bow) *bow = pst_add.bow;
@@ -2581,7 +3201,7 @@ namespace irstlm {
 		}
 		return logpr;
 #else
-		return lmtable::lprob(ong, bow, bol, state, statesize, extendible);
+		return lmtable::lprob(ong.wordp(ong.size), ong.size, bow, bol, state, statesize, extendible);
 #endif
 	};
 	
@@ -2606,7 +3226,10 @@ namespace irstlm {
 			return 0.0;
 		}
 		
-		if (sz>maxlev) sz=maxlev; //adjust n-gram level to table size
+		if (sz>maxlev) { //adjust n-gram level to table size
+			codes+=sz-maxlev;
+			sz=maxlev;
+		}
 		
 #ifdef PS_CACHE_ENABLE
 		double logpr;
@@ -2628,14 +3251,9 @@ namespace irstlm {
 		}
 		
 		
-		//create the actual ngram
-		ngram ong(dict);
-		ong.pushc(codes,sz);
-		MY_ASSERT (ong.size == sz);
-		
 		//cache miss
 		prob_and_state_t pst_add;
-		logpr = pst_add.logpr = lmtable::lprob(ong, &(pst_add.bow), &(pst_add.bol), &(pst_add.state), &(pst_add.statesize), &(pst_add.extendible));
+		logpr = pst_add.logpr = lmtable::lprob(codes, sz, &(pst_add.bow), &(pst_add.bol), &(pst_add.state), &(pst_add.statesize), &(pst_add.extendible));
 		
 		
 		if (bow) *bow = pst_add.bow;
@@ -2649,21 +3267,11 @@ namespace irstlm {
 		//			prob_and_state_cache->add(ong.wordp(maxlev),pst_add);
 		//		}
 		if (prob_and_state_cache[sz]) {
-			prob_and_state_cache[sz]->add(ong.wordp(ong.size),pst_add);
+			prob_and_state_cache[sz]->add(codes,pst_add);
 		}
 		return logpr;
 #else
-		
-		//create the actual ngram
-		ngram ong(dict);
-		ong.pushc(codes,sz);
-		MY_ASSERT (ong.size == sz);
-		
-		/*
-		 logpr = lmtable::lprob(ong, bow, bol, state, statesize, extendible);
-		 return logpr;
-		 */
-		return lmtable::lprob(ong, bow, bol, state, statesize, extendible);
+		return lmtable::lprob(codes, sz, bow, bol, state, statesize, extendible);
 #endif
 	};
 	
@@ -2701,15 +3309,18 @@ namespace irstlm {
 			memory=(table_pos_t) cursize[l] * nodesize(tbltype[l]);
 			cout << "lev " << l
 			<< " entries "<< cursize[l]
-			<< " used mem " << memory/mega << "Mb\n";
+			<< " used mem " << memory/mega << "Mb"
+			<< " alloc " << ((memmap>0 && l>=memmap)?std::string("memmap"):PAllocName(tableAlloc[l])) << "\n";
 			totmem+=memory;
 		}
 		
 		cout << "total allocated mem " << totmem/mega << "Mb\n";
 		
+		lmt_stats_t ts;
+		get_stats(ts);
 		cout << "total number of get and binary search calls\n";
 		for (int l=1; l<=maxlev; l++) {
-			cout << "level " << l << " get: " << totget[l] << " bsearch: " << totbsearch[l] << "\n";
+			cout << "level " << l << " get: " << ts.get[l] << " bsearch: " << ts.bsearch[l] << "\n";
 		}
 		
 		if (level >1 ) lmtable::getDict()->stat();
@@ -2794,106 +3405,334 @@ namespace irstlm {
 	{
 		//this function implements a method similar to the "Weighted Difference Method"
 		//described in "Scalable Backoff Language Models"  by Kristie Seymore	and Ronald Rosenfeld
-		int	l;
-		ngram	ng(lmtable::getDict(),0);
-		
-		isPruned=true;  //the table now might contain pruned n-grams
-		
-		ng.size=0;
-		
-		for(l=2; l<=maxlev; l++) wdprune(thr, aflag, ng, 1, l, 0, cursize[1]);
-		return 0;
+		table_entry_pos_t nk=prune(thr, LMT_PRUNE_WD, aflag, 1);
+		prune_apply();
+		return nk;
 	}
 	
-	// FABIO: LM pruning method
+	//shared state of the workers pruning one level
+	typedef struct {
+		lmtable* lmt;
+		int criterion;
+		int aflag;
+		int elev;                //level being pruned
+		float thr;               //threshold of the level
+		int bos;                 //code of the sentence start
+		table_entry_pos_t pruned;
+	} lmt_prune_t;
 	
-	table_entry_pos_t lmtable::wdprune(float *thr, int aflag, ngram ng, int ilev, int elev, table_entry_pos_t ipos, table_entry_pos_t epos, double tlk, double bo, double *ts, double *tbs)
+	void lmtable::prune_free()
 	{
-		LMT_TYPE	ndt=tbltype[ilev];
-		int		   ndsz=nodesize(ndt);
-		char		 *ndp;
-		float		 lk;
-		float ipr, ibo;
-		//int ipr, ibo;
-		table_entry_pos_t i, k, nk;
+		for (int l=0; l<=LMTMAXLEV; l++) {
+			if (prunekeep[l]) free(prunekeep[l]);
+			if (prunebow[l]) delete [] prunebow[l];
+			prunekeep[l]=NULL;
+			prunebow[l]=NULL;
+		}
+	}
+	
+	//LM pruning: the n-grams of each level are pruned given the decisions
+	//taken on the lower levels; the subtrees of the unigrams are visited in
+	//parallel. Decisions and new back-off weights are kept aside (see
+	//prune_apply and savebin_pruned), hence memory mapped tables can be pruned, too.
+	table_entry_pos_t lmtable::prune(float *thr, int criterion, int aflag, int threads)
+	{
+		if (isQtable) exit_error(IRSTLM_ERROR_MODEL, "lmtable::prune: quantized LMs cannot be pruned");
+		if (isInverted) exit_error(IRSTLM_ERROR_MODEL, "lmtable::prune: inverted LMs cannot be pruned");
+#ifdef LMT_CACHE_ENABLE
+		threads=1; //trie caches are not thread safe
+#endif
 		
-		MY_ASSERT(ng.size==ilev-1);
-		//Note that ipos and epos are always larger than or equal to 0 because they are unsigned int
-		MY_ASSERT(epos<=cursize[ilev] && ipos<epos);
+		prune_free();
+		for (int l=2; l<=maxlev; l++) {
+			table_entry_pos_t n=(cursize[l]+31)/32;
+			prunekeep[l]=(unsigned int*) malloc((n>0?n:1)*sizeof(unsigned int));
+			if (prunekeep[l]==NULL) exit_error(IRSTLM_ERROR_MEMORY, "lmtable::prune: cannot allocate keep flags");
+			memset(prunekeep[l], 0xff, n*sizeof(unsigned int));
+			if (cursize[l]%32) prunekeep[l][n-1]=(1u << (cursize[l]%32))-1;
+		}
+		for (int l=1; l<maxlev; l++) {
+			LMT_TYPE ndt=tbltype[l];
+			int ndsz=nodesize(ndt);
+			prunebow[l]=new float[cursize[l]];
+			for (table_entry_pos_t i=0; i<cursize[l]; i++)
+				prunebow[l][i]=bow(table[l]+(table_pos_t)i*ndsz, ndt);
+		}
+		
+		lmt_prune_t pr;
+		pr.lmt=this;
+		pr.criterion=criterion;
+		pr.aflag=aflag;
+		pr.bos=getDict()->getcode(BOS_);
+		pr.pruned=0;
+		
+		wspool pool=(threads>1?wspool_init(threads):NULL);
+		
+		for (int l=2; l<=maxlev; l++) {
+			table_entry_pos_t before=pr.pruned;
+			pr.elev=l;
+			pr.thr=thr[l-1];
+			if (pool)
+				wspool_parallel_for(pool, 0, cursize[1], 1, prune_range, &pr);
+			else
+				for (table_entry_pos_t i=0; i<cursize[1]; i++) prune_range(&pr, i);
+			VERBOSE(1, "lmtable::prune: level " << l << " pruned " << pr.pruned-before << " of " << cursize[l] << " n-grams" << std::endl);
+		}
 		
-		ng.pushc(0); //increase size of n-gram
+		if (pool) wspool_destroy(pool);
+		return pr.pruned;
+	}
+	
+	//prunes the n-grams of the current level starting with unigram i
+	void lmtable::prune_range(void *ctx,long long i)
+	{
+		lmt_prune_t* pr=(lmt_prune_t*) ctx;
+		int codes[LMTMAXLEV+1];
+		table_entry_pos_t nk=0;
 		
-		for(i=ipos, nk=0; i<epos; i++) {
-			
-			//scan table at next level ilev from position ipos
-			ndp = table[ilev]+(table_pos_t)i*ndsz;
-			*ng.wordp(1) = word(ndp);
+		pr->lmt->prune_context(ctx, codes, 1, (table_entry_pos_t) i, (table_entry_pos_t) i+1, 0.0, nk);
+		if (nk) __sync_fetch_and_add(&pr->pruned, nk);
+	}
+	
+	//visits the contexts (levels ilev..elev-1) of the n-grams to prune;
+	//tlk is the log-probability of the path down to level ilev-1
+	void lmtable::prune_context(void* ctx,int* codes,int ilev,table_entry_pos_t ipos,table_entry_pos_t epos,double tlk,table_entry_pos_t& nk)
+	{
+		lmt_prune_t* pr=(lmt_prune_t*) ctx;
+		LMT_TYPE ndt=tbltype[ilev];
+		int ndsz=nodesize(ndt);
+		
+		for (table_entry_pos_t i=ipos; i<epos; i++) {
+			if (!prune_kept(ilev, i)) continue; //already pruned
 			
-			//get probability
-			ipr = prob(ndp, ndt);
-			if(ipr==NOPROB) continue;	// Has it been already pruned ??
+			node ndp=table[ilev]+(table_pos_t)i*ndsz;
+			codes[ilev-1]=word(ndp);
 			
-			if ((ilev == 1) && (*ng.wordp(ng.size) == getDict()->getcode(BOS_))) {
+			float lk=prob(ndp, ndt);
+			if (ilev==1 && codes[0]==pr->bos) {
 				//the n-gram starts with the sentence start symbol
 				//do not consider is actual probability because it is not reliable (its frequency is manually set)
-				ipr = 0.0;
+				lk=0.0;
 			}
-			lk = ipr;
 			
-			if(ilev<elev) { //there is an higher order
-				
-				//get backoff-weight for next level
-				ibo = bow(ndp, ndt);
-				bo = ibo;
-				
-				//get table boundaries for next level
-				table_entry_pos_t isucc,esucc;
-				succrange(ndp,ilev,&isucc,&esucc);
-				
-				//table_entry_pos_t isucc = i>0 ? bound(ndp-ndsz, ndt) : 0;
-				//table_entry_pos_t  esucc = bound(ndp, ndt);
-				if(isucc>=esucc) continue; // no successors
-				
-				//look for n-grams to be pruned with this context (see
-				//back-off weight)
-			prune:
-				double nextlevel_ts=0, nextlevel_tbs=0;
-				k = wdprune(thr, aflag, ng, ilev+1, elev, isucc, esucc, tlk+lk, bo, &nextlevel_ts, &nextlevel_tbs);
-				//k  is the number of pruned n-grams with this context
-				if(ilev!=elev-1) continue;
-				if(nextlevel_ts>=1 || nextlevel_tbs>=1) {
-					VERBOSE(2, "ng: " << ng <<" nextlevel_ts=" << nextlevel_ts <<" nextlevel_tbs=" << nextlevel_tbs 					<<" k=" << k <<" ns=" << esucc-isucc << "\n");
-					if(nextlevel_ts>=1) {
-						pscale(ilev+1, isucc, esucc, 0.999999/nextlevel_ts);
-						goto prune;
-					}
-				}
-				// adjusts backoff:
-				// 1-sum_succ(pr(w|ng)) / 1-sum_succ(pr(w|bng))
-				bo = log((1-nextlevel_ts)/(1-nextlevel_tbs))/M_LN10;
-				ibo=(float)bo;
-				bow(ndp, ndt, ibo);
-			} else { //we are at the highest level
+			table_entry_pos_t isucc,esucc;
+			succrange(ndp, ilev, &isucc, &esucc);
+			if (isucc>=esucc) continue; // no successors
+			
+			if (ilev<pr->elev-1)
+				prune_context(ctx, codes, ilev+1, isucc, esucc, tlk+lk, nk);
+			else
+				nk+=prune_successors(ctx, codes, ndp, i, tlk+lk);
+		}
+	}
+	
+	//decides on the successors of context ndp (entry pos of level elev-1)
+	//and re-estimates its back-off weight:
+	// 1-sum_succ(pr(w|ng)) / 1-sum_succ(pr(w|bng))
+	table_entry_pos_t lmtable::prune_successors(void* ctx,int* codes,node ndp,table_entry_pos_t pos,double tlk)
+	{
+		lmt_prune_t* pr=(lmt_prune_t*) ctx;
+		int elev=pr->elev;
+		LMT_TYPE ndt=tbltype[elev];
+		int ndsz=nodesize(ndt);
+		table_entry_pos_t isucc,esucc,nk=0;
+		
+		succrange(ndp, elev-1, &isucc, &esucc);
+		double bo=bow(ndp, tbltype[elev-1]);
+		double ts=0, tbs=0;
+		
+		if (pr->criterion==LMT_PRUNE_WD) {
+			for (table_entry_pos_t j=isucc; j<esucc; j++) {
+				node sp=table[elev]+(table_pos_t)j*ndsz;
+				codes[elev-1]=word(sp);
+				float lk=prob(sp, ndt);
 				
 				//get probability of lower order n-gram
-				ngram bng = ng;
-				bng.size--;
-				double blk = lprob(bng);
+				double blk=prune_lprob(codes+1, elev-1);
 				
-				double wd = pow(10., tlk+lk) * (lk-bo-blk);
-				if(aflag&&wd<0) wd=-wd;
-				if(wd > thr[elev-1]) {	// kept
-					*ts += pow(10., lk);
-					*tbs += pow(10., blk);
+				double wd=pow(10., tlk+lk) * (lk-bo-blk);
+				if (pr->aflag && wd<0) wd=-wd;
+				if (wd > pr->thr) {	// kept
+					ts+=pow(10., lk);
+					tbs+=pow(10., blk);
 				} else {		// discarded
 					++nk;
-					prob(ndp, ndt, NOPROB);
+					__sync_fetch_and_and(&prunekeep[elev][j>>5], ~(1u << (j&31)));
+				}
+			}
+		} else {
+			//relative entropy: removing s from context h changes the
+			//back-off weight to a'=(num+p(s|h))/(den+p(s|h')) and the
+			//entropy by -P(h)[p(s|h)log(p'(s|h)/p(s|h))+num log(a'/a)]
+			std::vector<double> blks(esucc-isucc);
+			double num=1.0, den=1.0;
+			for (table_entry_pos_t j=isucc; j<esucc; j++) {
+				node sp=table[elev]+(table_pos_t)j*ndsz;
+				codes[elev-1]=word(sp);
+				blks[j-isucc]=prune_lprob(codes+1, elev-1);
+				num-=pow(10., (double) prob(sp, ndt));
+				den-=pow(10., blks[j-isucc]);
+			}
+			
+			double ph=pow(10., tlk);
+			for (table_entry_pos_t j=isucc; j<esucc; j++) {
+				node sp=table[elev]+(table_pos_t)j*ndsz;
+				float lk=prob(sp, ndt);
+				double blk=blks[j-isucc];
+				double p=pow(10., lk);
+				double pb=pow(10., blk);
+				bool keep=true;
+				
+				if (num>0 && den>0) {
+					double nbo=log10((num+p)/(den+pb));
+					double dh=-ph * (p*(nbo+blk-lk) + num*(nbo-bo)) * M_LN10;
+					keep=(exp(dh)-1 >= pr->thr);
+				}
+				if (keep) {
+					ts+=p;
+					tbs+=pb;
+				} else {
+					++nk;
+					__sync_fetch_and_and(&prunekeep[elev][j>>5], ~(1u << (j&31)));
 				}
 			}
 		}
+		
+		if (ts>=1 || tbs>=1) {
+			VERBOSE(2, "lmtable::prune: level " << elev-1 << " entry " << pos << " ts=" << ts << " tbs=" << tbs << " back-off weight kept\n");
+		} else {
+			prunebow[elev-1][pos]=(float) (log((1-ts)/(1-tbs))/M_LN10);
+		}
 		return nk;
 	}
 	
+	//log-probability of codes[0..sz-1] given the pruning decisions taken
+	//so far: pruned entries are missing and back-off weights are the new ones
+	double lmtable::prune_lprob(int* codes,int sz)
+	{
+		double rbow=0;
+		
+		for (int n=sz; n>0; n--,codes++) {
+			table_entry_pos_t offset=0,limit=cursize[1],pos=0;
+			char* found=NULL;
+			char* last=NULL;
+			int l;
+			
+			for (l=1; l<=n; l++) {
+				int ndsz=nodesize(tbltype[l]);
+				search(l, offset, (limit-offset), ndsz, codes+l-1, LMT_FIND, &found);
+				if (!found) break;
+				table_entry_pos_t p=(table_entry_pos_t) ((found-table[l])/ndsz);
+				if (!prune_kept(l, p)) break;
+				last=found;
+				pos=p;
+				if (l<n) succrange(found, l, &offset, &limit);
+			}
+			
+			if (l>n) {
+				double lpr=prob(last, tbltype[n]);
+				if (codes[n-1]==dict->oovcode()) lpr-=logOOVpenalty; //add OOV penalty
+				return rbow+lpr;
+			}
+			if (n==1) return rbow -log(UNIGRAM_RESOLUTION)/M_LN10; //real unknown word
+			if (l==n) rbow+=prunebow[n-1][pos]; //the context was found
+		}
+		MY_ASSERT(0); //never pass here!!!
+		return 1.0;
+	}
+	
+	//writes the pruning decisions into the table, which can then be saved in ARPA format
+	void lmtable::prune_apply()
+	{
+		if (memmap>0) exit_error(IRSTLM_ERROR_MODEL, "lmtable::prune_apply: a memory mapped LM cannot be modified");
+		
+		for (int l=1; l<=maxlev; l++) {
+			LMT_TYPE ndt=tbltype[l];
+			int ndsz=nodesize(ndt);
+			for (table_entry_pos_t i=0; i<cursize[l]; i++) {
+				node ndp=table[l]+(table_pos_t)i*ndsz;
+				if (l>1 && prunekeep[l] && !prune_kept(l, i)) prob(ndp, ndt, NOPROB);
+				if (l<maxlev && prunebow[l]) bow(ndp, ndt, prunebow[l][i]);
+			}
+		}
+		isPruned=true;  //the table now might contain pruned n-grams
+		prune_free();
+	}
+	
+	//saves the pruned LM in binary form without holes: entries below a
+	//pruned n-gram are dropped, too, and bounds are recomputed on the fly
+	void lmtable::savebin_pruned(const char *filename)
+	{
+		VERBOSE(2,"lmtable::savebin_pruned START " << filename << "\n");
+		
+		if (maxlev>1 && prunekeep[maxlev]==NULL)
+			exit_error(IRSTLM_ERROR_MODEL, "lmtable::savebin_pruned: the LM has not been pruned");
+		
+		//an entry is kept if all its prefixes are
+		table_entry_pos_t cnt[LMTMAXLEV+1];
+		cnt[1]=cursize[1];
+		for (int l=2; l<maxlev; l++) {
+			LMT_TYPE ndt=tbltype[l];
+			int ndsz=nodesize(ndt);
+			for (table_entry_pos_t i=0; i<cursize[l]; i++) {
+				if (prune_kept(l, i)) continue;
+				table_entry_pos_t isucc,esucc;
+				succrange(table[l]+(table_pos_t)i*ndsz, l, &isucc, &esucc);
+				for (table_entry_pos_t j=isucc; j<esucc; j++)
+					prunekeep[l+1][j>>5]&=~(1u << (j&31));
+			}
+		}
+		for (int l=2; l<=maxlev; l++) {
+			cnt[l]=0;
+			for (table_entry_pos_t k=0; k<(cursize[l]+31)/32; k++)
+				cnt[l]+=__builtin_popcount(prunekeep[l][k]);
+		}
+		
+		fstream out(filename,ios::out);
+		
+		out << "blmt" << " " << maxlev;
+		char buff[100];
+		for (int l=1; l<=maxlev; l++){
+			sprintf(buff," %10d",cnt[l]);
+			out << buff;
+		}
+		out << "\n";
+		
+		lmtable::getDict()->save(out);
+		
+		const table_entry_pos_t bufentries=1<<16;
+		for (int l=1; l<=maxlev; l++) {
+			LMT_TYPE ndt=tbltype[l];
+			int ndsz=nodesize(ndt);
+			char* buf=new char[(table_pos_t)bufentries*ndsz];
+			table_entry_pos_t nb=0;
+			table_entry_pos_t j=0,nsucc=0; //scan of level l+1
+			
+			for (table_entry_pos_t i=0; i<cursize[l]; i++) {
+				if (!prune_kept(l, i)) continue;
+				node ndp=table[l]+(table_pos_t)i*ndsz;
+				node bp=buf+(table_pos_t)nb*ndsz;
+				memcpy(bp, ndp, ndsz);
+				if (l<maxlev) {
+					table_entry_pos_t esucc;
+					succrange(ndp, l, NULL, &esucc);
+					for (; j<esucc; j++) if (prune_kept(l+1, j)) nsucc++;
+					bow(bp, ndt, prunebow[l][i]);
+					bound(bp, ndt, nsucc);
+				}
+				if (++nb==bufentries) {
+					out.write(buf, (table_pos_t)nb*ndsz);
+					nb=0;
+				}
+			}
+			out.write(buf, (table_pos_t)nb*ndsz);
+			delete [] buf;
+			VERBOSE(2, "savebin_pruned: " << cnt[l] << " " << l << "-grams" << std::endl);
+		}
+		
+		VERBOSE(2,"lmtable::savebin_pruned: END\n");
+	}
+	
 	int lmtable::pscale(int lev, table_entry_pos_t ipos, table_entry_pos_t epos, double s)
 	{
 		LMT_TYPE        ndt=tbltype[lev];
@@ -2944,5 +3783,111 @@ namespace irstlm {
 		}
 		return 0;
 	}
+	//counters of the slot of the calling thread, allocated at the first
+	//lookup through the slot
+	lmt_stats_t* lmtable::thread_stats()
+	{
+		int t=(lmt_thread_slot<0?lmt_thread_enter():lmt_thread_slot);
+		if (tstats[t]==NULL) {
+			lmt_stats_t* s=(lmt_stats_t*) calloc(1,sizeof(lmt_stats_t));
+			if (s==NULL) exit_error(IRSTLM_ERROR_MEMORY, "lmtable::thread_stats: cannot allocate counters");
+			if (!__sync_bool_compare_and_swap(&tstats[t],(lmt_stats_t*) NULL,s)) free(s);
+		}
+		return tstats[t];
+	}
+	
+	void lmtable::instrument(int flags)
+	{
+		instr=flags;
+	}
+	
+	void lmtable::get_stats(lmt_stats_t& s) const
+	{
+		memset(&s,0,sizeof(lmt_stats_t));
+		for (int t=0; t<=LMT_INSTR_MAXTHREADS; t++) {
+			const lmt_stats_t* ts=tstats[t];
+			if (ts==NULL) continue;
+			for (int l=0; l<=LMTMAXLEV; l++) {
+				s.get[l]+=ts->get[l];
+				s.bsearch[l]+=ts->bsearch[l];
+				for (int k=0; k<=LMT_INSTR_MAXPROBES; k++) s.probes[l][k]+=ts->probes[l][k];
+				for (int k=0; k<=LMTMAXLEV; k++) s.bol[l][k]+=ts->bol[l][k];
+			}
+			s.sampled+=ts->sampled;
+			s.cycles+=ts->cycles;
+			s.llcmisses+=ts->llcmisses;
+		}
+	}
+	
+	void lmtable::reset_stats()
+	{
+		for (int t=0; t<=LMT_INSTR_MAXTHREADS; t++)
+			if (tstats[t]) memset(tstats[t],0,sizeof(lmt_stats_t));
+	}
+	
+	//writes all counters as a JSON object; for memory mapped levels, the
+	//pages of the table which are resident in memory are counted, too
+	void lmtable::stat_json(std::ostream& out)
+	{
+		lmt_stats_t ts;
+		get_stats(ts);
+		
+		out << "{\"order\": " << maxlev
+		<< ", \"memmap\": " << memmap
+		<< ", \"quantized\": " << (isQtable?"true":"false")
+		<< ", \"instrumentation\": " << instr
+		<< ",\n \"levels\": [";
+		for (int l=1; l<=maxlev; l++) {
+			out << (l>1?",":"") << "\n  {\"level\": " << l
+			<< ", \"entries\": " << cursize[l]
+			<< ", \"alloc\": \"" << ((memmap>0 && l>=memmap)?std::string("memmap"):PAllocName(tableAlloc[l])) << "\""
+			<< ", \"get\": " << ts.get[l]
+			<< ", \"bsearch\": " << ts.bsearch[l];
+			
+			int last=LMT_INSTR_MAXPROBES;
+			while (last>0 && ts.probes[l][last]==0) last--;
+			out << ", \"probes\": [";
+			for (int k=0; k<=last; k++) out << (k?", ":"") << ts.probes[l][k];
+			out << "]";
+			
+			last=l-1;
+			while (last>0 && ts.bol[l][last]==0) last--;
+			out << ", \"bol\": [";
+			for (int k=0; k<=last; k++) out << (k?", ":"") << ts.bol[l][k];
+			out << "]";
+			
+			long long acc,hits,evicted;
+			if (prob_and_state_cache_stat(l,acc,hits,evicted))
+				out << ", \"prob_cache\": {\"accesses\": " << acc << ", \"hits\": " << hits << ", \"misses\": " << acc-hits << ", \"evicted\": " << evicted << "}";
+			if (lmtcache_stat(l,acc,hits,evicted))
+				out << ", \"trie_cache\": {\"accesses\": " << acc << ", \"hits\": " << hits << ", \"misses\": " << acc-hits << ", \"evicted\": " << evicted << "}";
+			
+#ifndef WIN32
+			if (memmap>0 && l>=memmap && table[l]) {
+				long pgsz=sysconf(_SC_PAGESIZE);
+				size_t len=(table_pos_t) cursize[l]*nodesize(tbltype[l])+tableGaps[l];
+				size_t npages=(len+pgsz-1)/pgsz;
+				unsigned char* vec=(unsigned char*) malloc(npages>0?npages:1);
+				size_t resident=0;
+				if (vec && mincore(table[l]-tableGaps[l],len,vec)==0)
+					for (size_t k=0; k<npages; k++) resident+=vec[k] & 1;
+				free(vec);
+				out << ", \"pages\": " << npages << ", \"resident\": " << resident;
+			}
+#endif
+			out << "}";
+		}
+		out << "]";
+		
+		out << ",\n \"perf\": {\"sampled\": " << ts.sampled
+		<< ", \"cycles\": " << ts.cycles
+		<< ", \"llc_misses\": " << ts.llcmisses << "}";
+		
+		struct rusage ru;
+		if (getrusage(RUSAGE_SELF,&ru)==0)
+			out << ",\n \"faults\": {\"minor\": " << ru.ru_minflt << ", \"major\": " << ru.ru_majflt << "}";
+		out << "\n}\n";
+	}
+	
 }//namespace irstlm
 
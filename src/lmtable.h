@@ -33,6 +33,7 @@
 #include <cstdlib>
 #include <string>
 #include <set>
+#include <vector>
 #include <limits>
 #include "util.h"
 #include "ngramcache.h"
@@ -62,6 +63,38 @@
 
 #define UNIGRAM_RESOLUTION 10000000.0
 
+//instrumentation flags (see lmtable::instrument)
+#define LMT_INSTR_COUNTS 1 //lookups, binary search probes and back-off levels
+#define LMT_INSTR_PERF   2 //cycles and LLC misses sampled around get (Linux perf events)
+
+#define LMT_INSTR_MAXTHREADS 256  //live threads with counters of their own
+#define LMT_INSTR_MAXPROBES  63   //longest binary search accounted exactly
+#define LMT_INSTR_SAMPLING   1024 //with LMT_INSTR_PERF, one get out of that many is measured
+
+#define LMT_BATCH_GROUP 16 //searches advanced in turn by get_batch
+
+#ifdef __GNUC__
+#define LMT_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define LMT_PREFETCH(p)
+#endif
+
+//pruning criteria
+#define LMT_PRUNE_WD      0 //weighted difference (Seymore and Rosenfeld)
+#define LMT_PRUNE_ENTROPY 1 //relative entropy (Stolcke)
+
+//counters of the lookups of a thread; the counters of all threads are
+//summed up by lmtable::get_stats
+typedef struct {
+	unsigned long long get[LMTMAXLEV+1];     //trie lookups, by level
+	unsigned long long bsearch[LMTMAXLEV+1]; //binary searches, by level
+	unsigned long long probes[LMTMAXLEV+1][LMT_INSTR_MAXPROBES+1]; //binary searches by number of probes, by level
+	unsigned long long bol[LMTMAXLEV+1][LMTMAXLEV+1]; //lprob calls by n-gram size and back-off level
+	unsigned long long sampled;   //get calls measured with hardware counters
+	unsigned long long cycles;    //cycles of the sampled calls
+	unsigned long long llcmisses; //last level cache misses of the sampled calls
+} lmt_stats_t;
+
 typedef enum {INTERNAL,QINTERNAL,LEAF,QLEAF} LMT_TYPE;
 typedef char* node;
 
@@ -73,8 +106,45 @@ typedef enum {LMT_FIND,    //!< search: find an entry
 
 typedef unsigned int  table_entry_pos_t; //type for pointing to a full ngram in the table
 typedef unsigned long table_pos_t; // type for pointing to a single char in the table
+
+//selection of the entries of a LM which survive a vocabulary filter
+typedef struct {
+	bool keepunigr;                      //all unigrams are kept
+	int* remap;                          //new code of each word, -1 if out of the vocabulary
+	dictionary* dict;                    //dictionary of the filtered LM
+	unsigned int* keep[LMTMAXLEV+1];     //one bit per entry, set if kept
+	table_entry_pos_t cnt[LMTMAXLEV+1];  //kept entries per level
+} lmt_filter_t;
 typedef unsigned char qfloat_t; //type for quantized probabilities
 
+//compact state of a trie lookup on an array of codes: the part of
+//ngram which get() fills, without the codes and the scan vectors
+typedef struct {
+	char* path[LMTMAXLEV+1]; //found entries, by level
+	char* link;              //entry of the longest match
+	int   lev;               //level of the longest match
+	int   succ;              //number of successors of a complete match
+	float bow;               //back-off weight of the longest match
+	float prob;              //probability of the longest match
+	unsigned char info;      //table type of the longest match
+} lmt_search_t;
+
+//state of a trie search advanced one probe at a time by get_batch
+typedef struct {
+	int*  codes;              //codes of the n-gram, oldest first
+	int   lev;                //levels to search
+	int   l;                  //level being searched
+	table_entry_pos_t offset,limit; //range of the successors at level l
+	table_entry_pos_t low,high,idx; //binary search inside the range
+	int   np;                 //probed entries at level l
+	int   sz;                 //entry size of level l
+	int   key;                //code searched at level l
+	char* base;               //first entry of the range
+	char* probe;              //entry compared at the next step, already prefetched
+	lmt_search_t* st;
+	int*  found;
+} lmt_lookup_t;
+
 //CHECK this part to HERE
 
 #define BOUND_EMPTY1 (numeric_limits<table_entry_pos_t>::max() - 2)
@@ -111,8 +181,9 @@ protected:
 	char      info[100]; //information put in the header
 	
 	//statistics
-	int    totget[LMTMAXLEV+1];
-	int    totbsearch[LMTMAXLEV+1];
+	int          instr;                             //instrumentation flags
+	lmt_stats_t* tstats[LMT_INSTR_MAXTHREADS+1];    //counters of each thread slot
+	lmt_stats_t* thread_stats();
 	
 	//probability quantization
 	bool      isQtable;
@@ -149,6 +220,13 @@ protected:
 	off_t tableOffs[LMTMAXLEV+1];
 	off_t tableGaps[LMTMAXLEV+1];
 	
+	//in-memory levels: allocation policy obtained (PALLOC_*) and bytes allocated
+	int tableAlloc[LMTMAXLEV+1];
+	table_pos_t tableSize[LMTMAXLEV+1];
+	char* alloc_level(int level,table_pos_t size);
+	void loadarray_alloc(int level,table_entry_pos_t n);
+	void free_level(int level);
+	
 	// is this LM queried for knowing the matching order or (standard
 	// case) for score?
 	bool      orderQuery;
@@ -156,6 +234,21 @@ protected:
 	//flag to enable/disable deletion of dict in the destructor
 	bool delete_dict;
 	
+	//pruning decisions, kept aside so that the table is only read
+	unsigned int* prunekeep[LMTMAXLEV+1]; //one bit per entry (levels 2..maxlev), set if kept
+	float*        prunebow[LMTMAXLEV+1];  //re-estimated back-off weights (levels 1..maxlev-1)
+	
+	inline bool prune_kept(int l,table_entry_pos_t i) const {
+		return l<2 || ((prunekeep[l][i>>5] >> (i&31)) & 1);
+	}
+	void prune_free();
+	void prune_context(void* ctx,int* codes,int ilev,table_entry_pos_t ipos,table_entry_pos_t epos,double tlk,table_entry_pos_t& nk);
+	table_entry_pos_t prune_successors(void* ctx,int* codes,node ndp,table_entry_pos_t pos,double tlk);
+	double prune_lprob(int* codes,int sz);
+	
+	void filter_successors(lmt_filter_t* f,node ndp,int l);
+	table_entry_pos_t filter_level(lmt_filter_t* f,int l,table_entry_pos_t& i,table_entry_pos_t& j,table_entry_pos_t& nsucc,char* buf,table_entry_pos_t maxn);
+	
 public:
 	
 #ifdef TRACE_CACHELM
@@ -170,7 +263,10 @@ public:
 	virtual ~lmtable();
 	
 	table_entry_pos_t wdprune(float *thr, int aflag=0);
-	table_entry_pos_t wdprune(float *thr, int aflag, ngram ng, int ilev, int elev, table_entry_pos_t ipos, table_entry_pos_t epos, double lk=0, double bo=0, double *ts=0, double *tbs=0);
+	table_entry_pos_t prune(float *thr, int criterion=LMT_PRUNE_WD, int aflag=0, int threads=1);
+	static void prune_range(void *ctx,long long i);
+	void prune_apply();
+	void savebin_pruned(const char *filename);
 	double lprobx(ngram ong, double *lkp=0, double *bop=0, int *bol=0);
 	
 	table_entry_pos_t ngcnt(table_entry_pos_t *cnt);
@@ -189,6 +285,9 @@ public:
 	void used_prob_and_state_cache() const;
 	void used_lmtcaches() const;
 	void used_caches() const;
+	//accesses and hits of the caches of a level; false if there is no such cache
+	bool prob_and_state_cache_stat(int lev,long long& acc,long long& hits,long long& evicted) const;
+	bool lmtcache_stat(int lev,long long& acc,long long& hits,long long& evicted) const;
 	
 	
 	void delete_prob_and_state_cache();
@@ -293,6 +392,10 @@ public:
 	
 	void dumplm(std::fstream& out,ngram ng, int ilev, int elev, table_entry_pos_t ipos,table_entry_pos_t epos);
 	
+	//appends the codes of all n-grams of level lev to codes, lev codes each, oldest word first
+	void getngrams(int lev, std::vector<int>& codes);
+	void getngrams(std::vector<int>& codes,ngram ng, int ilev, int elev, table_entry_pos_t ipos,table_entry_pos_t epos);
+	
 	
 	void delete_level(int level, const char* outfilename, int mmap);
 	void delete_level_nommap(int level);
@@ -310,11 +413,26 @@ public:
 	
 	void load_centers(std::istream& inp,int l);
 	
+	//builds the table from n-grams held in memory rather than from ARPA text:
+	//levels are filled in order, each n-gram as level codes of the table
+	//dictionary (oldest word first); quantized levels take codebook indexes
+	void loadarray_init(int n,bool quantized);
+	void loadarray_centers(int level,int nc,const double* pcenters,const double* bcenters);
+	void loadarray_level(int level,table_entry_pos_t n,const int* codes,const float* prob,const float* bow);
+	void loadarray_level(int level,table_entry_pos_t n,const int* codes,const unsigned short* qprob,const unsigned short* qbow);
+	
 	void expand_level(int level, table_entry_pos_t size, const char* outfilename, int mmap);
 	void expand_level_nommap(int level, table_entry_pos_t size);
 	void expand_level_mmap(int level, table_entry_pos_t size, const char* outfilename);
 	
-	void cpsublm(lmtable* sublmt, dictionary* subdict,bool keepunigr=true);
+	void cpsublm(lmtable* sublmt, dictionary* subdict,bool keepunigr=true,int threads=1);
+	
+	//vocabulary filtering: only reads the table, hence it works on memory mapped LMs, too
+	lmt_filter_t* filter_select(dictionary* subdict,bool keepunigr=false,int threads=1);
+	static void filter_range(void *ctx,long long i);
+	void filter_copy(lmt_filter_t* f,lmtable* slmt);
+	void filter_savebin(lmt_filter_t* f,const char *filename);
+	void filter_free(lmt_filter_t* f);
 	
 	int reload(std::set<string> words);
 	
@@ -322,13 +440,16 @@ public:
 	
 	
 	virtual double  lprob(ngram ng, double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL, bool* extendible=NULL, double* lastbow=NULL);
+	double lprob(int* ng, int ngsize, double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL, bool* extendible=NULL, double* lastbow=NULL);
+	double lprob_trie(int* ng, int ngsize, double* bow,int* bol,char** maxsuffptr,unsigned int* statesize, bool* extendible, double* lastbow);
 	virtual double clprob(ngram ng, double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL);
 	virtual double clprob(int* ng, int ngsize, double* bow=NULL,int* bol=NULL,char** maxsuffptr=NULL,unsigned int* statesize=NULL,bool* extendible=NULL);
+	virtual void clprob_batch(int** ng, int* ngsize, int n, double* logpr);
 	
 	
 	void *search(int lev,table_entry_pos_t offs,table_entry_pos_t n,int sz,int *w, LMT_ACTION action,char **found=(char **)NULL);
 	
-	int mybsearch(char *ar, table_entry_pos_t n, int size, char *key, table_entry_pos_t *idx);
+	int mybsearch(char *ar, table_entry_pos_t n, int size, char *key, table_entry_pos_t *idx, int *probes=NULL);
 	
 	
 	int add(ngram& ng, float prob,float bow);
@@ -343,10 +464,20 @@ public:
 		return get(ng,ng.size,ng.size);
 	}
 	int get(ngram& ng,int n,int lev);
+	int get(int* codes,int n,int lev,lmt_search_t& st);
+	int get_trie(int* codes,int n,int lev,lmt_search_t& st);
+	
+	//n independent searches, as get(codes[k],lev[k],lev[k],st[k]) with its
+	//result in found[k], whose cache misses are overlapped
+	void get_batch(int** codes,int* lev,int n,lmt_search_t* st,int* found);
+	bool lookup_start(lmt_lookup_t& q,lmt_stats_t* ts);
+	bool lookup_step(lmt_lookup_t& q,lmt_stats_t* ts);
+	bool lookup_found(lmt_lookup_t& q,lmt_stats_t* ts);
 	
 	int succscan(ngram& h,ngram& ng,LMT_ACTION action,int lev);
 	
 	virtual const char *maxsuffptr(ngram ong, unsigned int* size=NULL);
+	const char *maxsuffptr(int* codes, int sz, unsigned int* size=NULL);
 	virtual const char *cmaxsuffptr(ngram ong, unsigned int* size=NULL);
   virtual const char *cmaxsuffptr(int* codes, int sz, unsigned int* size=NULL);
 	
@@ -602,6 +733,21 @@ public:
 	int succrange(node ndp,int level,table_entry_pos_t* isucc=NULL,table_entry_pos_t* esucc=NULL);
 	
 	void stat(int lev=0);
+	
+	//allocation policy obtained by a level, PALLOC_DEFAULT for memory mapped levels
+	inline int alloc_kind(int level) const {
+		return tableAlloc[level];
+	}
+	
+	//instrumentation: counters are kept per thread, hence they are cheap
+	//enough to be always enabled (LMT_INSTR_COUNTS is the default)
+	void instrument(int flags);
+	inline int instrumented() const {
+		return instr;
+	}
+	void get_stats(lmt_stats_t& s) const;
+	void reset_stats();
+	void stat_json(std::ostream& out);
 	void printTable(int level);
 	
 	virtual inline void setDict(dictionary* d) {
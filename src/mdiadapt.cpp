@@ -20,6 +20,7 @@
 
 #include <cmath>
 #include <string>
+#include <vector>
 #include "util.h"
 #include "mfstream.h"
 #include "mempool.h"
@@ -173,7 +174,7 @@ namespace irstlm {
 	{
 		if (forelm!=NULL) delete forelm;
 		if (cache!=NULL) delete cache;
-		cache=new normcache(dict);
+		cache=new normcache(dict,lmsize());
 		
 		forelm=new shiftbeta(ngtfile,1);
 		forelm->train();
@@ -260,7 +261,7 @@ namespace irstlm {
 	
 	
 	
-	int mdiadaptlm::adapt(char* ngtfile,int alev,double step)
+	int mdiadaptlm::adapt(char* ngtfile,int alev,double step,int threads)
 	{
 		
 		if (alev > lmsize() || alev<=0) {
@@ -293,22 +294,92 @@ namespace irstlm {
 		
 		if (alev==1) return 1 ;
 		
-		cerr << "precomputing 2-gram normalization:\n";
+		//precompute the normalization terms level by level: the histories
+		//of a level only need the terms of the lower ones
+		if (!concurrent_discount()) threads=1;
+		wspool pool=wspool_init(threads);
 		
-		//precompute the bigram normalization
-		w=ng.wordp(2);
-		*ng.wordp(1)=0;
-		
-		for ((*w)=0; (*w)<dict->size(); (*w)++) {
-			zeta(ng,2);
-			if ((*w % 1000)==0) cerr << ".";
+		for (int size=2; size<=alev; size++) {
+			cerr << "precomputing " << size << "-gram normalization:\n";
+			zeta_level(size,pool);
+			cerr << "done\n";
 		}
 		
-		cerr << "done\n";
+		wspool_destroy(pool);
 		
 		return 1;
 	};
 	
+	//shared state of the workers precomputing the normalization terms of a level
+	typedef struct {
+		mdiadaptlm* lm;
+		int size;     //n-gram size
+		int* histo;   //histories, size-1 codes each
+		double* z;    //normalization terms
+		int* succ;    //number of successors
+	} zeta_job_t;
+	
+	void mdiadaptlm::zeta_range(void *ctx,long long i)
+	{
+		zeta_job_t* job=(zeta_job_t*) ctx;
+		int h=job->size-1;
+		
+		ngram ng(job->lm->dict,job->size);
+		memcpy(ng.wordp(job->size),job->histo+i*h,h*sizeof(int));
+		*ng.wordp(1)=0;
+		job->z[i]=job->lm->zeta(ng,job->size,job->succ[i]);
+	}
+	
+	//computes in parallel the normalization terms of the histories of a level,
+	//in batches, until all of them are cached or the cache is full; while the
+	//workers run the cache is only read, as the lower levels are already done
+	void mdiadaptlm::zeta_level(int size,wspool pool)
+	{
+		const int batch=100000;
+		int h=size-1;
+		std::vector<int> histo((size_t)batch*h);
+		std::vector<double> z(batch);
+		std::vector<int> succ(batch);
+		
+		zeta_job_t job;
+		job.lm=this;
+		job.size=size;
+		job.histo=&histo[0];
+		job.z=&z[0];
+		job.succ=&succ[0];
+		
+		ngram hg(dict,h);
+		int w=0; //next one word history
+		bool more=true;
+		if (size>2) scan(hg,INIT,h);
+		
+		while (more && !cache->isfull(size)) {
+			int n=0;
+			for (; n<batch; n++) {
+				if (size==2) {
+					if (w>=dict->size()) break;
+					histo[n]=w++;
+				} else {
+					if (!scan(hg,CONT,h)) break;
+					memcpy(&histo[(size_t)n*h],hg.wordp(h),h*sizeof(int));
+				}
+			}
+			more=(n==batch);
+			
+			wspool_parallel_for(pool,0,n,0,zeta_range,&job);
+			
+			ngram ng(dict,size);
+			*ng.wordp(1)=0;
+			for (int i=0; i<n && !cache->isfull(size); i++) {
+				if (succ[i]>1) {
+					memcpy(ng.wordp(size),&histo[(size_t)i*h],h*sizeof(int));
+					cache->put(ng,size,z[i]);
+				}
+			}
+			cerr << ".";
+		}
+	}
+	
 	
 	double mdiadaptlm::zeta(ngram ng,int size)
 	{
@@ -322,40 +393,51 @@ namespace irstlm {
 		if (size==1) return zeta0;
 		else { //size>1
 			
-			//check in the 2gr and 3gr cache
-			if (size <=3 && cache->get(ng,size,z)) return z;
+			//check in the cache
+			if (cache->get(ng,size,z)) return z;
 			
-			double fstar,lambda;
-			ngram histo=ng;
 			int succ=0;
+			z=zeta(ng,size,succ);
 			
-			discount(ng,size,fstar,lambda,(int)0);
+			if (succ>1) cache->put(ng,size,z);
 			
-			if ((lambda<1) && get(histo,size,size-1)) {
-				;
-				
-				//scan all its successors
-				succ=0;
+			return z;
+		}
+		
+	}
+	
+	//computes the normalization term of the history of ng without caching it
+	double mdiadaptlm::zeta(ngram ng,int size,int& succ)
+	{
+		
+		MY_ASSERT(size>1);
+		
+		double z=0; // compute normalization term
+		double fstar,lambda;
+		
+		ng.size=size;
+		ngram histo=ng;
+		succ=0;
+		
+		discount(ng,size,fstar,lambda,(int)0);
+		
+		if ((lambda<1) && get(histo,size,size-1)) {
+			
+			//scan all its successors
+			succscan(histo,ng,INIT,size);
+			while(succscan(histo,ng,CONT,size)) {
 				
-				succscan(histo,ng,INIT,size);
-				while(succscan(histo,ng,CONT,size)) {
-					
-					discount(ng,size,fstar,lambda,0);
-					if (fstar>0) {
-						z+=(scalefact(ng) * fstar);
-						succ++;
-						//cerr << ng << "zeta= " << z << "\n";
-					}
+				discount(ng,size,fstar,lambda,0);
+				if (fstar>0) {
+					z+=(scalefact(ng) * fstar);
+					succ++;
 				}
 			}
-			
-			z+=lambda*zeta(ng,size-1);
-			
-			if (size<=3 && succ>1) cache->put(ng,size,z);
-			
-			return z;
 		}
 		
+		z+=lambda*zeta(ng,size-1);
+		
+		return z;
 	}
 	
 	
@@ -26,6 +26,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #include "ngramcache.h"
 #include "normcache.h"
 #include "interplm.h"
+#include "wspool.h"
 
 #define DONT_PRINT 1000000
 
@@ -79,6 +80,14 @@ public:
   double gis_step;
 
   double zeta(ngram ng,int size);
+  double zeta(ngram ng,int size,int& succ);
+  void zeta_level(int size,wspool pool);
+  static void zeta_range(void *ctx,long long i);
+
+  //! true if discount() can be called by several threads at once
+  virtual bool concurrent_discount() {
+    return true;
+  }
 
   int discount(ngram ng,int size,double& fstar,double& lambda,int cv=0);
 
@@ -92,7 +101,7 @@ public:
 
   double foreunig(ngram ng);
 
-  int adapt(char* ngtfile,int alev=1,double gis_step=0.4);
+  int adapt(char* ngtfile,int alev=1,double gis_step=0.4,int threads=1);
 
   int scalefact(char* ngtfile);
 
@@ -0,0 +1,477 @@
+/******************************************************************************
+ IrstLM: IRST Language Model Toolkit, merge LM
+ Copyright (C) 2006 Marcello Federico, ITC-irst Trento, Italy
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+
+ ******************************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdlib.h>
+#include <stdio.h>
+#include "cmd.h"
+#include "util.h"
+#include "math.h"
+#include "lmContainer.h"
+#include "lmtable.h"
+
+#define MAX_N   100
+/********************************/
+using namespace std;
+using namespace irstlm;
+
+void print_help(int TypeFlag=0){
+  std::cerr << std::endl << "merge-lm - merges interpolated language models into a single one" << std::endl;
+  std::cerr << std::endl << "USAGE:"  << std::endl;
+	std::cerr << "       merge-lm [options] <lm-list-file> [output-file.blm]" << std::endl;
+
+	std::cerr << std::endl << "DESCRIPTION:" << std::endl;
+	std::cerr << "       merge-lm reads a LM list file including interpolation weights " << std::endl;
+	std::cerr << "       with the format: N\\n w1 lm1 \\n w2 lm2 ...\\n wN lmN\n" << std::endl;
+	std::cerr << "       and writes a back-off LM containing the union of the n-grams of all LMs," << std::endl;
+	std::cerr << "       with linearly interpolated probabilities and recomputed back-off weights." << std::endl;
+	std::cerr << "       The LMs are processed one level at a time." << std::endl;
+	std::cerr << "       It reads LMs in ARPA and IRSTLM binary format." << std::endl;
+	std::cerr << std::endl << "OPTIONS:" << std::endl;
+
+	FullPrintParams(TypeFlag, 0, 1, stderr);
+}
+
+void usage(const char *msg = 0)
+{
+  if (msg){
+    std::cerr << msg << std::endl;
+	}
+  else{
+		print_help();
+	}
+}
+
+
+//set of n-grams of one level, as a sorted array of codes of the merged dictionary
+
+struct nglevel {
+  int lev;
+  std::vector<int> codes;  //lev codes per n-gram, oldest word first
+  std::vector<double> pr;  //interpolated probability of each n-gram
+
+  int size() const { return pr.size(); }
+  const int* ngram(int k) const { return &codes[(size_t)k * lev]; }
+
+  //position of the given n-gram, or -1
+  int find(const int* ng) const {
+    int lo=0, hi=size();
+    while (lo < hi) {
+      int mid=(lo+hi)/2, c=compare(ngram(mid),ng,lev);
+      if (c == 0) return mid;
+      if (c < 0) lo=mid+1; else hi=mid;
+    }
+    return -1;
+  }
+
+  static int compare(const int* a, const int* b, int n) {
+    for (int j=0; j<n; j++)
+      if (a[j] != b[j]) return (a[j] < b[j])? -1 : 1;
+    return 0;
+  }
+};
+
+struct ngless {
+  const int* codes; int lev;
+  bool operator()(int a, int b) const {
+    return nglevel::compare(codes+(size_t)a*lev, codes+(size_t)b*lev, lev) < 0;
+  }
+};
+
+
+//LMs to merge, with code maps between their dictionaries and the merged one
+
+struct lmmerge {
+  int N;
+  lmtable* lmt[MAX_N];
+  float w[MAX_N];
+  std::vector<int> tomerged[MAX_N], fromerged[MAX_N];
+  int oov[MAX_N];      //OOV code of each LM
+  int mergedoov;       //OOV code of the merged dictionary
+
+  //interpolated probability of an n-gram of the merged dictionary;
+  //a word outside the vocabulary of a LM gets no probability from it,
+  //so that the merged distribution sums to one
+  double prob(const int* ng, int lev) {
+    int _ng[MAX_NGRAM];
+    double pr=0.0;
+    for (int i=0; i<N; i++) {
+      for (int j=0; j<lev; j++) _ng[j]=fromerged[i][ng[j]];
+      if (_ng[lev-1]==oov[i] && ng[lev-1]!=mergedoov) continue;
+      pr+=w[i]*pow(10.0,lmt[i]->clprob(_ng,lev));
+    }
+    return pr;
+  }
+};
+
+
+//collects the union of the n-grams of level lev and computes their interpolated probabilities;
+//n-grams whose history is missing in the previous level P are dropped, as when loading a LM
+
+void collect(nglevel& L, int lev, nglevel* P, lmmerge& M)
+{
+  L.lev=lev; L.codes.clear(); L.pr.clear();
+
+  std::vector<int> all;
+  for (int i=0; i<M.N; i++) {
+    if (M.lmt[i]->maxlevel() < lev) continue;
+    size_t first=all.size();
+    M.lmt[i]->getngrams(lev,all);
+    for (size_t j=first; j<all.size(); j++) all[j]=M.tomerged[i][all[j]];
+  }
+
+  //sort and remove duplicates
+  int n=all.size()/lev;
+  std::vector<int> order(n);
+  for (int k=0; k<n; k++) order[k]=k;
+  ngless less; less.codes=all.empty()?NULL:&all[0]; less.lev=lev;
+  std::sort(order.begin(),order.end(),less);
+
+  for (int k=0; k<n; k++) {
+    const int* ng=&all[(size_t)order[k]*lev];
+    if (L.size()>0 && nglevel::compare(L.ngram(L.size()-1),ng,lev)==0) continue;
+    if (P && P->find(ng) < 0) continue;
+    L.codes.insert(L.codes.end(),ng,ng+lev);
+    L.pr.push_back(0.0);
+  }
+  std::vector<int>().swap(all);
+
+  //interpolated probabilities
+  for (int k=0; k<L.size(); k++) L.pr[k]=M.prob(L.ngram(k),lev);
+}
+
+
+//back-off weight of the k-th n-gram of L, computed from its successors in the next level H;
+//h scans H, which is sorted by history, and is left past the successors
+
+float backoff(nglevel& L, int k, nglevel& H, int& h, lmmerge& M)
+{
+  const int* ng=L.ngram(k);
+
+  //sum probabilities of the explicit successors, and of their lower order estimates
+  double num=1.0, den=1.0;
+  while (h < H.size() && nglevel::compare(H.ngram(h),ng,L.lev) < 0) h++;
+  for (; h < H.size() && nglevel::compare(H.ngram(h),ng,L.lev) == 0; h++) {
+    num-=H.pr[h];
+    const int* lower=H.ngram(h)+1;
+    int pos=L.find(lower);
+    //lower order n-gram missing in all LMs: use the mixture directly
+    den-=(pos >= 0)? L.pr[pos] : M.prob(lower,L.lev);
+  }
+  //guard against rounding errors
+  if (num < 1e-10) num=1e-10;
+  if (den < 1e-10) den=1e-10;
+  float bow=(float) log10(num/den);
+  return (bow > UPPER_SINGLE_PRECISION_OF_0 || bow < -UPPER_SINGLE_PRECISION_OF_0)? bow : 0.0;
+}
+
+
+//writes level L of the merged LM in ARPA format; back-off weights are computed from the next level H
+
+void write(std::fstream& out, nglevel& L, nglevel* H, dictionary* dict, lmmerge& M)
+{
+  int h=0;
+
+  for (int k=0; k<L.size(); k++) {
+    const int* ng=L.ngram(k);
+
+    out << (float) log10(L.pr[k]) << "\t";
+    for (int j=0; j<L.lev; j++) {
+      if (j > 0) out << " ";
+      out << dict->decode(ng[j]);
+    }
+
+    if (H) {
+      float bow=backoff(L,k,*H,h,M);
+      if (bow != 0.0) out << "\t" << bow;
+    }
+    out << "\n";
+  }
+}
+
+
+//writes the dictionary of the binary LM, whose codes follow the order of the unigrams U,
+//as level 1 of a LM table is indexed by word code; words without unigram come last;
+//code maps the merged codes into it
+
+void writebindict(std::fstream& out, nglevel& U, dictionary* dict, std::vector<int>& code)
+{
+  dictionary bindict((char *)NULL,dict->size()+1);
+
+  code.assign(dict->size(),-1);
+  bindict.incflag(1);
+  for (int k=0; k<U.size(); k++) code[U.ngram(k)[0]]=bindict.encode(dict->decode(U.ngram(k)[0]));
+  for (int c=0; c<dict->size(); c++)
+    if (code[c] < 0) code[c]=bindict.encode(dict->decode(c));
+  bindict.incflag(0);
+  bindict.genoovcode();
+  bindict.save(out);
+}
+
+
+//writes level L of the merged LM as a level of a binary LM table: each entry holds the last
+//word, the probability and, but at the last level, the back-off weight and the end of its
+//successors in the next level H; L and H are sorted as the table requires
+
+void writebin(std::fstream& out, nglevel& L, nglevel* H, std::vector<int>& code, lmmerge& M)
+{
+  lmtable fmt; //only for its node layout
+  LMT_TYPE ndt=H?INTERNAL:LEAF;
+  int ndsz=fmt.nodesize(ndt);
+  char nd[64];
+  int h=0;
+
+  for (int k=0; k<L.size(); k++) {
+    fmt.word(nd,code[L.ngram(k)[L.lev-1]]);
+    fmt.prob(nd,ndt,(float) log10(L.pr[k]));
+    if (H) {
+      fmt.bow(nd,ndt,backoff(L,k,*H,h,M));
+      fmt.bound(nd,ndt,(table_entry_pos_t) h);
+    }
+    out.write(nd,ndsz);
+  }
+}
+
+
+int main(int argc, char **argv)
+{
+  int order = 0;
+  int memmap = 0;
+  int requiredMaxlev = 1000;
+  bool textoutput = false;
+  float ngramcache_load_factor = 0.0;
+  float dictionary_load_factor = 0.0;
+
+	bool help=false;
+  std::vector<std::string> files;
+
+	DeclareParams((char*)
+		"order", CMDINTTYPE|CMDMSG, &order, "order of the merged LM; default is the maximum order of LMs",
+		"o", CMDINTTYPE|CMDMSG, &order, "order of the merged LM; default is the maximum order of LMs",
+                "text", CMDBOOLTYPE|CMDMSG, &textoutput, "output is in ARPA text format; default is false",
+                "t", CMDBOOLTYPE|CMDMSG, &textoutput, "output is in ARPA text format; default is false",
+                "memmap", CMDINTTYPE|CMDMSG, &memmap, "uses memory map to read a binary LM",
+		"mm", CMDINTTYPE|CMDMSG, &memmap, "uses memory map to read a binary LM",
+                "dict_load_factor", CMDFLOATTYPE|CMDMSG, &dictionary_load_factor, "sets the load factor for ngram cache; it should be a positive real value; default is 0",
+                "ngram_load_factor", CMDFLOATTYPE|CMDMSG, &ngramcache_load_factor, "sets the load factor for ngram cache; it should be a positive real value; default is false",
+                "level", CMDINTTYPE|CMDMSG, &requiredMaxlev, "maximum level to load from the LM; if value is larger than the actual LM order, the latter is taken",
+		"lev", CMDINTTYPE|CMDMSG, &requiredMaxlev, "maximum level to load from the LM; if value is larger than the actual LM order, the latter is taken",
+
+		"Help", CMDBOOLTYPE|CMDMSG, &help, "print this help",
+		"h", CMDBOOLTYPE|CMDMSG, &help, "print this help",
+
+								(char *)NULL
+								);
+
+	if (argc == 1){
+		usage();
+		exit_error(IRSTLM_NO_ERROR);
+	}
+
+	for(int i=1; i < argc; i++) {
+		if(argv[i][0] != '-') files.push_back(argv[i]);
+	}
+
+  GetParams(&argc, &argv, (char*) NULL);
+
+	if (help){
+		usage();
+		exit_error(IRSTLM_NO_ERROR);
+	}
+
+  if (files.size() > 2) {
+    usage();
+		exit_error(IRSTLM_ERROR_DATA,"Too many arguments");
+  }
+
+  if (files.size() < 1) {
+    usage();
+		exit_error(IRSTLM_ERROR_DATA,"Must pecify a LM list file to read from");
+  }
+
+  std::string infile = files[0];
+  std::string outfile="";
+
+  if (files.size() == 1) {
+    outfile=infile;
+    //remove path information
+    std::string::size_type p = outfile.rfind('/');
+    if (p != std::string::npos && ((p+1) < outfile.size()))
+      outfile.erase(0,p+1);
+    outfile+=(textoutput?".lm":".blm");
+  } else
+    outfile = files[1];
+
+  std::cerr << "inpfile: " << infile << std::endl;
+  std::cerr << "outfile: " << outfile << std::endl;
+
+  lmmerge M; //interpolated language models and weights
+  std::string lmf[MAX_N]; //lm filenames
+  int N;
+
+  //Loading Language Models
+  std::cerr << "Reading " << infile << "..." << std::endl;
+  std::fstream inptxt(infile.c_str(),std::ios::in);
+
+  char line[BUFSIZ];
+  const char* words[3];
+  int tokenN;
+
+  inptxt.getline(line,BUFSIZ,'\n');
+  tokenN = parseWords(line,words,3);
+
+  if (tokenN != 2 || ((strcmp(words[0],"LMINTERPOLATION") != 0) && (strcmp(words[0],"lminterpolation")!=0)))
+    exit_error(IRSTLM_ERROR_DATA,"ERROR: wrong header format of configuration file\ncorrect format: LMINTERPOLATION number_of_models\nweight_of_LM_1 filename_of_LM_1\nweight_of_LM_2 filename_of_LM_2");
+
+  N=atoi(words[1]);
+  std::cerr << "Number of LMs: " << N << "..." << std::endl;
+  if(N > MAX_N || N < 1) {
+		exit_error(IRSTLM_ERROR_DATA,"Can't interpolate more than MAX_N language models");
+  }
+
+  for (int i=0; i<N; i++) {
+    inptxt.getline(line,BUFSIZ,'\n');
+    tokenN = parseWords(line,words,3);
+    if(tokenN != 2) {
+			exit_error(IRSTLM_ERROR_DATA,"Wrong input format");
+    }
+    M.w[i] = (float) atof(words[0]);
+    lmf[i] = words[1];
+
+    std::cerr << "i:" << i << " w[i]:" << M.w[i] << " lmf[i]:" << lmf[i] << std::endl;
+
+    lmContainer* lm = lmContainer::CreateLanguageModel(lmf[i],ngramcache_load_factor,dictionary_load_factor);
+    if ((M.lmt[i] = dynamic_cast<lmtable*>(lm)) == NULL)
+      exit_error(IRSTLM_ERROR_DATA,"Only plain LM tables can be merged");
+    M.lmt[i]->setMaxLoadedLevel(requiredMaxlev);
+    M.lmt[i]->load(lmf[i],memmap);
+  }
+  inptxt.close();
+  M.N=N;
+
+  //normalize weights
+  float norm=0.0;
+  for (int i=0; i<N; i++) norm+=M.w[i];
+  for (int i=0; i<N; i++) M.w[i]/=norm;
+
+  int maxorder = 0;
+  for (int i=0; i<N; i++) {
+    maxorder = (maxorder > M.lmt[i]->maxlevel())?maxorder:M.lmt[i]->maxlevel();
+  }
+  if (order <= 0 || order > maxorder) {
+    order = maxorder;
+    std::cerr << "order is reset to the maximum order of LMs: " << order << std::endl;
+  }
+
+  //merged dictionary and code maps from and to each LM
+  dictionary* dict=new dictionary((char *)NULL,1000000,dictionary_load_factor);
+
+  dict->incflag(1);
+  for (int i=0; i<N; i++) {
+    dictionary* _dict=M.lmt[i]->getDict();
+    for (int c=0; c<_dict->size(); c++)
+      M.tomerged[i].push_back(dict->encode(_dict->decode(c)));
+  }
+  M.mergedoov=dict->encode(dict->OOV());
+  dict->incflag(0);
+  for (int i=0; i<N; i++) {
+    dictionary* _dict=M.lmt[i]->getDict();
+    for (int c=0; c<dict->size(); c++)
+      M.fromerged[i].push_back(_dict->encode(dict->decode(c)));
+    M.oov[i]=_dict->oovcode();
+  }
+
+  //ARPA levels are written into a temporary file, as the header needs their sizes;
+  //binary levels go straight into the output file, after room for the sizes in the header
+  std::string bodyfile=textoutput?createtempName():outfile;
+  std::fstream body(bodyfile.c_str(),std::ios::out);
+  body.precision(6);
+
+  int cnt[MAX_NGRAM+1];
+  std::streampos pos[MAX_NGRAM+1];
+  char buff[100];
+  std::vector<int> bincode; //codes of the binary dictionary
+  nglevel* L=new nglevel;
+  nglevel* H=new nglevel;
+
+  collect(*L,1,NULL,M);
+  if (!textoutput) {
+    std::cerr << "Saving in bin format to " << outfile << std::endl;
+    body << "blmt " << order;
+    for (int l=1; l<=order; l++) {
+      pos[l]=body.tellp();
+      sprintf(buff," %10d",0);
+      body << buff;
+    }
+    body << "\n";
+    writebindict(body,*L,dict,bincode);
+  }
+
+  for (int l=1; l<=order; l++) {
+    std::cerr << "level " << l << ": " << L->size() << " n-grams" << std::endl;
+    if (l < order) collect(*H,l+1,L,M);
+
+    cnt[l]=L->size();
+    if (textoutput) {
+      body << "\n\\" << l << "-grams:\n";
+      write(body,*L,(l < order)?H:NULL,dict,M);
+    } else
+      writebin(body,*L,(l < order)?H:NULL,bincode,M);
+
+    nglevel* tmp=L; L=H; H=tmp;
+  }
+  delete L; delete H;
+
+  for (int i=0; i<N; i++) delete M.lmt[i];
+
+  if (textoutput) {
+    body << "\\end\\\n";
+    body.close();
+
+    std::fstream out(outfile.c_str(),std::ios::out);
+    out << "\n\\data\\\n";
+    for (int l=1; l<=order; l++) {
+      sprintf(buff,"ngram %2d=%10d\n",l,cnt[l]);
+      out << buff;
+    }
+    out << "\n";
+    std::ifstream inp(bodyfile.c_str(),std::ios::in);
+    out << inp.rdbuf();
+    inp.close();
+    out.close();
+    removefile(bodyfile);
+  } else {
+    //fill in the sizes of the levels
+    for (int l=1; l<=order; l++) {
+      sprintf(buff," %10d",cnt[l]);
+      body.seekp(pos[l]);
+      body << buff;
+    }
+    body.close();
+  }
+  delete dict;
+
+  return 0;
+}
@@ -21,6 +21,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 
 #include <cmath>
 #include <sstream>
+#include <vector>
+#include <algorithm>
 #include "mfstream.h"
 #include "mempool.h"
 #include "dictionary.h"
@@ -68,11 +70,13 @@ static Enum_T SLmTypeEnum [] = {
 };
 
 
-mixture::mixture(bool fulltable,char* sublminfo,int depth,int prunefreq,char* ipfile,char* opfile):
+mixture::mixture(bool fulltable,char* sublminfo,int depth,int prunefreq,char* ipfile,char* opfile,int nthreads):
   mdiadaptlm((char *)NULL,depth)
     {
         
         prunethresh=prunefreq;
+        threads=(nthreads>0?nthreads:1);
+        l=NULL;
         ipfname=ipfile;
         opfname=opfile;
         usefulltable=fulltable;
@@ -296,9 +300,7 @@ int mixture::savepar(char* opf)
   cerr << "saving parameters in " << opf << "\n";
   out << lmsize() << " " << pmax << "\n";
 
-  for (int i=0; i<=lmsize(); i++)
-    for (int j=0; j<pmax; j++)
-      out.writex(l[i][j],sizeof(double),numslm);
+  out.writex(l,sizeof(double),(lmsize()+1)*pmax*numslm);
 
 
   return 1;
@@ -330,17 +332,90 @@ int mixture::loadpar(char* ipf)
 		exit_error(IRSTLM_ERROR_DATA, ss_msg.str());
   }
 
-  for (int i=0; i<=lmsize(); i++)
-    for (int j=0; j<pmax; j++)
-      inp.readx(l[i][j],sizeof(double),numslm);
+  inp.readx(l,sizeof(double),(lmsize()+1)*pmax*numslm);
 
   return 1;
 }
 
-int mixture::train()
+//trains sub LM i
+void mixture::train_range(void *ctx,long long i)
+{
+  ((mixture *)ctx)->sublm[i]->train();
+}
+
+//E-step on the n-grams of the current level starting with word i
+void mixture::em_range(void *ctx,long long i)
 {
+  mixture* mx=(mixture *)ctx;
+  interplm* slm=mx->sublm[0];
+  int lev=mx->emlev;
+  int t=wspool_thread_id();
+
+  double* acc=mx->emacc+(size_t)t*mx->pmax*mx->numslm;
+  char* used=mx->emused+(size_t)t*mx->pmax;
+  double numer[mx->numslm];
+
+  ngram ug(slm->dict,1);
+  *ug.wordp(1)=(int)i;
+  if (!slm->get(ug,1,1)) return;
+
+  if (lev==1) {
+    mx->em_update(ug,acc,used,numer);
+    return;
+  }
+
+  ngram ng(slm->dict,lev);
+  *ng.wordp(lev)=(int)i;
+  slm->scan(ug.link,ug.info,1,ng,INIT,lev);
+  while(slm->scan(ug.link,ug.info,1,ng,CONT,lev))
+    mx->em_update(ng,acc,used,numer);
+}
+
+void mixture::em_update(ngram& ng,double* acc,char* used,double* numer)
+{
+  int lev=emlev;
+
+  //do not include oov for unigrams
+  if ((lev==1) && (*ng.wordp(1)==sublm[0]->dict->oovcode()))
+    return;
+
+  int par=pmap(ng,lev);
+  used[par]=1;
+
+  //controllo se aggiornare il parametro
+  if (!emalive[par]) return;
+
+  double* oldl=emold+(size_t)par*numslm;
+  double backoff=(lev>1?prob(ng,lev-1):1); //backoff
+  double denom=0.0;
+  double fstar,lambda;
 
-  double zf;
+  //int cv=(int)floor(zf * (double)ng.freq + rand01());
+  //int cv=1; //old version of leaving-one-out
+  int cv=(int)floor(emzf * (double)ng.freq)+1;
+
+  for (int i=0; i<numslm; i++) {
+
+    //use cv if i=0
+
+    sublm[i]->discount(ng,lev,fstar,lambda,(i==0)*(cv));
+    numer[i]=oldl[i]*(fstar + lambda * backoff);
+
+    ngram ngslm(sublm[i]->dict);
+    ngslm.trans(ng);
+    if ((*ngslm.wordp(1)==sublm[i]->dict->oovcode()) &&
+        (dict->dub() > sublm[i]->dict->size()))
+      numer[i]/=(double)(dict->dub() - sublm[i]->dict->size());
+
+    denom+=numer[i];
+  }
+
+  for (int i=0; i<numslm; i++)
+    acc[(size_t)par*numslm+i]+=(ng.freq * (numer[i]/denom));
+}
+
+int mixture::train()
+{
 
   srand(1333);
 
@@ -358,19 +433,18 @@ int mixture::train()
     cerr << i << " sublm --> DUB: " << sublm[i]->dub()  << endl;
     cerr << "eventually generate OOV code ";
     cerr << sublm[i]->dict->encode(sublm[i]->dict->OOV()) << "\n";
-    sublm[i]->train();
   }
 
+  //sub LMs are independent of each other
+  wspool pool=wspool_init(threads);
+  wspool_parallel_for(pool,0,numslm,1,train_range,this);
+
   //initialize parameters
 
-  for (int i=0; i<=lmsize(); i++) {
-    l[i]=new double*[pmax];
-    for (int j=0; j<pmax; j++) {
-      l[i][j]=new double[numslm];
-      for (int k=0; k<numslm; k++)
-        l[i][j][k]=1.0/(double)numslm;
-    }
-  }
+  size_t npar=(size_t)(lmsize()+1)*pmax*numslm;
+  if (l) delete [] l;
+  l=new double[npar];
+  for (size_t i=0; i<npar; i++) l[i]=1.0/(double)numslm;
 
   if (ipfname) {
     //load parameters from file
@@ -378,22 +452,35 @@ int mixture::train()
   } else {
     //start training of mixture model
 
-    double oldl[pmax][numslm];
-    char alive[pmax],used[pmax];
+    int nt=wspool_size(pool);
+#ifdef MDIADAPTLM_CACHE_ENABLE
+    nt=1; //probability caches are not thread safe
+#endif
+    if (nt<threads) {
+      wspool_destroy(pool);
+      pool=wspool_init(nt);
+    }
+
+    std::vector<double> oldl((size_t)pmax*numslm);
+    std::vector<double> acc((size_t)nt*pmax*numslm);
+    std::vector<char> alive(pmax),used((size_t)nt*pmax);
     int totalive;
 
-    ngram ng(sublm[0]->dict);
+    emold=&oldl[0];
+    emacc=&acc[0];
+    emalive=&alive[0];
+    emused=&used[0];
 
     for (int lev=1; lev<=lmsize(); lev++) {
 
-      zf=sublm[0]->zerofreq(lev);
+      emlev=lev;
+      emzf=sublm[0]->zerofreq(lev);
 
       cerr << "Starting training at lev:" << lev << "\n";
 
-      for (int i=0; i<pmax; i++) {
-        alive[i]=1;
-        used[i]=0;
-      }
+      for (int i=0; i<pmax; i++) alive[i]=1;
+      for (int i=0; i<nt*pmax; i++) used[i]=0;
+
       totalive=1;
       int iter=0;
       while (totalive && (iter < 20) ) {
@@ -403,75 +490,30 @@ int mixture::train()
         for (int i=0; i<pmax; i++)
           if (alive[i])
             for (int j=0; j<numslm; j++) {
-              oldl[i][j]=l[lev][i][j];
-              l[lev][i][j]=1.0/(double)numslm;
+              oldl[(size_t)i*numslm+j]=lpar(lev,i)[j];
+              lpar(lev,i)[j]=1.0/(double)numslm;
             }
+        std::fill(acc.begin(),acc.end(),0.0);
 
-        sublm[0]->scan(ng,INIT,lev);
-        while(sublm[0]->scan(ng,CONT,lev)) {
-
-          //do not include oov for unigrams
-          if ((lev==1) && (*ng.wordp(1)==sublm[0]->dict->oovcode()))
-            continue;
-
-          int par=pmap(ng,lev);
-          used[par]=1;
-
-          //controllo se aggiornare il parametro
-          if (alive[par]) {
-
-            double backoff=(lev>1?prob(ng,lev-1):1); //backoff
-            double denom=0.0;
-            double* numer = new double[numslm];
-						double fstar,lambda;
-
-            //int cv=(int)floor(zf * (double)ng.freq + rand01());
-            //int cv=1; //old version of leaving-one-out
-            int cv=(int)floor(zf * (double)ng.freq)+1;
-            //int cv=1; //old version of leaving-one-out
-            //if (lev==3)q
-
-            //if (iter>10)
-            // cout << ng
-            // << " backoff " << backoff
-            // << " level " << lev
-            // << "\n";
-
-            for (int i=0; i<numslm; i++) {
-
-              //use cv if i=0
-
-              sublm[i]->discount(ng,lev,fstar,lambda,(i==0)*(cv));
-              numer[i]=oldl[par][i]*(fstar + lambda * backoff);
-
-              ngram ngslm(sublm[i]->dict);
-              ngslm.trans(ng);
-              if ((*ngslm.wordp(1)==sublm[i]->dict->oovcode()) &&
-                  (dict->dub() > sublm[i]->dict->size()))
-                numer[i]/=(double)(dict->dub() - sublm[i]->dict->size());
-
-              denom+=numer[i];
-            }
-
-            for (int i=0; i<numslm; i++) {
-              l[lev][par][i]+=(ng.freq * (numer[i]/denom));
-              //if (iter>10)
-              //cout << ng << " l: " << l[lev][par][i] << "\n";
-            }
-						delete []numer;
-          }
-        }
+        //n-grams are partitioned by their first word; each worker
+        //collects expected counts in its own arrays
+        wspool_parallel_for(pool,0,sublm[0]->dict->size(),0,em_range,this);
 
         //normalize all parameters
         totalive=0;
         for (int i=0; i<pmax; i++) {
-          double tot=0;
           if (alive[i]) {
-            for (int j=0; j<numslm; j++) tot+=(l[lev][i][j]);
-            for (int j=0; j<numslm; j++) l[lev][i][j]/=tot;
+            double tot=0;
+            double* li=lpar(lev,i);
+            for (int t=0; t<nt; t++)
+              for (int j=0; j<numslm; j++) li[j]+=acc[((size_t)t*pmax+i)*numslm+j];
+            for (int j=0; j<numslm; j++) tot+=li[j];
+            for (int j=0; j<numslm; j++) li[j]/=tot;
 
             //decide if to continue to update
-            if (!used[i] || (reldist(l[lev][i],oldl[i],numslm)<=0.05))
+            char u=0;
+            for (int t=0; t<nt; t++) u|=used[(size_t)t*pmax+i];
+            if (!u || (reldist(li,&oldl[(size_t)i*numslm],numslm)<=0.05))
               alive[i]=0;
           }
           totalive+=alive[i];
@@ -483,6 +525,8 @@ int mixture::train()
     }
   }
 
+  wspool_destroy(pool);
+
   if (opfname) savepar(opfname);
 
 
@@ -516,9 +560,9 @@ int mixture::discount(ngram ng_,int size,double& fstar,double& lambda,int /* unu
 		}
 
 
-    fstar+=(l[size][p][i]*fstar2);
-    lambda+=(l[size][p][i]*lambda2);
-    lsum+=l[size][p][i];
+    fstar+=(lpar(size,p)[i]*fstar2);
+    lambda+=(lpar(size,p)[i]*lambda2);
+    lsum+=lpar(size,p)[i];
   }
 
   if (dict->dub() > dict->size())
@@ -23,11 +23,13 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #ifndef LM_MIXTURE
 #define LM_MIXTURE
 
+#include "wspool.h"
+
 namespace irstlm {
 	
 class mixture: public mdiadaptlm
 {
-  double** l[MAX_NGRAM]; //interpolation parameters
+  double* l; //interpolation parameters, by level, parameter and sub LM
   int* pm; //parameter mappings
   int  pmax; //#parameters
   int k1,k2; //two thresholds
@@ -36,16 +38,33 @@ class mixture: public mdiadaptlm
   interplm** sublm;
   char *ipfname;
   char *opfname;
+  int threads;
+
+  //shared by the workers of an EM pass
+  int emlev;        //current level
+  double emzf;      //zero frequency of the current level
+  char* emalive;    //parameters still updated
+  double* emold;    //parameters of the previous iteration
+  double* emacc;    //expected counts, one array per worker
+  char* emused;     //parameters seen, one array per worker
 
 
   double reldist(double *l1,double *l2,int n);
   int genpmap();
   int pmap(ngram ng,int lev);
+
+  inline double* lpar(int lev,int par) {
+    return l+((size_t)lev*pmax+par)*numslm;
+  }
+
+  static void train_range(void *ctx,long long i);
+  static void em_range(void *ctx,long long i);
+  void em_update(ngram& ng,double* acc,char* used,double* numer);
 public:
 
   bool usefulltable;
 
-  mixture(bool fulltable,char *sublminfo,int depth,int prunefreq=0,char* ipfile=NULL,char* opfile=NULL);
+  mixture(bool fulltable,char *sublminfo,int depth,int prunefreq=0,char* ipfile=NULL,char* opfile=NULL,int nthreads=1);
 
   int train();
 
@@ -69,14 +88,16 @@ public:
   }
   int discount(ngram ng,int size,double& fstar,double& lambda,int cv=0);
 
+  //sub-LM tables may be built on demand while looking up n-grams
+  bool concurrent_discount() {
+    return false;
+  }
+
 
 
   ~mixture(){
 	 
-	  for (int i=0;i<=lmsize();i++){
-		   for (int j=0; j<pmax; j++) free(l[i][j]);
-  		   free(l[i]);
-	  }
+	  if (l) delete [] l;
 	
 	 for (int i=0;i<numslm;i++) delete(sublm[i]);
 
@@ -57,6 +57,7 @@ ngramcache::ngramcache(int n,int size,int maxentries,float lf)
   mp=new mempool(ngsize * sizeof(int)+infosize,MP_BLOCK_SIZE);
   accesses=0;
   hits=0;
+  evicted=0;
 };
 
 ngramcache::~ngramcache()
@@ -70,6 +71,7 @@ ngramcache::~ngramcache()
 void ngramcache::reset(int n)
 {
   //ht->stat();
+  evicted+=entries;
   delete ht;
   delete mp;
   if (n>0) maxn=n;
@@ -117,6 +119,19 @@ char* ngramcache::get(const int* ngp,prob_and_state_t& info)
   return found;
 };
 
+//info is an array of infosize bytes
+char* ngramcache::get(const int* ngp,int* info)
+{
+  char *found;
+
+  accesses++;
+  if ((found=(char*) ht->find((int *)ngp))) {
+    memcpy(info,found+ngsize*sizeof(int),infosize);
+    hits++;
+  }
+  return found;
+};
+
 int ngramcache::add(const int* ngp,const char*& info)
 {
   char* entry=mp->allocate();
@@ -151,9 +166,25 @@ int ngramcache::add(const int* ngp,const prob_and_state_t& info)
 };
 
 
+int ngramcache::add(const int* ngp,const int* info)
+{
+  char* entry=mp->allocate();
+  memcpy(entry,(char*) ngp,sizeof(int) * ngsize);
+  memcpy(entry + ngsize * sizeof(int),info,infosize);
+  char *found=(char*) ht->insert((int *)entry);
+  MY_ASSERT(found == entry); //false if key is already inside
+  entries++;
+  return 1;
+};
+
+void ngramcache::set(char* entry,const int* info)
+{
+  memcpy(entry + ngsize * sizeof(int),info,infosize);
+};
+
 void ngramcache::stat() const
 {
-  std::cout << "ngramcache stats: entries=" << entries << " acc=" << accesses << " hits=" << hits
+  std::cout << "ngramcache stats: entries=" << entries << " acc=" << accesses << " hits=" << hits << " evicted=" << evicted
        << " ht.used= " << ht->used() << " mp.used= " << mp->used() << " mp.wasted= " << mp->wasted() << "\n";
 };
 
@@ -53,8 +53,9 @@ private:
   int maxn;
   int ngsize;
   int infosize;
-  int accesses;
-  int hits;
+  long long accesses;
+  long long hits;
+  long long evicted; //entries dropped by reset
   int entries;
   float load_factor; //!< ngramcache loading factor
   void print(const int*);
@@ -73,12 +74,25 @@ public:
   char* get(const int* ngp,char*& info);
   char* get(const int* ngp,double& info);
   char* get(const int* ngp,prob_and_state_t& info);
+  char* get(const int* ngp,int* info);
   int add(const int* ngp,const char*& info);
   int add(const int* ngp,const double& info);
   int add(const int* ngp,const prob_and_state_t& info);
+  int add(const int* ngp,const int* info);
+  //overwrites the info of an entry found by get
+  void set(char* entry,const int* info);
   inline int isfull() const {
     return (entries >= maxn);
   }
+  inline long long naccesses() const {
+    return accesses;
+  }
+  inline long long nhits() const {
+    return hits;
+  }
+  inline long long nevicted() const {
+    return evicted;
+  }
   void stat() const;
   inline void used() const {
     stat();
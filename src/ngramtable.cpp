@@ -29,6 +29,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #include "dictionary.h"
 #include "n_gram.h"
 #include "ngramtable.h"
+#include "tokenizer.h"
 #include "crc.h"
 
 using namespace std;
@@ -290,9 +291,13 @@ ngramtable::ngramtable(char* filename,int maxl,char* /* unused parameter: is */,
   for (int i=1; i<=maxlev; i++)
     mentr[i]=memory[i]=occupancy[i]=0;
 
-  dict=new dictionary(NULL,1000000);
+  if (!filename) {
+    //empty table: it takes the codes of the external dictionary, if any
+    dict=(extdict?new dictionary(extdict):new dictionary(NULL,1000000));
+    return ;
+  }
 
-  if (!filename) return ;
+  dict=new dictionary(NULL,1000000);
 
   filterdict=NULL;
   if (filterdictfile) {
@@ -668,27 +673,32 @@ void ngramtable::generate(char *filename, dictionary* extdict)
     ng.freq=1;
   };
 
-  while (inp >> ng) {
+  tokenizer tok(inp);
+  while (tok.getline()>=0) {
+    for (int k=0, len=tok.encode(ng.dict); k<len; k++) {
+      ng.pushc(tok.code()[k]);
+      ng.freq=1;
 	
-	if (ng.size>maxlev) ng.size=maxlev;  //speeds up 
+      if (ng.size>maxlev) ng.size=maxlev;  //speeds up 
 	  
-    ng2.trans(ng); //reencode with new dictionary
+      ng2.trans(ng); //reencode with new dictionary
 
-    check_dictsize_bound();
+      check_dictsize_bound();
 
-    if (ng2.size) dict->incfreq(*ng2.wordp(1),1);
+      if (ng2.size) dict->incfreq(*ng2.wordp(1),1);
 
-    // if filtering dictionary exists
-    // and if the first word of the ngram does not belong to it
-    // do not insert the ngram
-    if (filterdict) {
-      int code=filterdict->encode(dict->decode(*ng2.wordp(maxlev)));
-      if (code!=filterdict->oovcode())	put(ng2);
-    } else put(ng2);
+      // if filtering dictionary exists
+      // and if the first word of the ngram does not belong to it
+      // do not insert the ngram
+      if (filterdict) {
+        int code=filterdict->encode(dict->decode(*ng2.wordp(maxlev)));
+        if (code!=filterdict->oovcode())	put(ng2);
+      } else put(ng2);
 	  
-    if (!(++c % 1000000)) cerr << ".";
+      if (!(++c % 1000000)) cerr << ".";
 
-  }    
+    }    
+  }
 	
   cerr << "adding some more n-grams to make table consistent\n";
   for (i=1; i<=maxlev; i++) {
@@ -746,27 +756,32 @@ void ngramtable::generate_hmask(char *filename,char* hmask,int inplen)
   ngram ng2(dict);
   dict->incflag(1);
 	long c=0;
-  while (inp >> ng) {
+  tokenizer tok(inp);
+  while (tok.getline()>=0) {
+    for (int k=0, len=tok.encode(ng.dict); k<len; k++) {
+      ng.pushc(tok.code()[k]);
+      ng.freq=1;
 
-    if (inplen && ng.size<inplen) continue;
+      if (inplen && ng.size<inplen) continue;
 
-    ng2.trans(ng); //reencode with new dictionary
-    ng.size=0;    //reset  ng
+      ng2.trans(ng); //reencode with new dictionary
+      ng.size=0;    //reset  ng
 
-    if (ng2.size >= selmask[maxlev-1]) {
-      for (int j=0; j<maxlev; j++)
-        *ng2.wordp(j+1)=*ng2.wordp(selmask[i]);
+      if (ng2.size >= selmask[maxlev-1]) {
+        for (int j=0; j<maxlev; j++)
+          *ng2.wordp(j+1)=*ng2.wordp(selmask[i]);
 
-      //cout << ng2 << "size:" << ng2.size << "\n";
-      check_dictsize_bound();
+        //cout << ng2 << "size:" << ng2.size << "\n";
+        check_dictsize_bound();
 
-      put(ng2);
-    }
+        put(ng2);
+      }
 
-    if (ng2.size) dict->incfreq(*ng2.wordp(1),1);
+      if (ng2.size) dict->incfreq(*ng2.wordp(1),1);
 
-    if (!(++c % 1000000)) cerr << ".";
-  };
+      if (!(++c % 1000000)) cerr << ".";
+    };
+  }
 
   dict->incflag(0);
   inp.close();
@@ -804,66 +819,71 @@ void ngramtable::generate_dstco(char *filename,int dstco)
   ngram dng(dict);
   dict->incflag(1);
 
-  while (inp >> ng) {
-    if (ng.size) {
-
-      ng2.trans(ng); //reencode with new dictionary
-
-      if (ng2.size>dstco) ng2.size=dstco; //maximum distance
-
-      check_dictsize_bound();
-
-      dict->incfreq(*ng2.wordp(1),1);
+  tokenizer tok(inp);
+  while (tok.getline()>=0) {
+    for (int k=0, len=tok.encode(ng.dict); k<len; k++) {
+      ng.pushc(tok.code()[k]);
+      ng.freq=1;
+      if (ng.size) {
 
-      if (maxlev == 1 )
-        cerr << "maxlev is wrong! (Possible values are 2 or 3)\n";
+        ng2.trans(ng); //reencode with new dictionary
 
-      else if (maxlev == 2 ) { //maxlev ==2
-        dng.size=2;
-        dng.freq=1;
+        if (ng2.size>dstco) ng2.size=dstco; //maximum distance
 
-        //cerr << "size=" << ng2.size << "\n";
+        check_dictsize_bound();
 
-        for (int i=2; i<=ng2.size; i++) {
-
-          if (*ng2.wordp(1)<*ng2.wordp(i)) {
-            *dng.wordp(2)=*ng2.wordp(i);
-            *dng.wordp(1)=*ng2.wordp(1);
-          } else {
-            *dng.wordp(1)=*ng2.wordp(i);
-            *dng.wordp(2)=*ng2.wordp(1);
-          }
-          //cerr << dng << "\n";
-          put(dng);
-        }
-        if (!(++c % 1000000)) cerr << ".";
-      } else { //maxlev ==3
-        dng.size=3;
-        dng.freq=1;
+        dict->incfreq(*ng2.wordp(1),1);
 
-        //cerr << "size=" << ng2.size << "\n";
-        int ar[3];
+        if (maxlev == 1 )
+          cerr << "maxlev is wrong! (Possible values are 2 or 3)\n";
 
-        ar[0]=*ng2.wordp(1);
-        for (int i=2; i<ng2.size; i++) {
-          ar[1]=*ng2.wordp(i);
-          for (int j=i+1; j<=ng2.size; j++) {
-            ar[2]=*ng2.wordp(j);
+        else if (maxlev == 2 ) { //maxlev ==2
+          dng.size=2;
+          dng.freq=1;
 
-            //sort ar
-            qsort(ar,3,sizeof(int),cmpint);
+          //cerr << "size=" << ng2.size << "\n";
 
-            *dng.wordp(1)=ar[0];
-            *dng.wordp(2)=ar[1];
-            *dng.wordp(3)=ar[2];
+          for (int i=2; i<=ng2.size; i++) {
 
-            //	    cerr << ng2 << "\n";
+            if (*ng2.wordp(1)<*ng2.wordp(i)) {
+              *dng.wordp(2)=*ng2.wordp(i);
+              *dng.wordp(1)=*ng2.wordp(1);
+            } else {
+              *dng.wordp(1)=*ng2.wordp(i);
+              *dng.wordp(2)=*ng2.wordp(1);
+            }
             //cerr << dng << "\n";
-            //cerr << *dng.wordp(1) << " "
-            //	 << *dng.wordp(2) << " "
-            //	 << *dng.wordp(3) << "\n";
             put(dng);
           }
+          if (!(++c % 1000000)) cerr << ".";
+        } else { //maxlev ==3
+          dng.size=3;
+          dng.freq=1;
+
+          //cerr << "size=" << ng2.size << "\n";
+          int ar[3];
+
+          ar[0]=*ng2.wordp(1);
+          for (int i=2; i<ng2.size; i++) {
+            ar[1]=*ng2.wordp(i);
+            for (int j=i+1; j<=ng2.size; j++) {
+              ar[2]=*ng2.wordp(j);
+
+              //sort ar
+              qsort(ar,3,sizeof(int),cmpint);
+
+              *dng.wordp(1)=ar[0];
+              *dng.wordp(2)=ar[1];
+              *dng.wordp(3)=ar[2];
+
+              //	    cerr << ng2 << "\n";
+              //cerr << dng << "\n";
+              //cerr << *dng.wordp(1) << " "
+              //	 << *dng.wordp(2) << " "
+              //	 << *dng.wordp(3) << "\n";
+              put(dng);
+            }
+          }
         }
       }
     }
@@ -1058,7 +1078,7 @@ void *ngramtable::search(table *tb,NODETYPE ndt,int lev,int n,int sz,int *ngp,
         mybsearch(*tb,n,sz,(unsigned char *)w,&idx)) {
       //shift table down by one
 
-      static char buffer[100];
+      char buffer[100];
 
       memcpy(buffer,*tb + idx * sz , sz);
 
@@ -36,6 +36,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #include "dictionary.h"
 #include "n_gram.h"
 #include "ngramtable.h"
+#include "tokenizer.h"
 
 using namespace std;
 
@@ -401,22 +402,27 @@ int main(int argc, char **argv)
 
     int bos=ng.dict->encode(ng.dict->BoS());
 
-    while(inptxt >> ng) {
+    tokenizer tok(inptxt);
+    while(tok.getline()>=0) {
+      for (int k=0, len=tok.encode(ng.dict); k<len; k++) {
+        ng.pushc(tok.code()[k]);
+        ng.freq=1;
 
-      // reset ngram at begin of sentence
-      if (*ng.wordp(1)==bos) {
-        ng.size=1;
-        continue;
-      }
+        // reset ngram at begin of sentence
+        if (*ng.wordp(1)==bos) {
+          ng.size=1;
+          continue;
+        }
 
-      ngt->bo_state(0);
-      if (ng.size>=1) {
-        logPr+=log(ngt->prob(ng));
-        if (*ng.wordp(1) == ngt->dict->oovcode())
-          Noov++;
+        ngt->bo_state(0);
+        if (ng.size>=1) {
+          logPr+=log(ngt->prob(ng));
+          if (*ng.wordp(1) == ngt->dict->oovcode())
+            Noov++;
 
-        Nw++;
-        if (ngt->bo_state()) Nbo++;
+          Nw++;
+          if (ngt->bo_state()) Nbo++;
+        }
       }
     }
 
@@ -31,55 +31,57 @@ using namespace std;
 
 // Normalization factors cache
 
-normcache::normcache(dictionary* d)
+normcache::normcache(dictionary* d,int ml,int maxentries)
 {
   dict=d;
-  //trigram and bigram normalization cache
+  maxlev=ml;
 
-  //ngt=new ngramtable(NULL,2,NULL,NULL,0,0,NULL,0,LEAFPROB);
-  ngt=new ngramtable(NULL,2,NULL,NULL,NULL,0,0,NULL,0,LEAFPROB);
+  maxcache=d->size();
+  cache=new double[maxcache];
+  for (int i=0; i<maxcache; i++) cache[i]=0.0;
 
-  maxcache[0]=d->size();//unigram cache
-  maxcache[1]=d->size();//bigram cache
+  //the normalization term of an n-gram depends on its n-1 words history
+  memset(ngcache, 0, sizeof(ngcache));
+  for (int l=3; l<=maxlev; l++)
+    ngcache[l]=new NGRAMCACHE_t(l-1,sizeof(double),maxentries);
 
-  cache[0]=new double[maxcache[0]];
-  cache[1]=new double[maxcache[1]];
-
-  for (int i=0; i<d->size(); i++)
-    cache[0][i]=cache[1][i]=0.0;
-
-  cachesize[0]=cachesize[1]=0;
   hit=miss=0;
 }
 
-void normcache::expand(int n)
+normcache::~normcache()
+{
+  delete [] cache;
+  for (int l=3; l<=maxlev; l++) delete ngcache[l];
+}
+
+void normcache::expand()
 {
 
   int step=100000;
   cerr << "Expanding cache ...\n";
-  double *newcache=new double[maxcache[n]+step];
-  memcpy(newcache,cache[n],sizeof(double)*maxcache[n]);
-  delete [] cache[n];
-  cache[n]=newcache;
+  double *newcache=new double[maxcache+step];
+  memcpy(newcache,cache,sizeof(double)*maxcache);
+  delete [] cache;
+  cache=newcache;
   for (int i=0; i<step; i++)
-    cache[n][maxcache[n]+i]=0;
-  maxcache[n]+=step;
+    cache[maxcache+i]=0;
+  maxcache+=step;
 };
 
 
+// returns 0 if the value is not in the cache
 double normcache::get(ngram ng,int size,double& value)
 {
 
   if (size==2) {
-    if (*ng.wordp(2) < cachesize[0])
-      return value=cache[0][*ng.wordp(2)];
+    if (*ng.wordp(2) < maxcache)
+      return value=cache[*ng.wordp(2)];
     else
       return value=0;
-  } else if (size==3) {
-    if (ngt->get(ng,size,size-1)) {
+  } else if (size>2 && size<=maxlev) {
+    if (ngcache[size]->get(ng.wordp(size),value)) {
       hit++;
-      //      cerr << "hit " << ng << "\n";
-      return value=cache[1][ng.freq];
+      return value;
     } else {
       miss++;
       return value=0;
@@ -92,22 +94,14 @@ double normcache::put(ngram ng,int size,double value)
 {
 
   if (size==2) {
-    if (*ng.wordp(2)>= maxcache[0]) expand(0);
-    cache[0][*ng.wordp(2)]=value;
-    cachesize[0]++;
+    while (*ng.wordp(2)>= maxcache) expand();
+    return cache[*ng.wordp(2)]=value;
+  } else if (size>2 && size<=maxlev) {
+    double z;
+    if (ngcache[size]->isfull() || ngcache[size]->get(ng.wordp(size),z))
+      return value;
+    ngcache[size]->add(ng.wordp(size),value);
     return value;
-  } else if (size==3) {
-    if (ngt->get(ng,size,size-1))
-      return cache[1][ng.freq]=value;
-    else {
-      ngram histo(dict,2);
-      *histo.wordp(1)=*ng.wordp(2);
-      *histo.wordp(2)=*ng.wordp(3);
-      histo.freq=cachesize[1]++;
-      if (cachesize[1]==maxcache[1]) expand(1);
-      ngt->put(histo);
-      return cache[1][histo.freq]=value;
-    }
   }
   return 0;
 }
@@ -116,8 +110,3 @@ void normcache::stat()
 {
   std::cout << "misses " << miss << ", hits " << hit << "\n";
 }
-
-
-
-
-
@@ -23,30 +23,34 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 
 #include "dictionary.h"
 #include "ngramtable.h"
+#include "ngramcache.h"
 
-// Normalization factors cache
+#define NORMCACHE_MAXENTRIES 4000000 //max number of histories cached per level
+
+// Normalization factors cache: one word histories are kept in an array
+// indexed by word code, longer histories in one hash table per level,
+// which stops accepting entries once full
 
 class normcache
 {
   dictionary* dict;
-  ngramtable *ngt;
-  double* cache[2];
-  int cachesize[2];
-  int maxcache[2];
+  int maxlev;
+  double* cache;                      //one word histories
+  int maxcache;
+  NGRAMCACHE_t* ngcache[MAX_NGRAM+1]; //longer histories, by n-gram size
   int hit;
   int miss;
 
 public:
-  normcache(dictionary* d);
-  ~normcache() {
-    delete [] cache[0];
-    delete [] cache[1];
-    delete ngt;
-  }
+  normcache(dictionary* d,int maxlev,int maxentries=NORMCACHE_MAXENTRIES);
+  ~normcache();
 
-  void expand(int i);
+  void expand();
   double get(ngram ng,int size,double& value);
   double put(ngram ng,int size,double value);
+  inline bool isfull(int size) const {
+    return size>2 && (size>maxlev || ngcache[size]->isfull());
+  }
   void stat();
 };
 #endif
@@ -22,7 +22,6 @@
 #include <iostream>
 #include "cmd.h"
 #include <pthread.h>
-#include "thpool.h"
 #include "util.h"
 #include "mfstream.h"
 #include "mempool.h"
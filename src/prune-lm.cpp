@@ -43,8 +43,10 @@ void print_help(int TypeFlag=0){
   std::cerr << std::endl << "DESCRIPTION:" << std::endl;
 	std::cerr << "       prune-lm reads a LM in either ARPA or compiled format and" << std::endl;
 	std::cerr << "       prunes out n-grams (n=2,3,..) for which backing-off to the" << std::endl;
-	std::cerr << "       lower order n-gram results in a small difference in probability." << std::endl;
-	std::cerr << "       The pruned LM is saved in ARPA format" << std::endl;
+	std::cerr << "       lower order n-gram results in a small difference in probability" << std::endl;
+	std::cerr << "       (weighted difference) or in a small increase of perplexity" << std::endl;
+	std::cerr << "       (relative entropy)." << std::endl;
+	std::cerr << "       The pruned LM is saved in ARPA format, or in binary format with -b" << std::endl;
   std::cerr << std::endl << "OPTIONS:" << std::endl;
 	
 	FullPrintParams(TypeFlag, 0, 1, stderr);
@@ -77,6 +79,10 @@ int main(int argc, char **argv)
   float thr[MAX_NGRAM];
   char *spthr=NULL;
 	int	aflag=0;
+	bool entropy=false;
+	bool binary=false;
+	bool memmap=false;
+	int threads=1;
   std::vector<std::string> files;
 	
 	bool help=false;
@@ -86,6 +92,14 @@ int main(int argc, char **argv)
 		"t", CMDSTRINGTYPE|CMDMSG, &spthr, "pruning thresholds for 2-grams, 3-grams, 4-grams,...; if less thresholds are specified, the last one is applied to all following n-gram levels; default is 0",
 							
 		"abs", CMDBOOLTYPE|CMDMSG, &aflag, "uses absolute value of weighted difference; default is 0",
+		"entropy", CMDBOOLTYPE|CMDMSG, &entropy, "prunes n-grams whose removal increases perplexity by a relative amount below the threshold (relative entropy); default is false",
+		"e", CMDBOOLTYPE|CMDMSG, &entropy, "prunes n-grams whose removal increases perplexity by a relative amount below the threshold (relative entropy); default is false",
+		"threads", CMDINTTYPE|CMDMSG, &threads, "number of threads; default is 1",
+		"th", CMDINTTYPE|CMDMSG, &threads, "number of threads; default is 1",
+		"binary", CMDBOOLTYPE|CMDMSG, &binary, "saves the pruned LM in binary format; default is false",
+		"b", CMDBOOLTYPE|CMDMSG, &binary, "saves the pruned LM in binary format; default is false",
+		"memmap", CMDBOOLTYPE|CMDMSG, &memmap, "uses memory map to read a binary LM; requires binary output; default is false",
+		"mm", CMDBOOLTYPE|CMDMSG, &memmap, "uses memory map to read a binary LM; requires binary output; default is false",
 
 		"Help", CMDBOOLTYPE|CMDMSG, &help, "print this help",
 		"h", CMDBOOLTYPE|CMDMSG, &help, "print this help",
@@ -133,6 +147,11 @@ int main(int argc, char **argv)
 		exit_error(IRSTLM_ERROR_DATA,"Specify a LM file to read from");
   }
 
+  if (memmap && !binary) {
+    usage();
+		exit_error(IRSTLM_ERROR_DATA,"A memory mapped LM can only be saved in binary format (-b)");
+  }
+
   memset(thr, 0, sizeof(thr));
   if(spthr != NULL) s2t(spthr, thr);
   std::string infile = files[0];
@@ -150,7 +169,7 @@ int main(int argc, char **argv)
     if (outfile.compare(outfile.size()-3,3,".gz")==0)
       outfile.erase(outfile.size()-3,3);
 
-    outfile+=".plm";
+    outfile+=(binary?".pblm":".plm");
   } else
     outfile = files[1];
 	
@@ -162,13 +181,21 @@ int main(int argc, char **argv)
 		exit_error(IRSTLM_ERROR_IO, ss_msg.str());
   }
 
-  lmt.load(inp,infile.c_str(),outfile.c_str(),0);
+  if (memmap)
+    lmt.load(inp,infile.c_str(),NULL,1);
+  else
+    lmt.load(inp,infile.c_str(),outfile.c_str(),0);
   std::cerr << "pruning LM with thresholds: \n";
 
   for (int i=1; i<lmt.maxlevel(); i++) std::cerr<< " " << thr[i];
   std::cerr << "\n";
-  lmt.wdprune((float*)thr, aflag);
-  lmt.savetxt(outfile.c_str());
+  lmt.prune((float*)thr, entropy?LMT_PRUNE_ENTROPY:LMT_PRUNE_WD, aflag, threads);
+  if (binary)
+    lmt.savebin_pruned(outfile.c_str());
+  else {
+    lmt.prune_apply();
+    lmt.savetxt(outfile.c_str());
+  }
 	
 	exit_error(IRSTLM_NO_ERROR);
 }
@@ -26,44 +26,34 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #include <fstream>
 #include <vector>
 #include <string>
+#include <algorithm>
 #include <stdlib.h>
+#include <sys/time.h>
 #include "cmd.h"
 #include "math.h"
 #include "util.h"
 #include "mfstream.h"
+#include "wspool.h"
+#include "tokenizer.h"
+#include "lmtable.h"
 
 
 using namespace std;
+using namespace irstlm;
 
 //----------------------------------------------------------------------
-//  Special type and global variable for the BIN CLUSTERING algorithm
-//
-//
+//  Codebooks are computed on the sorted points of a level: a code covers
+//  a contiguous range of values, upper[c] being the largest one, so that
+//  points are mapped to codes by binary search
 //----------------------------------------------------------------------
 
-
-typedef struct {
-  float pt;
-  unsigned int idx;
-  unsigned short code;
-} DataItem;
-
-
-int cmpFloatEntry(const void* a,const void* b)
-{
-  if (*(float *)a > *(float*)b)
-    return 1;
-  else if (*(float *)a < *(float *)b)
-    return -1;
-  else
-    return 0;
-}
-
 //----------------------------------------------------------------------
 //  Global entry points
 //----------------------------------------------------------------------
 
-int ComputeCluster(int nc, double* cl,unsigned int N,DataItem* Pts);
+int ComputeCluster(int nc, double* cl,unsigned int N,const float* pts,float* upper);
+int RefineCluster(int nc, double* cl,unsigned int N,const float* pts,float* upper,int& used,int iter);
+double ClusterError(const double* cl,unsigned int N,const float* pts,const float* upper,int used);
 
 //----------------------------------------------------------------------
 //  Global parameters (some are set in getArgs())
@@ -72,6 +62,134 @@ int ComputeCluster(int nc, double* cl,unsigned int N,DataItem* Pts);
 int       k      = 256;   // number of centers
 const int MAXLEV = 11;    //maximum n-gram size
 
+//----------------------------------------------------------------------
+//  Parallel sort and mapping of the points of a level
+//----------------------------------------------------------------------
+
+typedef struct {
+  float* a;         // runs to sort or merge
+  float* b;         // merge target
+  long long n;
+  long long width;  // run length
+  const float* upper;
+  int used;
+  unsigned short* map;
+} QuantJob;
+
+static void sort_run(void* ctx,long long i)
+{
+  QuantJob* j=(QuantJob*) ctx;
+  long long lo=i*j->width, hi=min(lo+j->width,j->n);
+  std::sort(j->a+lo,j->a+hi);
+}
+
+static void merge_run(void* ctx,long long i)
+{
+  QuantJob* j=(QuantJob*) ctx;
+  long long lo=2*i*j->width;
+  long long mid=min(lo+j->width,j->n), hi=min(lo+2*j->width,j->n);
+  std::merge(j->a+lo,j->a+mid,j->a+mid,j->a+hi,j->b+lo);
+}
+
+static void map_run(void* ctx,long long i)
+{
+  QuantJob* j=(QuantJob*) ctx;
+  j->map[i]=(unsigned short)(std::lower_bound(j->upper,j->upper+j->used,j->a[i])-j->upper);
+}
+
+// sorts n points with one run per task followed by rounds of pairwise
+// merges; returns the buffer holding the result (a or tmp)
+static float* ParallelSort(wspool pool,float* a,float* tmp,long long n)
+{
+  QuantJob j;
+  long long parts=4*wspool_size(pool);
+  j.n=n;
+  j.width=(n+parts-1)/parts;
+  if (j.width<1) j.width=1;
+  j.a=a;
+  j.b=tmp;
+  wspool_parallel_for(pool,0,(n+j.width-1)/j.width,1,sort_run,&j);
+  while (j.width<n) {
+    wspool_parallel_for(pool,0,(n+2*j.width-1)/(2*j.width),1,merge_run,&j);
+    swap(j.a,j.b);
+    j.width*=2;
+  }
+  return j.a;
+}
+
+static void ParallelMap(wspool pool,float* pts,long long n,const float* upper,int used,unsigned short* map)
+{
+  QuantJob j;
+  j.a=pts;
+  j.n=n;
+  j.upper=upper;
+  j.used=used;
+  j.map=map;
+  wspool_parallel_for(pool,0,n,0,map_run,&j);
+}
+
+static double wallclock()
+{
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// quantizes the points of a level: codebook in ctrs, codes in map
+static void QuantizeLevel(wspool pool,int centers,double* ctrs,unsigned int N,float* pts,float* sorted,float* tmp,unsigned short* map,int lloyd)
+{
+  float* upper=new float[centers];
+
+  memcpy(sorted,pts,N * sizeof(float));
+  float* s=ParallelSort(pool,sorted,tmp,N);
+
+  int used=ComputeCluster(centers,ctrs,N,s,upper);
+
+  if (lloyd>0) {
+    double err=ClusterError(ctrs,N,s,upper,used);
+    int it=RefineCluster(centers,ctrs,N,s,upper,used,lloyd);
+    cerr << "Lloyd refinement: " << it << " iterations, squared error per point "
+         << err/N << " -> " << ClusterError(ctrs,N,s,upper,used)/N << "\n";
+  } else
+    cerr << "squared error per point " << ClusterError(ctrs,N,s,upper,used)/N << "\n";
+
+  ParallelMap(pool,pts,N,upper,used,map);
+
+  delete [] upper;
+}
+
+// perplexity of a text, computed as compile-lm --eval does
+static double Perplexity(lmtable* lmt,const char* textfile)
+{
+  mfstream inptxt(textfile,ios::in);
+  tokenizer tok(inptxt);
+  ngram ng(lmt->getDict());
+
+  lmt->getDict()->incflag(1);
+  int bos=ng.dict->encode(ng.dict->BoS());
+  lmt->getDict()->incflag(0);
+
+  double logPr=0;
+  int Nw=0;
+
+  lmt->dictionary_incflag(1);
+  while (tok.getline()>=0) {
+    for (int k=0, len=tok.encode(ng.dict); k<len; k++) {
+      ng.pushc(tok.code()[k]);
+      if (ng.size>lmt->maxlevel()) ng.size=lmt->maxlevel();
+      if (*ng.wordp(1)==bos) {
+        ng.size=1;
+        continue;
+      }
+      logPr+=lmt->clprob(ng);
+      Nw++;
+    }
+  }
+  lmt->dictionary_incflag(0);
+
+  return exp((-logPr * log(10.0)) /Nw);
+}
+
 //----------------------------------------------------------------------
 //  Main program
 //----------------------------------------------------------------------
@@ -79,14 +197,13 @@ const int MAXLEV = 11;    //maximum n-gram size
 void print_help(int TypeFlag=0){
   std::cerr << std::endl << "quantize-lm - quantizes probabilities and back-off weights" << std::endl;
   std::cerr << std::endl << "USAGE:"  << std::endl;
-	std::cerr << "       quantize-lm <input-file.lm> [<output-file.qlm> [<tmpfile>]]" << std::endl;
+	std::cerr << "       quantize-lm <input-file.lm> [<output-file.qlm>] [options]" << std::endl;
   std::cerr << std::endl << "DESCRIPTION:" << std::endl;
 	std::cerr << "       quantize-lm reads a standard LM file in ARPA format and produces" << std::endl;
 	std::cerr << "       a version of it with quantized probabilities and back-off weights"<< std::endl;
 	std::cerr << "       that the IRST LM toolkit can compile. Accepts LMs with .gz suffix." << std::endl;
-	std::cerr << "       You can specify the output file to be created and also the pathname" << std::endl;
-	std::cerr << "       of a temporary file used by the program. As default, the temporary "  << std::endl;
-	std::cerr << "       file is created in the /tmp directory." << std::endl;
+	std::cerr << "       Each level is read once and kept in memory, so no temporary file" << std::endl;
+	std::cerr << "       is needed. The output can also be the compiled binary LM." << std::endl;
 	std::cerr << "       Output file can be written to standard output by using the special name -."  << std::endl;
   std::cerr << std::endl << "OPTIONS:" << std::endl;
 	
@@ -109,8 +226,23 @@ int main(int argc, char **argv)
   std::vector<std::string> files;
 	
 	bool help=false;
+	bool binary=false;
+	int lloyd=0;
+	int threads=1;
+	char* seval=NULL;
+	int dub=10000000;
 	
 	DeclareParams((char*)
+								"lloyd", CMDINTTYPE|CMDMSG, &lloyd, "iterations of Lloyd-Max refinement of the codebooks; default is 0 (equal-population bins)",
+								"l", CMDINTTYPE|CMDMSG, &lloyd, "iterations of Lloyd-Max refinement of the codebooks; default is 0 (equal-population bins)",
+								"threads", CMDINTTYPE|CMDMSG, &threads, "number of threads sorting and mapping the points; default is 1",
+								"th", CMDINTTYPE|CMDMSG, &threads, "number of threads sorting and mapping the points; default is 1",
+								"binary", CMDBOOLTYPE|CMDMSG, &binary, "saves the quantized LM in binary format; default is false",
+								"b", CMDBOOLTYPE|CMDMSG, &binary, "saves the quantized LM in binary format; default is false",
+								"eval", CMDSTRINGTYPE|CMDMSG, &seval, "computes perplexity of the specified text file with the original and the quantized LM",
+								"e", CMDSTRINGTYPE|CMDMSG, &seval, "computes perplexity of the specified text file with the original and the quantized LM",
+								"dub", CMDINTTYPE|CMDMSG, &dub, "dictionary upperbound to compute OOV word penalty with -eval: default 10^7",
+								
 								"Help", CMDBOOLTYPE|CMDMSG, &help, "print this help",
 								"h", CMDBOOLTYPE|CMDMSG, &help, "print this help",
 								
@@ -155,7 +287,6 @@ int main(int argc, char **argv)
 
   std::string infile = files[0];
   std::string outfile="";
-  std::string tmpfile="";
 
   if (files.size() == 1) {
 
@@ -170,22 +301,12 @@ int main(int argc, char **argv)
     if (outfile.compare(outfile.size()-3,3,".gz")==0)
       outfile.erase(outfile.size()-3,3);
 
-    outfile+=".qlm";
+    outfile+=(binary?".qblm":".qlm");
   } else
     outfile = files[1];
 
-
-  if (files.size()==3) {
-    //create temporary file
-    tmpfile = files[2];
-    mfstream dummy(tmpfile.c_str(),ios::out);
-    dummy.close();
-  } else {
-    //create temporary internal file in /tmp
-    mfstream dummy;
-    createtempfile(dummy,tmpfile,ios::out);
-    dummy.close();
-  }
+  if (files.size()==3)
+    std::cerr << "Temporary file " << files[2] << " is not needed any more and is ignored" << std::endl;
 
   std::cerr << "Reading " << infile << "..." << std::endl;
 
@@ -196,38 +317,50 @@ int main(int argc, char **argv)
 		exit_error(IRSTLM_ERROR_IO, ss_msg.str());
   }
 	
-  std::ofstream* out;
-  if (outfile == "-")
-    out = (ofstream *)&std::cout;
-  else {
-    out=new std::ofstream;
-    out->open(outfile.c_str());
-  }
-	if (!out->good()) {
-		std::stringstream ss_msg;
-		ss_msg << "Failed to open " << outfile;
-		exit_error(IRSTLM_ERROR_IO, ss_msg.str());
+  //the qARPA text is written while levels are processed; the binary LM
+  //and the evaluation use tables filled from the levels kept in memory
+  std::ofstream* out=NULL;
+
+  if (!binary) {
+    if (outfile == "-")
+      out = (ofstream *)&std::cout;
+    else {
+      out=new std::ofstream;
+      out->open(outfile.c_str());
+    }
+    if (!out->good()) {
+      std::stringstream ss_msg;
+      ss_msg << "Failed to open " << outfile;
+      exit_error(IRSTLM_ERROR_IO, ss_msg.str());
+    }
   }
+  std::ostream* qout=out;
 
   std::cerr << "Writing " << outfile << "..." << std::endl;
 
-  //prepare temporary file to save n-gram blocks for multiple reads
-  //this avoids using seeks which do not work with inputfilestream
-  //it's odd but i need a bidirectional filestream!
-  std::cerr << "Using temporary file " << tmpfile << std::endl;
-  fstream filebuff(tmpfile.c_str(),ios::out|ios::in|ios::binary);
-
-  unsigned int nPts = 0;  // actual number of points
-
   // *** Read ARPA FILE **
 
   unsigned int numNgrams[MAXLEV + 1]; /* # n-grams for each order */
   int Order=0,MaxOrder=0;
   int n=0;
 
-  float logprob,logbow;
+  wspool pool=wspool_init(threads);
 
-  DataItem* dataPts;
+  //n-gram words are kept as codes of a dictionary
+  dictionary dict((char*)NULL,1000000);
+  dict.incflag(1);
+
+  //quantized LM and, for the evaluation, the original one share dict
+  lmtable* qlmt=NULL;
+  lmtable* lmt=NULL;
+  if (binary || seval) {
+    qlmt=new lmtable;
+    qlmt->setDict(&dict);
+  }
+  if (seval) {
+    lmt=new lmtable;
+    lmt->setDict(&dict);
+  }
 
   double* centersP=NULL;
   double* centersB=NULL;
@@ -237,140 +370,135 @@ int main(int argc, char **argv)
   unsigned short* mapB=NULL;
 
   int centers[MAXLEV + 1];
-  streampos iposition;
 
   for (int i=1; i<=MAXLEV; i++) numNgrams[i]=0;
   for (int i=1; i<=MAXLEV; i++) centers[i]=k;
 
   /* all levels 256 centroids; in case read them as parameters */
 
-  char line[MAX_LINE];
+  tokenizer tok(inp);
+  double tstart=wallclock();
 
-  while (inp.getline(line,MAX_LINE)) {
+  while (tok.getline()>=0) {
 
-    bool backslash = (line[0] == '\\');
+    if (tok.size()==0 || !strcmp(tok.word(0),"\\data\\"))
+      continue;
 
-    if (sscanf(line, "ngram %d=%d", &Order, &n) == 2) {
-      numNgrams[Order] = n;
-      MaxOrder=Order;
+    if (!strcmp(tok.word(0),"ngram") && tok.size()>=2) {
+      int m=sscanf(tok.word(1),"%d=%d", &Order, &n);
+      if (m==1 && tok.size()>=3) m+=sscanf(tok.word(2),"%d",&n);
+      if (m==2) {
+        numNgrams[Order] = n;
+        MaxOrder=Order;
+      }
       continue;
     }
 
-    if (!strncmp(line, "\\data\\", 6) || strlen(line)==0)
-      continue;
+    if (tok.word(0)[0] == '\\' && sscanf(tok.word(0), "\\%d-grams", &Order) == 1) {
 
-    if (backslash && sscanf(line, "\\%d-grams", &Order) == 1) {
+      if (Order == 1) {
+        if (qlmt) qlmt->loadarray_init(MaxOrder,true);
+        if (lmt) lmt->loadarray_init(MaxOrder,false);
+      }
 
       // print output header:
-      if (Order == 1) {
-        *out << "qARPA " << MaxOrder;
+      if (Order == 1 && qout) {
+        *qout << "qARPA " << MaxOrder;
         for (int i=1; i<=MaxOrder; i++)
-          *out << " " << centers[i];
-        *out << "\n\n\\data\\\n";
+          *qout << " " << centers[i];
+        *qout << "\n\n\\data\\\n";
 
         for (int i=1; i<=MaxOrder; i++)
-          *out << "ngram " << i << "= " << numNgrams[i] << "\n";
+          *qout << "ngram " << i << "= " << numNgrams[i] << "\n";
       }
 
-      *out << "\n";
-      *out << line << "\n";
+      if (qout) {
+        *qout << "\n";
+        *qout << tok.word(0) << "\n";
+      }
       cerr << "-- Start processing of " << Order << "-grams\n";
       MY_ASSERT(Order <= MAXLEV);
 
       unsigned int N=numNgrams[Order];
+      bool hasbow=(Order<MaxOrder);
+      double t0=wallclock();
 
-      const char* words[MAXLEV+3];
-      dataPts=new DataItem[N]; // allocate data
-
-      //reset tempout file to start writing
-      filebuff.seekg((streampos)0);
-
-      for (nPts=0; nPts<N; nPts++) {
-        inp.getline(line,MAX_LINE);
-        filebuff << line << std::endl;
-        if (!filebuff.good()) {
-          removefile(tmpfile.c_str());
-					std::stringstream ss_msg;
-					ss_msg << "Cannot write in temporary file " << tmpfile  << std::endl
-					<< " Probably there is not enough space in this filesystem " << std::endl
-					<< " Eventually rerun quantize-lm by specifyng the pathname" << std::endl
-					<< " of the temporary file to be used. ";
-					exit_error(IRSTLM_ERROR_IO, ss_msg.str());
-        }
-        int howmany = parseWords(line, words, Order + 3);
+      //one pass collects probabilities, back-off weights and words
+      float* probs=new float[N];
+      float* bows=hasbow?new float[N]:NULL;
+      int* words=new int[(size_t)N * Order];
+
+      for (unsigned int nPts=0; nPts<N; nPts++) {
+        int howmany=tok.getline();
         MY_ASSERT(howmany == Order+2 || howmany == Order+1);
-        sscanf(words[0],"%f",&logprob);
-        dataPts[nPts].pt=logprob; //exp(logprob * logten);
-        dataPts[nPts].idx=nPts;
+        probs[nPts]=strtof(tok.word(0),NULL);
+        for (int i=1; i<=Order; i++)
+          words[(size_t)nPts * Order + i - 1]=dict.encode(tok.word(i));
+        if (hasbow) {
+          if (howmany==Order+2) //backoff is written
+            bows[nPts]=strtof(tok.word(Order+1),NULL);
+          else
+            bows[nPts]=0; // backoff is implicit
+        }
       }
 
+      double t1=wallclock();
+
+      float* sorted=new float[N];
+      float* tmp=new float[N];
+
       cerr << "quantizing " << N << " probabilities\n";
 
       centersP=new double[centers[Order]];
       mapP=new unsigned short[N];
+      QuantizeLevel(pool,centers[Order],centersP,N,probs,sorted,tmp,mapP,lloyd);
 
-      ComputeCluster(centers[Order],centersP,N,dataPts);
-
-
-      for (unsigned int p=0; p<N; p++) {
-        mapP[dataPts[p].idx]=dataPts[p].code;
-      }
-
-      if (Order<MaxOrder) {
-        //second pass to read back-off weights
-        //read from temporary file
-        filebuff.seekg((streampos)0);
-
-        for (nPts=0; nPts<N; nPts++) {
-
-          filebuff.getline(line,MAX_LINE);
-          int howmany = parseWords(line, words, Order + 3);
-          if (howmany==Order+2) //backoff is written
-            sscanf(words[Order+1],"%f",&logbow);
-          else
-            logbow=0; // backoff is implicit
-
-          dataPts[nPts].pt=logbow;
-          dataPts[nPts].idx=nPts;
-        }
-
+      if (hasbow) {
         centersB=new double[centers[Order]];
         mapB=new unsigned short[N];
 
         cerr << "quantizing " << N << " backoff weights\n";
-        ComputeCluster(centers[Order],centersB,N,dataPts);
-
-        for (unsigned int p=0; p<N; p++) {
-          mapB[dataPts[p].idx]=dataPts[p].code;
-        }
-
+        QuantizeLevel(pool,centers[Order],centersB,N,bows,sorted,tmp,mapB,lloyd);
       }
 
+      delete [] sorted;
+      delete [] tmp;
 
-      *out << centers[Order] << "\n";
-      for (int c=0; c<centers[Order]; c++) {
-        *out << centersP[c];
-        if (Order<MaxOrder) *out << " " << centersB[c];
-        *out << "\n";
-      }
+      double t2=wallclock();
 
-      filebuff.seekg(0);
-
-      for (nPts=0; nPts<numNgrams[Order]; nPts++) {
+      if (qout) {
+        *qout << centers[Order] << "\n";
+        for (int c=0; c<centers[Order]; c++) {
+          *qout << centersP[c];
+          if (hasbow) *qout << " " << centersB[c];
+          *qout << "\n";
+        }
 
-        filebuff.getline(line,MAX_LINE);
+        for (unsigned int nPts=0; nPts<N; nPts++) {
 
-        parseWords(line, words, Order + 3);
+          *qout << mapP[nPts];
 
-        *out << mapP[nPts];
+          for (int i=0; i<Order; i++) *qout << "\t" << dict.decode(words[(size_t)nPts * Order + i]);
 
-        for (int i=1; i<=Order; i++) *out << "\t" << words[i];
+          if (hasbow) *qout << "\t" << mapB[nPts];
 
-        if (Order < MaxOrder) *out << "\t" << mapB[nPts];
+          *qout << "\n";
 
-        *out << "\n";
+        }
+      }
 
+      if (qlmt) {
+        qlmt->loadarray_centers(Order,centers[Order],centersP,centersB);
+        qlmt->loadarray_level(Order,N,words,mapP,mapB);
       }
+      if (lmt) lmt->loadarray_level(Order,N,words,probs,bows);
+
+      cerr << "level " << Order << ": read " << t1-t0 << "s quantize " << t2-t1
+           << "s write " << wallclock()-t2 << "s\n";
+
+      delete [] probs;
+      if (bows) delete [] bows;
+      delete [] words;
 
       if (mapP) {
         delete [] mapP;
@@ -390,8 +518,6 @@ int main(int argc, char **argv)
         centersB=NULL;
       }
 
-      delete [] dataPts;
-
       continue;
 
 
@@ -399,35 +525,57 @@ int main(int argc, char **argv)
 
   }
 
-  *out << "\\end\\\n";
-  cerr << "---- done\n";
-
-  out->flush();
+  if (qout) *qout << "\\end\\\n";
+  cerr << "---- done in " << wallclock()-tstart << "s\n";
 
-  out->close();
+  wspool_destroy(pool);
   inp.close();
 
-  removefile(tmpfile.c_str());
+  if (out) {
+    out->flush();
+    if (out != (ofstream *)&std::cout) out->close();
+  }
+
+  if (!qlmt) return 0;
+
+  dict.incflag(0);
+  dict.genoovcode();
+
+  if (seval) {
+    if (dub) {
+      lmt->setlogOOVpenalty(dub);
+      qlmt->setlogOOVpenalty(dub);
+    }
+    double pp=Perplexity(lmt,seval);
+    double qpp=Perplexity(qlmt,seval);
+    std::cerr.precision(2);
+    std::cerr << std::fixed << "%% PP=" << pp << " quantized PP=" << qpp
+              << " (" << (qpp-pp)/pp*100.0 << "%)" << std::endl;
+    delete lmt;
+  }
+
+  if (binary) {
+    std::cerr << "Saving in bin format to " << outfile << std::endl;
+    qlmt->savebin(outfile.c_str());
+  }
+
+  delete qlmt;
+  return 0;
 }
 
 // Compute Clusters
 
-int ComputeCluster(int centers,double* ctrs,unsigned int N,DataItem* bintable)
+int ComputeCluster(int centers,double* ctrs,unsigned int N,const float* bintable,float* upper)
 {
 
 
   //cerr << "\nExecuting Clutering Algorithm:  k=" << centers<< "\n";
   double log10=log(10.0);
 
-  for (unsigned int i=0; i<N; i++) bintable[i].code=0;
-
-  //cout << "start sort \n";
-  qsort(bintable,N,sizeof(DataItem),cmpFloatEntry);
-
   unsigned int different=1;
 
   for (unsigned int i=1; i<N; i++)
-    if (bintable[i].pt!=bintable[i-1].pt)
+    if (bintable[i]!=bintable[i-1])
       different++;
 
   unsigned int interval=different/centers;
@@ -445,7 +593,7 @@ int ComputeCluster(int centers,double* ctrs,unsigned int N,DataItem* bintable)
   }
 
   // initial values: this should catch up very low values: -99
-  bintable[0].code=0;
+  upper[0]=bintable[0];
   population[0]=1;
   species[0]=1;
 
@@ -454,7 +602,7 @@ int ComputeCluster(int centers,double* ctrs,unsigned int N,DataItem* bintable)
 
   for (unsigned int i=1; i<N; i++) {
 
-    if ((bintable[i].pt!=bintable[i-1].pt)) {
+    if ((bintable[i]!=bintable[i-1])) {
       different++;
       if ((different % interval) == 0)
         if ((currcode+1) < centers
@@ -462,20 +610,13 @@ int ComputeCluster(int centers,double* ctrs,unsigned int N,DataItem* bintable)
             population[currcode]>0) {
           currcode++;
         }
-    }
-
-    if (bintable[i].pt == bintable[i-1].pt)
-      bintable[i].code=bintable[i-1].code;
-    else {
-      bintable[i].code=currcode;
       species[currcode]++;
     }
 
-    population[bintable[i].code]++;
-
-    MY_ASSERT(bintable[i].code < centers);
+    population[currcode]++;
+    upper[currcode]=bintable[i];
 
-    ctrs[bintable[i].code]=ctrs[bintable[i].code]+exp(bintable[i].pt * log10);
+    ctrs[currcode]=ctrs[currcode]+exp(bintable[i] * log10);
 
   }
 
@@ -499,14 +640,78 @@ int ComputeCluster(int centers,double* ctrs,unsigned int N,DataItem* bintable)
   delete [] species;
 
 
-  return 1;
+  return currcode+1;
 
 }
 
-//----------------------------------------------------------------------
-//  Reading/Printing utilities
-//      readPt - read a point from input stream into data storage
-//              at position i.  Returns false on error or EOF.
-//      printPt - prints a points to output file
-//----------------------------------------------------------------------
+// Lloyd-Max refinement in the log domain: every center moves to the mean
+// of its points, every boundary to the midpoint of adjacent centers; the
+// used codes keep their order, codes left empty are dropped
+
+int RefineCluster(int centers,double* ctrs,unsigned int N,const float* pts,float* upper,int& used,int iter)
+{
+  double* sum=new double[N+1]; // prefix sums of the points
+  unsigned int* end=new unsigned int[used];
+
+  sum[0]=0;
+  for (unsigned int i=0; i<N; i++) sum[i+1]=sum[i]+pts[i];
+
+  for (int c=0; c<used; c++)
+    end[c]=std::upper_bound(pts,pts+N,upper[c])-pts;
 
+  int it=0;
+  for (;;) {
+
+    //centers of the non empty codes
+    int m=0;
+    for (int c=0; c<used; c++) {
+      unsigned int beg=(c>0?end[c-1]:0);
+      if (end[c]>beg) {
+        ctrs[m]=(sum[end[c]]-sum[beg])/(end[c]-beg);
+        end[m++]=end[c];
+      }
+    }
+    used=m;
+
+    if (it==iter) break;
+    it++;
+
+    //boundaries
+    bool changed=false;
+    for (int c=0; c<used-1; c++) {
+      float mid=(float)((ctrs[c]+ctrs[c+1])/2);
+      unsigned int e=std::upper_bound(pts,pts+N,mid)-pts;
+      if (e!=end[c]) {
+        end[c]=e;
+        changed=true;
+      }
+    }
+    if (!changed) break;
+  }
+
+  for (int c=0; c<centers; c++) {
+    if (c<used)
+      upper[c]=pts[end[c]-1];
+    else
+      ctrs[c]=-99;
+    if (ctrs[c]<-99) ctrs[c]=-99;
+  }
+
+  delete [] sum;
+  delete [] end;
+
+  return it;
+}
+
+// squared quantization error (log domain) of the sorted points
+
+double ClusterError(const double* ctrs,unsigned int N,const float* pts,const float* upper,int used)
+{
+  double err=0;
+  int c=0;
+  for (unsigned int i=0; i<N; i++) {
+    while (c<used-1 && pts[i]>upper[c]) c++;
+    err+=(pts[i]-ctrs[c])*(pts[i]-ctrs[c]);
+  }
+  return err;
+}
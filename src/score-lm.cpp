@@ -24,13 +24,245 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "cmd.h"
 #include "util.h"
-#include "lmtable.h"
-#include "n_gram.h"
+#include "lmContainer.h"
+#include "ngramcache.h"
+#include "tokenizer.h"
 
 using namespace irstlm;
 
+/* Server mode (-socket): the LM is loaded once and clients connect to a
+ * Unix-domain socket; every connection is served by its own thread, with
+ * its own cache of n-gram scores, over the shared read-only model.
+ *
+ * A client sends request frames and receives one reply frame for each.
+ * A frame is a header of three native unsigned ints followed by a payload:
+ *   type   request type; in replies, 0 on success (the connection is
+ *          closed after a failure)
+ *   nsent  number of sentences
+ *   bytes  size of the payload
+ * Request payload, for each sentence: an unsigned int n, then
+ *   SCORELM_RAW     n bytes of text, words separated by white spaces
+ *   SCORELM_CODES   n ints, word codes of the LM dictionary
+ *   SCORELM_ENCODE  n bytes of text, as SCORELM_RAW
+ * Reply payload, for each sentence: an unsigned int n (number of words), then
+ *   SCORELM_RAW, SCORELM_CODES  a double (log10 score of the sentence) and
+ *                               n floats (log10 score of each word)
+ *   SCORELM_ENCODE              n ints (word codes)
+ * Words are scored as in the standard input mode.
+ */
+
+#define SCORELM_RAW    0
+#define SCORELM_CODES  1
+#define SCORELM_ENCODE 2
+
+#define SCORELM_MAXFRAME (1u << 28) //largest accepted payload
+#define SCORELM_CACHESIZE 100000    //default size of the cache of a connection
+
+typedef struct {
+  unsigned int type;
+  unsigned int nsent;
+  unsigned int bytes;
+} scorelm_frame_t;
+
+typedef struct {
+  lmContainer* lmt;
+  int fd;
+  int cachesize;
+  pthread_mutex_t* lock; //serializes scoring, if the model is not thread safe
+} scorelm_conn_t;
+
+static bool readall(int fd, void* buf, size_t n)
+{
+  char* p=(char*) buf;
+  while (n>0) {
+    ssize_t r=read(fd, p, n);
+    if (r<0 && errno==EINTR) continue;
+    if (r<=0) return false;
+    p+=r; n-=r;
+  }
+  return true;
+}
+
+static bool writeall(int fd, const void* buf, size_t n)
+{
+  const char* p=(const char*) buf;
+  while (n>0) {
+    ssize_t r=send(fd, p, n, MSG_NOSIGNAL);
+    if (r<0 && errno==EINTR) continue;
+    if (r<=0) return false;
+    p+=r; n-=r;
+  }
+  return true;
+}
+
+template<class T> static void append(std::vector<char>& buf, const T* v, size_t n)
+{
+  buf.insert(buf.end(), (const char*) v, (const char*) (v+n));
+}
+
+//scores the n-grams ending at each word of a sentence, looking them up
+//in the cache of the connection first
+static double score_codes(scorelm_conn_t* c, std::vector<ngramcache*>& cache, const int* codes, int n, float* logpr)
+{
+  int maxlev=c->lmt->maxlevel();
+  double total=.0;
+  if (c->lock) pthread_mutex_lock(c->lock);
+  for (int k=0; k<n; k++) {
+    int sz=(k+1 < maxlev)? k+1 : maxlev;
+    const int* ng=codes+k+1-sz;
+    double lp;
+    if (!cache[sz]->get(ng, lp)) {
+      lp=c->lmt->clprob((int*) ng, sz);
+      if (cache[sz]->isfull()) cache[sz]->reset();
+      cache[sz]->add(ng, lp);
+    }
+    logpr[k]=(float) lp;
+    total+=lp;
+  }
+  if (c->lock) pthread_mutex_unlock(c->lock);
+  return total;
+}
+
+static void* serve(void* arg)
+{
+  scorelm_conn_t* c=(scorelm_conn_t*) arg;
+  dictionary* dict=c->lmt->getDict();
+  int maxlev=c->lmt->maxlevel();
+
+  std::vector<ngramcache*> cache(maxlev+1, (ngramcache*) NULL);
+  for (int l=1; l<=maxlev; l++)
+    cache[l]=new ngramcache(l, sizeof(double), c->cachesize);
+
+  tokenizer tok;
+  std::vector<char> req, rep;
+  std::vector<int> codes;
+  std::vector<float> logpr;
+  scorelm_frame_t h;
+
+  while (readall(c->fd, &h, sizeof(h))) {
+    bool ok=(h.bytes <= SCORELM_MAXFRAME);
+    if (ok) {
+      req.resize(h.bytes+1);
+      ok=readall(c->fd, &req[0], h.bytes);
+    }
+    rep.clear();
+    size_t p=0;
+    for (unsigned int s=0; ok && s<h.nsent; s++) {
+      unsigned int len;
+      if (h.bytes-p < sizeof(len)) { ok=false; break; }
+      memcpy(&len, &req[p], sizeof(len));
+      p+=sizeof(len);
+
+      int n;
+      if (h.type == SCORELM_CODES) {
+        if ((h.bytes-p)/sizeof(int) < len) { ok=false; break; }
+        n=len;
+        codes.resize(n+1);
+        memcpy(&codes[0], &req[p], n*sizeof(int));
+        p+=n*sizeof(int);
+        for (int k=0; k<n; k++)
+          if (codes[k]<0 || codes[k]>=dict->size()) ok=false;
+        if (!ok) break;
+      } else if (h.type == SCORELM_RAW || h.type == SCORELM_ENCODE) {
+        if (h.bytes-p < len) { ok=false; break; }
+        tok.getline(&req[p], len);
+        p+=len;
+        n=tok.encode(dict);
+        codes.assign(tok.code(), tok.code()+n);
+        codes.resize(n+1);
+      } else {
+        ok=false;
+        break;
+      }
+
+      unsigned int un=n;
+      append(rep, &un, 1);
+      if (h.type == SCORELM_ENCODE) {
+        append(rep, &codes[0], n);
+      } else {
+        logpr.resize(n+1);
+        double total=score_codes(c, cache, &codes[0], n, &logpr[0]);
+        append(rep, &total, 1);
+        append(rep, &logpr[0], n);
+      }
+    }
+
+    scorelm_frame_t r;
+    r.type=ok? 0 : 1;
+    r.nsent=ok? h.nsent : 0;
+    r.bytes=ok? rep.size() : 0;
+    if (!writeall(c->fd, &r, sizeof(r))) break;
+    if (!ok) break;
+    if (r.bytes>0 && !writeall(c->fd, &rep[0], r.bytes)) break;
+  }
+
+  close(c->fd);
+  for (int l=1; l<=maxlev; l++) delete cache[l];
+  delete c;
+  return NULL;
+}
+
+//accepts connections forever, one thread each
+static void server(lmContainer* lmt, const char* path, int cachesize)
+{
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    exit_error(IRSTLM_ERROR_DATA, std::string("socket path is too long: ")+path);
+
+  int sfd=socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sfd<0) exit_error(IRSTLM_ERROR_IO, "cannot create the socket");
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(sfd, (struct sockaddr*) &addr, sizeof(addr))<0 || listen(sfd, 64)<0)
+    exit_error(IRSTLM_ERROR_IO, std::string("cannot listen on ")+path);
+
+  signal(SIGPIPE, SIG_IGN);
+
+  //words are encoded without changing the dictionary
+  lmt->getDict()->genoovcode();
+
+  //lmtable only reads its tables, unless its caches are compiled in
+  static pthread_mutex_t lock=PTHREAD_MUTEX_INITIALIZER;
+  bool shared=(lmt->getLanguageModelType() == _IRSTLM_LMTABLE);
+#if defined(PS_CACHE_ENABLE) || defined(LMT_CACHE_ENABLE)
+  shared=false;
+#endif
+
+  std::cerr << "score-lm: serving on " << path << std::endl;
+  for (;;) {
+    int fd=accept(sfd, NULL, NULL);
+    if (fd<0) {
+      if (errno==EINTR) continue;
+      exit_error(IRSTLM_ERROR_IO, "accept failed");
+    }
+    scorelm_conn_t* c=new scorelm_conn_t;
+    c->lmt=lmt;
+    c->fd=fd;
+    c->cachesize=cachesize;
+    c->lock=shared? NULL : &lock;
+
+    pthread_t th;
+    if (pthread_create(&th, NULL, serve, c) != 0) {
+      std::cerr << "score-lm: cannot create a thread for a new connection" << std::endl;
+      close(fd);
+      delete c;
+      continue;
+    }
+    pthread_detach(th);
+  }
+}
+
 void print_help(int TypeFlag=0){
   std::cerr << std::endl << "score-lm - scores sentences with a language model" << std::endl;
   std::cerr << std::endl << "USAGE:"  << std::endl
@@ -41,6 +273,8 @@ void print_help(int TypeFlag=0){
   std::cerr << "       -level   max level to load from the language models (default: 1000," << std::endl;
   std::cerr << "           meaning the actual LM order)" << std::endl;
   std::cerr << "       -mm 1    memory-mapped access to lm (default: 0)" << std::endl;
+  std::cerr << "       -threads threads evaluating the sub-models of an interpolated lm (default: 1)" << std::endl;
+  std::cerr << "       -socket  serves clients on this Unix-domain socket instead of reading stdin" << std::endl;
   std::cerr << std::endl;
 
   FullPrintParams(TypeFlag, 0, 1, stderr);
@@ -61,7 +295,12 @@ int main(int argc, char **argv)
   int mmap = 0;
   int dub = 10000000;
   int requiredMaxlev = 1000;
+  int threads = 1;
+  int cachesize = SCORELM_CACHESIZE;
+  int batch = 0;
   char *lm = NULL;
+  char *socketpath = NULL;
+  char *salloc = NULL;
 
   bool help=false;
 
@@ -71,8 +310,18 @@ int main(int argc, char **argv)
                 "dub", CMDINTTYPE|CMDMSG, &dub, "dictionary upperbound to compute OOV word penalty: default 10^7",
                 "memmap", CMDINTTYPE|CMDMSG, &mmap, "uses memory map to read a binary LM",
                 "mm", CMDINTTYPE|CMDMSG, &mmap, "uses memory map to read a binary LM",
+                "alloc", CMDSTRINGTYPE|CMDMSG, &salloc, "allocation policy of the in-memory tables: default, or a comma separated list of thp (transparent huge pages), hugetlb (huge pages, falling back to thp) and interleave (over NUMA nodes); default is default",
+                "al", CMDSTRINGTYPE|CMDMSG, &salloc, "allocation policy of the in-memory tables: default, or a comma separated list of thp (transparent huge pages), hugetlb (huge pages, falling back to thp) and interleave (over NUMA nodes); default is default",
                 "level", CMDINTTYPE|CMDMSG, &requiredMaxlev, "maximum level to load from the LM; if value is larger than the actual LM order, the latter is taken",
                 "lev", CMDINTTYPE|CMDMSG, &requiredMaxlev, "maximum level to load from the LM; if value is larger than the actual LM order, the latter is taken",
+                "threads", CMDINTTYPE|CMDMSG, &threads, "number of threads evaluating the sub-models of an interpolated LM on batches (see -batch); default is 1",
+                "th", CMDINTTYPE|CMDMSG, &threads, "number of threads evaluating the sub-models of an interpolated LM on batches (see -batch); default is 1",
+                "batch", CMDINTTYPE|CMDMSG, &batch, "scores the n-grams of a sentence in batches of the given size through the batched lookup; default is 0 (one n-gram at a time)",
+                "ba", CMDINTTYPE|CMDMSG, &batch, "scores the n-grams of a sentence in batches of the given size through the batched lookup; default is 0 (one n-gram at a time)",
+                "socket", CMDSTRINGTYPE|CMDMSG, &socketpath, "serves clients on the specified Unix-domain socket instead of reading the standard input",
+                "so", CMDSTRINGTYPE|CMDMSG, &socketpath, "serves clients on the specified Unix-domain socket instead of reading the standard input",
+                "cachesize", CMDINTTYPE|CMDMSG, &cachesize, "n-grams cached per level by each connection of the server; default is 100000",
+                "cs", CMDINTTYPE|CMDMSG, &cachesize, "n-grams cached per level by each connection of the server; default is 100000",
                                                                 
                 "Help", CMDBOOLTYPE|CMDMSG, &help, "print this help",
                 "h", CMDBOOLTYPE|CMDMSG, &help, "print this help",
@@ -98,24 +347,54 @@ int main(int argc, char **argv)
 		exit_error(IRSTLM_ERROR_DATA,"Missing parameter: please, specify the LM to use (-lm)");
   }
 
-  std::ifstream lmstr(lm);
-  lmtable lmt;
-  lmt.setMaxLoadedLevel(requiredMaxlev);
-  lmt.load(lmstr, lm, NULL, mmap);
-  lmt.setlogOOVpenalty(dub);
+  //checking the language model type
+  lmContainer* lmt = lmContainer::CreateLanguageModel(lm);
+  lmt->setMaxLoadedLevel(requiredMaxlev);
+  if (salloc) lmt->setAllocPolicy(PAllocPolicy(salloc));
+  lmt->load(lm, mmap);
+  lmt->setlogOOVpenalty(dub);
+  lmt->setThreads(threads);
+
+  if (socketpath != NULL) {
+    if (cachesize < 1) cachesize = 1;
+    server(lmt, socketpath, cachesize);
+  }
+
+  //the n-gram ending at a word is the stretch of codes of the line up
+  //to it; with -batch, n-grams are scored in batches of that size
+  tokenizer tok;
+  std::vector<int*> ngs;
+  std::vector<int> ngsize;
+  std::vector<double> logpr;
 
   for(;;) {
     std::string line;
     std::getline(std::cin, line);
-    if(!std::cin.good())
+    if(!std::cin.good()){
+      delete lmt;
       return !std::cin.eof();
+    }
+
+    tok.getline(line.data(), line.size());
+    int n = tok.encode(lmt->getDict());
+    int* codes = tok.code();
 
-    std::istringstream linestr(line);
-    ngram ng(lmt.dict);
+    ngs.resize(n); ngsize.resize(n); logpr.resize(n);
+    for (int k=0; k<n; k++) {
+      ngsize[k] = (k+1 < lmt->maxlevel())? k+1 : lmt->maxlevel();
+      ngs[k] = codes + k + 1 - ngsize[k];
+    }
+    if (batch > 0) {
+      for (int k=0; k<n; k+=batch)
+        lmt->clprob_batch(&ngs[k], &ngsize[k], (n-k<batch)? n-k : batch, &logpr[k]);
+    } else {
+      for (int k=0; k<n; k++)
+        logpr[k] = lmt->clprob(ngs[k], ngsize[k]);
+    }
 
     double logprob = .0;
-    while((linestr >> ng))
-      logprob += lmt.lprob(ng);
+    for (int k=0; k<n; k++)
+      logprob += logpr[k];
 
     std::cout << logprob << std::endl;
   }
@@ -154,6 +154,7 @@ int main(int argc, char **argv)
 	int adaptlevel=0;   //adaptation level
 	double adaptrate=1.0;
 	bool adaptoov=false; //do not increment the dictionary
+	int threads=1;
 	
 	bool help=false;
 	
@@ -201,6 +202,9 @@ int main(int argc, char **argv)
 		"AdaptOOV", CMDBOOLTYPE|CMDMSG, &adaptoov, "boolean flag for increasing the dictionary during adaptation (default is false)",
 		"ao", CMDBOOLTYPE|CMDMSG, &adaptoov, "boolean flag for increasing the dictionary during adaptation (default is false)",
 								
+		"Threads", CMDINTTYPE|CMDMSG, &threads, "number of threads for training mixture LMs and precomputing the adaptation normalization terms (default is 1)",
+		"th", CMDINTTYPE|CMDMSG, &threads, "number of threads for training mixture LMs and precomputing the adaptation normalization terms (default is 1)",
+								
 		"SaveScaleFactor", CMDSTRINGTYPE|CMDMSG, &scalefactorfile, "output file for the scale factors",
 		"ssf", CMDSTRINGTYPE|CMDMSG, &scalefactorfile, "output file for the scale factors",
 								
@@ -346,7 +350,7 @@ int main(int argc, char **argv)
 		case MIXTURE:
 			//temporary check: so far unable to proper handle this flag in sub LMs
 			//no ngramtable is created
-			lm=new mixture(SavePerLevel,slminfo,size,prunefreq,imixpar,omixpar);
+			lm=new mixture(SavePerLevel,slminfo,size,prunefreq,imixpar,omixpar,threads);
 			break;
 			
 		default:
@@ -388,7 +392,7 @@ int main(int argc, char **argv)
 	
 	if (adaptoov) lm->dict->incflag(1);
 	
-	if (adaptfile) lm->adapt(adaptfile,adaptlevel,adaptrate);
+	if (adaptfile) lm->adapt(adaptfile,adaptlevel,adaptrate,threads);
 	
 	if (adaptoov) lm->dict->incflag(0);
 	
@@ -532,7 +536,7 @@ int main(int argc, char **argv)
 					<< afile << " " << tfile << "\n";
 					
 					if (adaptoov) lm->dict->incflag(1);
-					lm->adapt(afile,adaptlevel,adaptrate);
+					lm->adapt(afile,adaptlevel,adaptrate,threads);
 					if (adaptoov) lm->dict->incflag(0);
 					if (scalefactorfile) lm->savescalefactor(scalefactorfile);
 					if (ASRfile) lm->saveASR(ASRfile,backoff,dictfile);
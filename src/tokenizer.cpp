@@ -0,0 +1,292 @@
+/******************************************************************************
+IrstLM: IRST Language Model Toolkit
+Copyright (C) 2006 Marcello Federico, ITC-irst Trento, Italy
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+
+******************************************************************************/
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "util.h"
+#include "mempool.h"
+#include "htable.h"
+#include "dictionary.h"
+#include "tokenizer.h"
+
+using namespace std;
+
+// bit i is set if p[i] is one of ' ','\t','\n','\v','\f','\r'
+static inline unsigned int wsmask(const char* p)
+{
+#ifdef __SSE2__
+  __m128i x=_mm_loadu_si128((const __m128i*)p);
+  __m128i sp=_mm_cmpeq_epi8(x,_mm_set1_epi8(' '));
+  __m128i d=_mm_sub_epi8(x,_mm_set1_epi8('\t'));
+  __m128i ct=_mm_cmpeq_epi8(_mm_min_epu8(d,_mm_set1_epi8(4)),d); //'\t'..'\r'
+  return (unsigned int)_mm_movemask_epi8(_mm_or_si128(sp,ct));
+#else
+  unsigned int m=0;
+  for (int i=0; i<16; i++) {
+    unsigned char c=(unsigned char)p[i];
+    if (c==' ' || (unsigned char)(c-'\t')<5) m|=1u<<i;
+  }
+  return m;
+#endif
+}
+
+tokenizer::tokenizer(std::istream& in,size_t size)
+{
+  inp=&in;
+  bufsize=size;
+  buf=(char *)calloc(bufsize+TOKENIZER_PAD,1);
+  beg=end=0;
+  eof=false;
+
+  maxwords=256;
+  words=(char **)malloc(maxwords * sizeof(char*));
+  codes=(int *)malloc(maxwords * sizeof(int));
+  nwords=0;
+  ls=le=buf;
+  spill=NULL;
+  spillsize=0;
+
+  if (buf==NULL || words==NULL || codes==NULL)
+    exit_error(IRSTLM_ERROR_MEMORY, "tokenizer: cannot allocate buffers");
+}
+
+tokenizer::tokenizer()
+{
+  inp=NULL;
+  bufsize=MAX_WORD;
+  buf=(char *)calloc(bufsize+TOKENIZER_PAD,1);
+  beg=end=0;
+  eof=true;
+
+  maxwords=256;
+  words=(char **)malloc(maxwords * sizeof(char*));
+  codes=(int *)malloc(maxwords * sizeof(int));
+  nwords=0;
+  ls=le=buf;
+  spill=NULL;
+  spillsize=0;
+
+  if (buf==NULL || words==NULL || codes==NULL)
+    exit_error(IRSTLM_ERROR_MEMORY, "tokenizer: cannot allocate buffers");
+}
+
+tokenizer::~tokenizer()
+{
+  free(buf);
+  free(words);
+  free(codes);
+  free(spill);
+}
+
+// moves the unread data to the front and reads the next block;
+// the buffer is doubled when a single line does not fit
+int tokenizer::fill()
+{
+  if (beg>0) {
+    memmove(buf,buf+beg,end-beg);
+    end-=beg;
+    beg=0;
+  }
+  if (end==bufsize) {
+    bufsize*=2;
+    buf=(char *)realloc(buf,bufsize+TOKENIZER_PAD);
+    if (buf==NULL)
+      exit_error(IRSTLM_ERROR_MEMORY, "tokenizer: cannot grow buffer");
+  }
+
+  inp->read(buf+end,bufsize-end);
+  size_t n=inp->gcount();
+  end+=n;
+  if (n==0) eof=true;
+  memset(buf+end,0,TOKENIZER_PAD);
+  return (int)n;
+}
+
+const char* tokenizer::readline(size_t& len)
+{
+  if (inp==NULL) return NULL;
+
+  size_t from=beg;  //bytes already searched for a newline
+  for (;;) {
+    char* nl=(char*) memchr(buf+from,'\n',end-from);
+    if (nl) {
+      ls=buf+beg;
+      le=nl;
+      beg=nl-buf+1;
+      break;
+    }
+    if (eof) {
+      if (beg==end) return NULL;
+      ls=buf+beg;
+      le=buf+end; //last line without newline
+      beg=end;
+      break;
+    }
+    from=end-beg;
+    fill();
+    from+=beg;
+  }
+  len=le-ls;
+  return ls;
+}
+
+int tokenizer::split()
+{
+  return split(ls,le);
+}
+
+int tokenizer::getline()
+{
+  size_t len;
+  if (readline(len)==NULL) return -1;
+  return split(ls,le);
+}
+
+int tokenizer::getline(const char* line,size_t len)
+{
+  if (len>bufsize) {
+    while (len>bufsize) bufsize*=2;
+    free(buf);
+    buf=(char *)malloc(bufsize+TOKENIZER_PAD);
+    if (buf==NULL)
+      exit_error(IRSTLM_ERROR_MEMORY, "tokenizer: cannot grow buffer");
+  }
+  memcpy(buf,line,len);
+  memset(buf+len,0,TOKENIZER_PAD);
+  ls=buf;
+  le=buf+len;
+  return split(ls,le);
+}
+
+// scans 16 bytes at a time: the white space mask of a block gives the
+// positions where words start and end, which are visited in order;
+// bytes past e are read from the padding and masked as spaces
+int tokenizer::split(char* s,char* e)
+{
+  unsigned int carry=0; //previous byte belongs to a word
+  bool longwords=false;
+  nwords=0;
+
+  for (char* p=s; p<e; p+=16) {
+    unsigned int sp=wsmask(p);
+    if (e-p<16) sp|=(0xffffu << (e-p)) & 0xffffu;
+    unsigned int wd=~sp & 0xffffu;
+    unsigned int prev=((wd << 1) | carry) & 0xffffu;
+    unsigned int starts=wd & ~prev;
+    unsigned int events=starts | (sp & prev);
+    carry=wd >> 15;
+
+    while (events) {
+      int i=__builtin_ctz(events);
+      events&=events-1;
+      if (starts & (1u << i)) {
+        if (nwords==maxwords) growwords(nwords+1);
+        words[nwords++]=p+i;
+      } else {
+        p[i]='\0';
+        if (p+i-words[nwords-1]>=MAX_WORD-1) longwords=true;
+      }
+    }
+  }
+  if (carry) { //word reaching the end of a block-aligned line
+    *e='\0';
+    if (e-words[nwords-1]>=MAX_WORD-1) longwords=true;
+  }
+  if (longwords) splitlong();
+  return nwords;
+}
+
+void tokenizer::growwords(int n)
+{
+  while (maxwords<n) maxwords*=2;
+  words=(char **)realloc(words,maxwords * sizeof(char*));
+  codes=(int *)realloc(codes,maxwords * sizeof(int));
+  if (words==NULL || codes==NULL)
+    exit_error(IRSTLM_ERROR_MEMORY, "tokenizer: cannot grow word array");
+}
+
+// as with istream >> setw(MAX_WORD), a word of more than MAX_WORD-1
+// characters is returned as several words of at most MAX_WORD-1
+// characters; pieces cannot be terminated in place, so they are copied
+void tokenizer::splitlong()
+{
+  const size_t piece=MAX_WORD-1;
+  size_t need=0;
+  int n=nwords;
+
+  for (int i=0; i<nwords; i++) {
+    size_t len=strlen(words[i]);
+    if (len<piece) continue;
+    for (size_t off=0; off+piece<=len; off+=piece)
+      cerr << "tokenizer: a too long word was read ("
+           << string(words[i]+off,piece) << ")\n";
+    if (len==piece) continue;
+    int k=(len+piece-1)/piece;
+    n+=k-1;
+    need+=len+k;
+  }
+  if (n==nwords) return;
+
+  if (need>spillsize) {
+    spill=(char *)realloc(spill,need);
+    if (spill==NULL)
+      exit_error(IRSTLM_ERROR_MEMORY, "tokenizer: cannot grow buffer");
+    spillsize=need;
+  }
+  if (n>maxwords) growwords(n);
+
+  //from the last word backwards, so that the array can be expanded in place
+  char* q=spill;
+  for (int i=nwords-1, j=n-1; i>=0; i--) {
+    char* w=words[i];
+    size_t len=strlen(w);
+    if (len<=piece) {
+      words[j--]=w;
+      continue;
+    }
+    for (int k=(len-1)/piece; k>=0; k--) {
+      size_t off=k*piece, plen=(len-off<piece)? len-off : piece;
+      memcpy(q,w+off,plen);
+      q[plen]='\0';
+      words[j--]=q;
+      q+=plen+1;
+    }
+  }
+  nwords=n;
+}
+
+int tokenizer::encode(dictionary* d,int skip)
+{
+  int n=0;
+  for (int i=skip; i<nwords; i++) {
+    int c=d->encode(words[i]);
+    if (c == -1 ) {
+      std::stringstream ss_msg;
+      ss_msg << "tokenizer: " << words[i] << " is OOV";
+      exit_error(IRSTLM_ERROR_MODEL, ss_msg.str());
+    }
+    codes[n++]=c;
+  }
+  return n;
+}
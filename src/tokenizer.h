@@ -0,0 +1,88 @@
+/******************************************************************************
+IrstLM: IRST Language Model Toolkit
+Copyright (C) 2006 Marcello Federico, ITC-irst Trento, Italy
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+
+******************************************************************************/
+
+#ifndef MF_TOKENIZER_H
+#define MF_TOKENIZER_H
+
+#include <iostream>
+
+class dictionary;
+
+#define TOKENIZER_BUFSIZE (1<<22)  //bytes read from the stream at once
+#define TOKENIZER_PAD 16           //bytes beyond the data scanned by a block
+
+// Bulk line tokenizer: reads the input in large blocks, splits every
+// line on white spaces (the same set used by istream >>) 16 bytes at a
+// time and encodes the words of a line into an array of codes with a
+// single call. Words are terminated in place and stay valid until the
+// next line is read.
+
+class tokenizer
+{
+  std::istream* inp;
+  char* buf;       //input block plus padding
+  size_t bufsize;  //allocated size, padding excluded
+  size_t beg;      //start of the unread data
+  size_t end;      //end of the valid data
+  bool eof;
+
+  char** words;    //words of the current line
+  int* codes;      //codes of the current line
+  int nwords;
+  int maxwords;
+  char* ls;        //current line
+  char* le;
+  char* spill;     //pieces of too long words
+  size_t spillsize;
+
+  int fill();
+  int split(char* s,char* e);
+  void growwords(int n);
+  void splitlong();
+
+public:
+  tokenizer(std::istream& in,size_t size=TOKENIZER_BUFSIZE);
+  tokenizer();
+  ~tokenizer();
+
+  //! splits the next line of the stream; returns the number of words, -1 at end of input
+  int getline();
+  //! returns the next line of the stream as it is, NULL at end of input
+  const char* readline(size_t& len);
+  //! splits the line returned by readline()
+  int split();
+  //! splits a line given by the caller, e.g. read interactively
+  int getline(const char* line,size_t len);
+
+  //! encodes the words of the current line from position skip on; returns their number
+  int encode(dictionary* d,int skip=0);
+
+  inline int size() const {
+    return nwords;
+  }
+  inline char* word(int i) const {
+    return words[i];
+  }
+  inline int* code() const {
+    return codes;
+  }
+};
+
+#endif
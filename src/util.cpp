@@ -30,6 +30,12 @@
 #include <sstream>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <fstream>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #endif
 #include "gzfilebuf.h"
 #include "timer.h"
@@ -191,6 +197,120 @@ int Munmap(void	*p,size_t	len,int	sync)
 }
 
 
+/* Large anonymous allocations
+ PAlloc returns at least len bytes allocated according to the policy
+ (PALLOC_* flags) and sets in *kind the policy actually obtained, which
+ must be passed to PFree: huge pages are tried first and the request
+ falls back to transparent huge pages and then to normal pages;
+ interleaving over the NUMA nodes is applied to whatever was obtained.
+ Allocations smaller than a huge page always come from malloc.
+ */
+
+#define PALLOC_HUGESIZE (2UL<<20)
+
+#ifdef __linux__
+//bit mask of the online NUMA nodes; 0 if there is only one node
+static unsigned long numa_nodes()
+{
+	std::ifstream inp("/sys/devices/system/node/online");
+	unsigned long mask=0;
+	int a,b;
+	char c;
+	while (inp >> a) {
+		b=a;
+		if (inp.peek()=='-') inp >> c >> b;
+		for (int n=a; n<=b && n<(int)(8*sizeof(mask)); n++) mask|=1UL<<n;
+		if (inp.peek()==',') inp >> c;
+	}
+	return (mask & (mask-1))? mask : 0;
+}
+#endif
+
+void *PAlloc(size_t len, int policy, int *kind)
+{
+	*kind=PALLOC_DEFAULT;
+#ifdef __linux__
+	if (policy!=PALLOC_DEFAULT && len>=PALLOC_HUGESIZE) {
+		size_t sz=(len+PALLOC_HUGESIZE-1) & ~(PALLOC_HUGESIZE-1);
+		char *p=NULL;
+#ifdef MAP_HUGETLB
+		if (policy & PALLOC_HUGETLB) {
+			p=(char*) mmap(NULL,sz,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+			if (p==MAP_FAILED) p=NULL;
+			else *kind=PALLOC_HUGETLB;
+		}
+#endif
+		if (p==NULL) {
+			//aligned to a huge page, so that it can be backed by transparent ones
+			char *q=(char*) mmap(NULL,sz+PALLOC_HUGESIZE,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+			if (q!=MAP_FAILED) {
+				p=(char*) (((size_t) q+PALLOC_HUGESIZE-1) & ~(PALLOC_HUGESIZE-1));
+				if (p>q) munmap(q,p-q);
+				munmap(p+sz,q+PALLOC_HUGESIZE-p);
+				*kind=PALLOC_MMAP;
+#ifdef MADV_HUGEPAGE
+				if ((policy & (PALLOC_THP|PALLOC_HUGETLB)) && madvise(p,sz,MADV_HUGEPAGE)==0)
+					*kind=PALLOC_THP;
+#endif
+			}
+		}
+		if (p!=NULL) {
+			//pages are not touched yet, so the policy applies to all of them
+			unsigned long nodes;
+			if ((policy & PALLOC_INTERLEAVE) && (nodes=numa_nodes())!=0 &&
+			    syscall(__NR_mbind,p,sz,MPOL_INTERLEAVE,&nodes,8*sizeof(nodes),0)==0)
+				*kind|=PALLOC_INTERLEAVE;
+			return p;
+		}
+	}
+#else
+	UNUSED(policy);
+#endif
+	return malloc(len>0?len:1);
+}
+
+void PFree(void *p, size_t len, int kind)
+{
+	if (p==NULL) return;
+#ifdef __linux__
+	if (kind!=PALLOC_DEFAULT) {
+		munmap(p,(len+PALLOC_HUGESIZE-1) & ~(PALLOC_HUGESIZE-1));
+		return;
+	}
+#else
+	UNUSED(len);
+	UNUSED(kind);
+#endif
+	free(p);
+}
+
+int PAllocPolicy(const std::string &list)
+{
+	int policy=PALLOC_DEFAULT;
+	std::string s=list+",";
+	size_t b=0,e;
+	while ((e=s.find(',',b))!=std::string::npos) {
+		std::string w=s.substr(b,e-b);
+		if (w=="hugetlb") policy|=PALLOC_HUGETLB|PALLOC_THP;
+		else if (w=="thp") policy|=PALLOC_THP;
+		else if (w=="interleave") policy|=PALLOC_INTERLEAVE;
+		else if (w!="" && w!="default") exit_error(IRSTLM_ERROR_DATA, "unknown allocation policy "+w+" (known: default, thp, hugetlb, interleave)");
+		b=e+1;
+	}
+	return policy;
+}
+
+std::string PAllocName(int kind)
+{
+	std::string s;
+	if (kind & PALLOC_HUGETLB) s="hugetlb";
+	else if (kind & PALLOC_THP) s="thp";
+	else if (kind & PALLOC_MMAP) s="mmap";
+	else s="default";
+	if (kind & PALLOC_INTERLEAVE) s+=",interleave";
+	return s;
+}
+
 //global variable
 Timer g_timer;
 
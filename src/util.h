@@ -54,6 +54,18 @@ void removefile(const std::string &filePath);
 void *MMap(int	fd, int	access, off_t	offset, size_t	len, off_t	*gap);
 int Munmap(void	*p,size_t	len,int	sync);
 
+//allocation policies of PAlloc
+#define PALLOC_DEFAULT    0  //malloc
+#define PALLOC_THP        1  //transparent huge pages
+#define PALLOC_HUGETLB    2  //explicit huge pages, falling back to THP
+#define PALLOC_INTERLEAVE 4  //pages interleaved over all NUMA nodes
+#define PALLOC_MMAP       8  //anonymous mapping (set by PAlloc only)
+
+void *PAlloc(size_t len, int policy, int *kind);
+void PFree(void *p, size_t len, int kind);
+int PAllocPolicy(const std::string &list);
+std::string PAllocName(int kind);
+
 
 // A couple of utilities to measure access time
 void ResetUserTime();
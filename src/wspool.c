@@ -0,0 +1,400 @@
+/******************************************************************************
+ IrstLM: IRST Language Model Toolkit
+ Copyright (C) 2006 Marcello Federico, ITC-irst Trento, Italy
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "wspool.h"
+
+#define WSDEQUE_INITSIZE 64
+#define WSCHUNKS_PER_THREAD 64
+
+static __thread int wsworker_id=-1;     /* index of the calling worker */
+static __thread struct wspool_* wsworker_pool=NULL; /* pool of the calling worker */
+
+
+/* ========================== STRUCTURES ============================ */
+
+
+/* Completion counter shared by the tasks of one parallel-for */
+typedef struct wsgroup{
+	volatile long long remaining;        /* indices still to process  */
+	int done;                            /* set under lock at the end */
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+} wsgroup;
+
+
+/* Task: either a single job or a range of a parallel-for */
+typedef struct wstask{
+	void*  (*job)(void* arg);            /* single job                */
+	void*  arg;
+	void   (*body)(void* ctx, long long i); /* range job              */
+	void*  ctx;
+	long long lo, hi, chunk;
+	wsgroup* group;
+} wstask;
+
+
+/* Deque: owner works at the bottom, thieves at the top */
+typedef struct wsdeque{
+	pthread_mutex_t lock;
+	wstask* buf;
+	long long cap;
+	long long top;
+	long long bottom;
+} wsdeque;
+
+
+typedef struct wsworker{
+	int       id;
+	pthread_t pthread;
+	unsigned int seed;                   /* for victim selection      */
+	wsdeque   dq;
+	struct wspool_* pool;
+} wsworker;
+
+
+typedef struct wspool_{
+	int        num_threads;
+	wsworker*  workers;
+	volatile long queued;                /* tasks sitting in deques   */
+	volatile long unfinished;            /* tasks not yet completed   */
+	volatile int  sleeping;              /* workers waiting for tasks */
+	volatile int  stop;
+	volatile unsigned int next;          /* round-robin for add_work  */
+	pthread_mutex_t idle_lock;
+	pthread_cond_t  idle_cond;
+	pthread_mutex_t done_lock;
+	pthread_cond_t  done_cond;
+} wspool_;
+
+
+
+/* ============================ DEQUE =============================== */
+
+
+static void wsdeque_init(wsdeque* dq){
+	pthread_mutex_init(&dq->lock, NULL);
+	dq->cap=WSDEQUE_INITSIZE;
+	dq->buf=(wstask*)malloc(dq->cap * sizeof(wstask));
+	if (dq->buf==NULL){
+		fprintf(stderr, "wspool_init(): Could not allocate memory for deque\n");
+		exit(1);
+	}
+	dq->top=dq->bottom=0;
+}
+
+static void wsdeque_push(wsdeque* dq, const wstask* t){
+	pthread_mutex_lock(&dq->lock);
+	if (dq->bottom - dq->top == dq->cap){ /* full: double the ring */
+		wstask* nbuf=(wstask*)malloc(2 * dq->cap * sizeof(wstask));
+		long long i;
+		if (nbuf==NULL){
+			fprintf(stderr, "wspool: Could not allocate memory for deque\n");
+			exit(1);
+		}
+		for (i=dq->top; i<dq->bottom; i++) nbuf[i % (2 * dq->cap)]=dq->buf[i % dq->cap];
+		free(dq->buf);
+		dq->buf=nbuf; dq->cap*=2;
+	}
+	dq->buf[dq->bottom % dq->cap]=*t;
+	dq->bottom++;
+	pthread_mutex_unlock(&dq->lock);
+}
+
+static int wsdeque_pop(wsdeque* dq, wstask* t){
+	int found=0;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->bottom > dq->top){
+		dq->bottom--;
+		*t=dq->buf[dq->bottom % dq->cap];
+		found=1;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return found;
+}
+
+static int wsdeque_steal(wsdeque* dq, wstask* t){
+	int found=0;
+	if (dq->bottom == dq->top) return 0; /* cheap unlocked check */
+	pthread_mutex_lock(&dq->lock);
+	if (dq->bottom > dq->top){
+		*t=dq->buf[dq->top % dq->cap];
+		dq->top++;
+		found=1;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return found;
+}
+
+
+
+/* ========================== SCHEDULING ============================ */
+
+
+static void wspool_push(wspool_* pool, wsdeque* dq, const wstask* t){
+	__sync_add_and_fetch(&pool->unfinished, 1);
+	__sync_add_and_fetch(&pool->queued, 1);
+	wsdeque_push(dq, t);
+	if (pool->sleeping > 0){
+		pthread_mutex_lock(&pool->idle_lock);
+		pthread_cond_signal(&pool->idle_cond);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+}
+
+static void wspool_done(wspool_* pool){
+	if (__sync_sub_and_fetch(&pool->unfinished, 1) == 0){
+		pthread_mutex_lock(&pool->done_lock);
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->done_lock);
+	}
+}
+
+static int wspool_steal(wspool_* pool, wsworker* self, wstask* t){
+	int n=pool->num_threads, k, start;
+	if (n < 2) return 0;
+	start=rand_r(&self->seed) % n;
+	for (k=0; k<n; k++){
+		int v=(start + k) % n;
+		if (v != self->id && wsdeque_steal(&pool->workers[v].dq, t)) return 1;
+	}
+	return 0;
+}
+
+static void wspool_run(wspool_* pool, wsworker* self, wstask* t){
+	if (t->job){
+		t->job(t->arg);
+	}
+	else{
+		long long lo=t->lo, hi=t->hi, i;
+		/* keep the lower half, expose the upper half to thieves */
+		while (hi - lo > t->chunk){
+			wstask half=*t;
+			half.lo=lo + (hi - lo) / 2; half.hi=hi;
+			hi=half.lo;
+			wspool_push(pool, &self->dq, &half);
+		}
+		for (i=lo; i<hi; i++) t->body(t->ctx, i);
+		if (__sync_sub_and_fetch(&t->group->remaining, hi - lo) == 0){
+			pthread_mutex_lock(&t->group->lock);
+			t->group->done=1;
+			pthread_cond_broadcast(&t->group->cond);
+			pthread_mutex_unlock(&t->group->lock);
+		}
+	}
+	wspool_done(pool);
+}
+
+static void* wsworker_do(void* arg){
+	wsworker* self=(wsworker*)arg;
+	wspool_* pool=self->pool;
+	wstask t;
+
+	wsworker_id=self->id;
+	wsworker_pool=pool;
+
+	while (1){
+		if (wsdeque_pop(&self->dq, &t) || wspool_steal(pool, self, &t)){
+			__sync_sub_and_fetch(&pool->queued, 1);
+			wspool_run(pool, self, &t);
+			continue;
+		}
+		if (pool->stop) break;
+
+		/* nothing to do: sleep until somebody pushes a task */
+		pthread_mutex_lock(&pool->idle_lock);
+		__sync_add_and_fetch(&pool->sleeping, 1);
+		while (pool->queued <= 0 && !pool->stop)
+			pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+		__sync_sub_and_fetch(&pool->sleeping, 1);
+		pthread_mutex_unlock(&pool->idle_lock);
+	}
+	return NULL;
+}
+
+
+
+/* ========================== WSPOOL ============================ */
+
+
+struct wspool_* wspool_init(int num_threads){
+	int i;
+	wspool_* pool;
+
+	if (num_threads < 1) num_threads=1;
+
+	pool=(struct wspool_*)calloc(1, sizeof(struct wspool_));
+	if (pool==NULL){
+		fprintf(stderr, "wspool_init(): Could not allocate memory for thread pool\n");
+		exit(1);
+	}
+	pool->num_threads=num_threads;
+	pthread_mutex_init(&pool->idle_lock, NULL);
+	pthread_cond_init(&pool->idle_cond, NULL);
+	pthread_mutex_init(&pool->done_lock, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	pool->workers=(wsworker*)calloc(num_threads, sizeof(wsworker));
+	if (pool->workers==NULL){
+		fprintf(stderr, "wspool_init(): Could not allocate memory for threads\n");
+		exit(1);
+	}
+	for (i=0; i<num_threads; i++){
+		pool->workers[i].id=i;
+		pool->workers[i].seed=i + 1;
+		pool->workers[i].pool=pool;
+		wsdeque_init(&pool->workers[i].dq);
+	}
+	for (i=0; i<num_threads; i++)
+		pthread_create(&pool->workers[i].pthread, NULL, wsworker_do, &pool->workers[i]);
+
+	return pool;
+}
+
+
+int wspool_add_work(wspool_* pool, void *(*function_p)(void*), void* arg_p){
+	wstask t;
+	memset(&t, 0, sizeof(wstask));
+	t.job=function_p;
+	t.arg=arg_p;
+	wspool_push(pool, &pool->workers[__sync_fetch_and_add(&pool->next, 1) % pool->num_threads].dq, &t);
+	return 0;
+}
+
+
+void wspool_parallel_for(wspool_* pool, long long begin, long long end, long long chunk,
+                         void (*function_p)(void* ctx, long long i), void* ctx){
+	wsgroup group;
+	wstask t;
+	long long size=end - begin, step;
+	int i, n=pool->num_threads;
+
+	if (size <= 0) return;
+	if (chunk <= 0){
+		chunk=size / ((long long)n * WSCHUNKS_PER_THREAD);
+		if (chunk < 1) chunk=1;
+	}
+
+	group.remaining=size;
+	group.done=0;
+	pthread_mutex_init(&group.lock, NULL);
+	pthread_cond_init(&group.cond, NULL);
+
+	memset(&t, 0, sizeof(wstask));
+	t.body=function_p; t.ctx=ctx; t.chunk=chunk; t.group=&group;
+
+	/* one contiguous slice per worker; stealing balances the rest */
+	step=(size + n - 1) / n;
+	for (i=0; i<n && begin + i * step < end; i++){
+		t.lo=begin + i * step;
+		t.hi=t.lo + step < end ? t.lo + step : end;
+		wspool_push(pool, &pool->workers[i].dq, &t);
+	}
+
+	if (wsworker_pool==pool){
+		/* nested call from a task: the worker keeps running tasks, its
+		   own pieces first, otherwise it would wait for itself */
+		wsworker* self=&pool->workers[wsworker_id];
+		pthread_mutex_lock(&group.lock);
+		while (!group.done){
+			pthread_mutex_unlock(&group.lock);
+			if (wsdeque_pop(&self->dq, &t) || wspool_steal(pool, self, &t)){
+				__sync_sub_and_fetch(&pool->queued, 1);
+				wspool_run(pool, self, &t);
+				pthread_mutex_lock(&group.lock);
+			}
+			else{
+				/* the last pieces are running elsewhere */
+				struct timeval now;
+				struct timespec until;
+				gettimeofday(&now, NULL);
+				until.tv_sec=now.tv_sec;
+				until.tv_nsec=now.tv_usec * 1000 + 100000;
+				if (until.tv_nsec >= 1000000000){ until.tv_sec++; until.tv_nsec-=1000000000; }
+				pthread_mutex_lock(&group.lock);
+				if (!group.done) pthread_cond_timedwait(&group.cond, &group.lock, &until);
+			}
+		}
+		pthread_mutex_unlock(&group.lock);
+	}
+	else{
+		pthread_mutex_lock(&group.lock);
+		while (!group.done)
+			pthread_cond_wait(&group.cond, &group.lock);
+		pthread_mutex_unlock(&group.lock);
+	}
+
+	pthread_mutex_destroy(&group.lock);
+	pthread_cond_destroy(&group.cond);
+}
+
+
+void wspool_wait(wspool_* pool){
+	if (wsworker_pool==pool){
+		fprintf(stderr, "wspool_wait(): called from a task of the pool\n");
+		exit(1);
+	}
+	pthread_mutex_lock(&pool->done_lock);
+	while (pool->unfinished > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+	pthread_mutex_unlock(&pool->done_lock);
+}
+
+
+int wspool_size(wspool_* pool){
+	return pool->num_threads;
+}
+
+
+int wspool_thread_id(void){
+	return wsworker_id;
+}
+
+
+void wspool_destroy(wspool_* pool){
+	int i;
+	if (pool==NULL) return;
+
+	wspool_wait(pool);
+
+	pthread_mutex_lock(&pool->idle_lock);
+	pool->stop=1;
+	pthread_cond_broadcast(&pool->idle_cond);
+	pthread_mutex_unlock(&pool->idle_lock);
+
+	for (i=0; i<pool->num_threads; i++)
+		pthread_join(pool->workers[i].pthread, NULL);
+
+	for (i=0; i<pool->num_threads; i++){
+		pthread_mutex_destroy(&pool->workers[i].dq.lock);
+		free(pool->workers[i].dq.buf);
+	}
+	free(pool->workers);
+	pthread_mutex_destroy(&pool->idle_lock);
+	pthread_cond_destroy(&pool->idle_cond);
+	pthread_mutex_destroy(&pool->done_lock);
+	pthread_cond_destroy(&pool->done_cond);
+	free(pool);
+}
@@ -0,0 +1,122 @@
+/******************************************************************************
+ IrstLM: IRST Language Model Toolkit
+ Copyright (C) 2006 Marcello Federico, ITC-irst Trento, Italy
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+
+ ******************************************************************************/
+
+/* Work-stealing thread pool.
+ *
+ * Every worker owns a deque of tasks: it pushes and pops at the bottom,
+ * while idle workers steal from the top of the deques of the others.
+ * Ranges of a parallel-for are split lazily and in halves, so that large
+ * pieces of work are stolen first and tiny tasks never go through a
+ * shared queue.
+ */
+
+#ifndef _WSPOOL_
+#define _WSPOOL_
+
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct wspool_* wspool;
+
+
+/**
+ * @brief  Initialize a work-stealing pool
+ *
+ * @param  num_threads   number of worker threads (at least 1)
+ * @return wspool        created pool on success, exits on error
+ */
+wspool wspool_init(int num_threads);
+
+
+/**
+ * @brief  Add a single job
+ *
+ * Jobs submitted from outside the pool are distributed round-robin over
+ * the workers' deques.
+ *
+ * @param  wspool        pool to which the job will be added
+ * @param  function_p    pointer to function to run
+ * @param  arg_p         pointer to its argument
+ * @return 0 on success
+ */
+int wspool_add_work(wspool, void *(*function_p)(void*), void* arg_p);
+
+
+/**
+ * @brief  Run function_p(ctx,i) for every i in [begin,end)
+ *
+ * The range is split among the workers and then halved on demand until
+ * pieces of at most chunk indices are left; idle workers steal the
+ * largest pending pieces. If chunk <= 0 a chunk size is derived from the
+ * range size and the number of workers. Returns when the whole range has
+ * been processed.
+ *
+ * A thread outside the pool only waits for the range. A task of the pool
+ * may call it, too (nested parallel-for): its worker then runs pending
+ * tasks, its own first, until the range is done.
+ *
+ * @example
+ *
+ *    void count(void* ctx, long long i){ ... }
+ *    ..
+ *    wspool_parallel_for(pool, 0, numdoc, 0, count, (void*)this);
+ */
+void wspool_parallel_for(wspool, long long begin, long long end, long long chunk,
+                         void (*function_p)(void* ctx, long long i), void* ctx);
+
+
+/**
+ * @brief  Wait for all added jobs to finish
+ *
+ * Must not be called from a task of the pool, which would wait for itself.
+ */
+void wspool_wait(wspool);
+
+
+/**
+ * @brief  Number of worker threads of the pool
+ */
+int wspool_size(wspool);
+
+
+/**
+ * @brief  Index of the calling worker thread
+ *
+ * Lets jobs address per-thread data, e.g. caches, without locking.
+ *
+ * @return index in [0,wspool_size()) inside a worker, -1 otherwise
+ */
+int wspool_thread_id(void);
+
+
+/**
+ * @brief  Wait for pending jobs, stop the workers and free the pool
+ */
+void wspool_destroy(wspool);
+
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif